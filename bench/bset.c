@@ -0,0 +1,140 @@
+// Time of the operations on the sets of temporaries against their size
+//
+// The liveness, the spiller and the register allocator keep sets of every temporary of a function,
+// so a set has a bit for each of them. Generated functions mostly have sets of 2 to 8 words, and
+// functions of tens of thousands of temporaries, as from unrolled or machine generated code, have
+// hundreds. The sets here are filled with a quarter of the bits set at random, and compared when
+// equal, which is the slowest case
+//
+// Usage: ./bset [words...]
+#include <time.h>
+
+#include "../src/all.h"
+
+#define OPERATIONS (1 << 22)
+#define ITERATIONS 5
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static bits random_word(void) {
+    bits b = 0;
+    for (size_t i = 0; i < 2; i++) {
+        b |= (bits) rand() << (i * 31);
+    }
+    return b & ((bits) rand() << 33 | (bits) rand());
+}
+
+typedef enum {
+    BENCH_UNION,
+    BENCH_INTER,
+    BENCH_DIFF,
+    BENCH_EQUAL,
+    BENCH_COUNT,
+    BENCH_ITER,
+    COUNT_BENCHES
+} Bench;
+
+static const char *bench_names[COUNT_BENCHES] = {"union", "inter", "diff", "equal", "count", "iter"};
+
+static size_t run(Bench kind, BSet *x, BSet *y, BSet *z) {
+    size_t sink = 0;
+    switch (kind) {
+    case BENCH_UNION:
+        qbe_bsunion(x, y);
+        break;
+
+    case BENCH_INTER:
+        qbe_bsinter(x, y);
+        break;
+
+    case BENCH_DIFF:
+        qbe_bsdiff(x, y);
+        break;
+
+    case BENCH_EQUAL:
+        sink = qbe_bsequal(x, z);
+        break;
+
+    case BENCH_COUNT:
+        sink = qbe_bscount(y);
+        break;
+
+    case BENCH_ITER:
+        for (int t = 0; qbe_bsiter(y, &t); t++) {
+            sink += t;
+        }
+        break;
+
+    default:
+        assert(0 && "unreachable");
+    }
+    return sink;
+}
+
+// Nanoseconds per operation, the best of a few runs
+static double bench(Bench kind, uint words) {
+    bits *a = malloc(words * sizeof(*a));
+    bits *b = malloc(words * sizeof(*b));
+    bits *c = malloc(words * sizeof(*c));
+    for (uint i = 0; i < words; i++) {
+        a[i] = random_word();
+        b[i] = random_word();
+        c[i] = a[i];
+    }
+
+    BSet x = {.nt = words, .t = a}, y = {.nt = words, .t = b}, z = {.nt = words, .t = c};
+
+    const size_t count = OPERATIONS / words;
+    size_t       sink = 0;
+    double       best = 0;
+    for (size_t k = 0; k < ITERATIONS; k++) {
+        const double start = now();
+        for (size_t i = 0; i < count; i++) {
+            sink += run(kind, &x, &y, &z);
+        }
+
+        const double elapsed = now() - start;
+        best = !k || elapsed < best ? elapsed : best;
+    }
+
+    // Keeps the results alive
+    if (sink == 1) {
+        putchar(' ');
+    }
+
+    free(a);
+    free(b);
+    free(c);
+    return best / count;
+}
+
+int main(int argc, char **argv) {
+    const char *words_default[] = {"2", "4", "8", "16", "64", "256", "1024"};
+
+    const char **words = (const char **) argv + 1;
+    size_t       words_count = argc - 1;
+    if (!words_count) {
+        words = words_default;
+        words_count = sizeof(words_default) / sizeof(*words_default);
+    }
+
+    printf("%8s", "Words");
+    for (size_t i = 0; i < COUNT_BENCHES; i++) {
+        printf(" %10s", bench_names[i]);
+    }
+    printf("   (ns)\n");
+
+    for (size_t i = 0; i < words_count; i++) {
+        const uint n = strtoul(words[i], NULL, 10);
+        printf("%8u", n ? n : 1);
+        for (size_t j = 0; j < COUNT_BENCHES; j++) {
+            printf(" %10.1f", bench(j, n ? n : 1));
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+}
@@ -0,0 +1,70 @@
+// Time to generate a function against the number of distinct constants in it
+//
+// The function stores every constant through a pointer argument in a single block, so that the rest
+// of the backend does as little as possible per constant. Half of them are integers, which are
+// interned per function, and half are floating point, which are interned per module as labels
+//
+// Usage: ./consts [constants...]
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "qbe.h"
+
+#define ITERATIONS 5
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void build(Qbe *q, size_t count) {
+    QbeFn   *fn = qbe_fn_new(q, qbe_sv_from_cstr("consts"), qbe_type_basic(QBE_TYPE_I32));
+    QbeNode *i = qbe_fn_add_arg(q, fn, qbe_type_basic(QBE_TYPE_I64));
+    QbeNode *f = qbe_fn_add_arg(q, fn, qbe_type_basic(QBE_TYPE_I64));
+    for (size_t k = 0; k < count / 2; k++) {
+        qbe_build_store(q, fn, i, qbe_atom_int(q, QBE_TYPE_I64, k * 0x9e3779b97f4a7c15ull));
+        qbe_build_store(q, fn, f, qbe_atom_float(q, QBE_TYPE_F64, k + 0.5));
+    }
+    qbe_build_return(q, fn, qbe_atom_int(q, QBE_TYPE_I32, 0));
+}
+
+static double bench(size_t count) {
+    double best = 0;
+    for (size_t k = 0; k < ITERATIONS; k++) {
+        Qbe *q = qbe_new();
+        build(q, count);
+
+        QbeSV        out;
+        const double start = now();
+        if (qbe_generate_asm(q, QBE_TARGET_DEFAULT, &out)) {
+            fprintf(stderr, "ERROR: Compilation failed\n");
+            exit(1);
+        }
+
+        const double elapsed = now() - start;
+        best = !k || elapsed < best ? elapsed : best;
+        qbe_free(q);
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    const char *counts_default[] = {"25000", "50000", "100000"};
+
+    const char **counts = (const char **) argv + 1;
+    size_t       counts_count = argc - 1;
+    if (!counts_count) {
+        counts = counts_default;
+        counts_count = sizeof(counts_default) / sizeof(*counts_default);
+    }
+
+    printf("%10s %14s %14s\n", "Constants", "Time (ms)", "Per each (ns)");
+    for (size_t i = 0; i < counts_count; i++) {
+        const size_t n = strtoull(counts[i], NULL, 10);
+        const double t = bench(n);
+        printf("%10zu %14.1f %14.1f\n", n, t / 1e3, n ? t * 1e3 / n : 0);
+        fflush(stdout);
+    }
+}
@@ -0,0 +1,223 @@
+// Throughput and latency of the compile server against a process per compilation
+//
+// A module of a few hundred functions is generated into assembly: by spawning a process that builds
+// and generates it, as a tool linking the library would, and by sending its binary and textual IL to
+// a server from a number of concurrent clients. The server runs one worker per client, so that no
+// client waits for a connection
+//
+// Usage: ./server [clients...]
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "qbe.h"
+
+#define FUNCTIONS 200
+#define REQUESTS  50
+
+extern char **environ;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// fn_i(x) = sum of (x * k) ^ i for k in [0, x)
+static void build(Qbe *q) {
+    for (size_t i = 0; i < FUNCTIONS; i++) {
+        char *name = malloc(32);
+        snprintf(name, 32, "fn_%zu", i);
+
+        QbeFn   *fn = qbe_fn_new(q, qbe_sv_from_cstr(name), qbe_type_basic(QBE_TYPE_I64));
+        QbeNode *x = qbe_fn_add_arg(q, fn, qbe_type_basic(QBE_TYPE_I64));
+        QbeNode *k = qbe_fn_add_var(q, fn, qbe_type_basic(QBE_TYPE_I64));
+        QbeNode *sum = qbe_fn_add_var(q, fn, qbe_type_basic(QBE_TYPE_I64));
+        qbe_build_store(q, fn, k, qbe_atom_int(q, QBE_TYPE_I64, 0));
+        qbe_build_store(q, fn, sum, qbe_atom_int(q, QBE_TYPE_I64, 0));
+
+        QbeBlock *cond = qbe_block_new(q);
+        QbeBlock *body = qbe_block_new(q);
+        QbeBlock *done = qbe_block_new(q);
+
+        qbe_build_block(q, fn, cond);
+        QbeNode *kv = qbe_build_load(q, fn, k, qbe_type_basic(QBE_TYPE_I64), true);
+        QbeNode *lt = qbe_build_binary(q, fn, QBE_BINARY_SLT, qbe_type_basic(QBE_TYPE_I64), kv, x);
+        qbe_build_branch(q, fn, lt, body, done);
+
+        qbe_build_block(q, fn, body);
+        QbeNode *t = qbe_build_binary(q, fn, QBE_BINARY_MUL, qbe_type_basic(QBE_TYPE_I64), x, kv);
+        t = qbe_build_binary(q, fn, QBE_BINARY_XOR, qbe_type_basic(QBE_TYPE_I64), t, qbe_atom_int(q, QBE_TYPE_I64, i));
+        QbeNode *s = qbe_build_load(q, fn, sum, qbe_type_basic(QBE_TYPE_I64), true);
+        qbe_build_store(q, fn, sum, qbe_build_binary(q, fn, QBE_BINARY_ADD, qbe_type_basic(QBE_TYPE_I64), s, t));
+        qbe_build_store(
+            q, fn, k, qbe_build_binary(q, fn, QBE_BINARY_ADD, qbe_type_basic(QBE_TYPE_I64), kv, qbe_atom_int(q, QBE_TYPE_I64, 1)));
+        qbe_build_jump(q, fn, cond);
+
+        qbe_build_block(q, fn, done);
+        qbe_build_return(q, fn, qbe_build_load(q, fn, sum, qbe_type_basic(QBE_TYPE_I64), true));
+    }
+}
+
+// The baseline, run as a process of its own
+static int once(void) {
+    Qbe *q = qbe_new();
+    build(q);
+
+    QbeSV out;
+    const int code = qbe_generate_asm(q, QBE_TARGET_DEFAULT, &out);
+    qbe_free(q);
+    return code;
+}
+
+static double bench_process(const char *self) {
+    char *const argv[] = {(char *) self, "--once", NULL};
+
+    double total = 0;
+    for (size_t i = 0; i < REQUESTS; i++) {
+        pid_t        pid;
+        int          status;
+        const double start = now();
+        if (posix_spawn(&pid, self, NULL, NULL, argv, environ) || waitpid(pid, &status, 0) < 0 || status) {
+            fprintf(stderr, "ERROR: Compilation in a process failed\n");
+            exit(1);
+        }
+        total += now() - start;
+    }
+    return total / REQUESTS;
+}
+
+typedef struct {
+    const char *path;
+    QbeSV       program;
+    double      latencies[REQUESTS];
+} Client;
+
+static void *client_run(void *arg) {
+    Client    *c = arg;
+    QbeClient *client = qbe_client_new(c->path);
+    if (!client) {
+        fprintf(stderr, "ERROR: Could not connect to the server\n");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < REQUESTS; i++) {
+        QbeSV        out;
+        const double start = now();
+        if (qbe_client_generate(client, c->program, QBE_TARGET_DEFAULT, false, &out)) {
+            fprintf(stderr, "ERROR: Compilation in the server failed\n");
+            exit(1);
+        }
+        c->latencies[i] = now() - start;
+    }
+
+    qbe_client_free(client);
+    return NULL;
+}
+
+static int compare(const void *a, const void *b) {
+    const double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static void bench_server(const char *path, const char *form, QbeSV program, size_t clients_count) {
+    Client    *clients = calloc(clients_count, sizeof(*clients));
+    pthread_t *threads = calloc(clients_count, sizeof(*threads));
+
+    const double start = now();
+    for (size_t i = 0; i < clients_count; i++) {
+        clients[i] = (Client) {.path = path, .program = program};
+        pthread_create(&threads[i], NULL, client_run, &clients[i]);
+    }
+    for (size_t i = 0; i < clients_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    const double elapsed = now() - start;
+
+    const size_t count = clients_count * REQUESTS;
+    double      *latencies = malloc(count * sizeof(*latencies));
+    for (size_t i = 0; i < clients_count; i++) {
+        memcpy(latencies + i * REQUESTS, clients[i].latencies, sizeof(clients[i].latencies));
+    }
+    qsort(latencies, count, sizeof(*latencies), compare);
+
+    printf("%8s %8zu %14.1f %14.1f %14.1f\n",
+           form,
+           clients_count,
+           count / (elapsed / 1e6),
+           latencies[count / 2],
+           latencies[count * 99 / 100]);
+    fflush(stdout);
+
+    free(latencies);
+    free(threads);
+    free(clients);
+}
+
+int main(int argc, char **argv) {
+    if (argc == 2 && !strcmp(argv[1], "--once")) {
+        return once();
+    }
+
+    const char *clients_default[] = {"1", "2", "4", "8"};
+
+    const char **clients = (const char **) argv + 1;
+    size_t       clients_count = argc - 1;
+    if (!clients_count) {
+        clients = clients_default;
+        clients_count = sizeof(clients_default) / sizeof(*clients_default);
+    }
+
+    size_t workers = 1;
+    for (size_t i = 0; i < clients_count; i++) {
+        const size_t n = strtoull(clients[i], NULL, 10);
+        workers = n > workers ? n : workers;
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/qbe-bench-%d.sock", (int) getpid());
+
+    const pid_t server = fork();
+    if (server == 0) {
+        return qbe_serve(path, workers);
+    }
+
+    // Wait for the server to come up
+    for (size_t i = 0;; i++) {
+        QbeClient *c = qbe_client_new(path);
+        if (c) {
+            qbe_client_free(c);
+            break;
+        }
+
+        if (i == 1000) {
+            fprintf(stderr, "ERROR: The server did not come up\n");
+            return 1;
+        }
+        usleep(1000);
+    }
+
+    Qbe *q = qbe_new();
+    build(q);
+    QbeSV binary = qbe_get_binary_program(q);
+    qbe_compile(q);
+    QbeSV text = qbe_get_compiled_program(q);
+
+    printf("Process per compilation: %.1f us\n\n", bench_process(argv[0]));
+    printf("%8s %8s %14s %14s %14s\n", "IL", "Clients", "Requests/s", "p50 (us)", "p99 (us)");
+    for (size_t i = 0; i < clients_count; i++) {
+        const size_t n = strtoull(clients[i], NULL, 10);
+        bench_server(path, "binary", binary, n ? n : 1);
+        bench_server(path, "text", text, n ? n : 1);
+    }
+
+    qbe_free(q);
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+}
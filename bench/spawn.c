@@ -0,0 +1,115 @@
+// Latency of launching the toolchain against the resident size of the host process
+//
+// The host is grown by touching memory, then every iteration measures how long it takes until the
+// process is running: with fork() and exec, with posix_spawn(), and with qbe_generate_async(), which
+// also includes the backend of an empty program. The toolchain itself is waited for outside of the
+// measurement
+//
+// Usage: ./spawn [MB...]
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "qbe.h"
+
+#define ITERATIONS 50
+
+extern char **environ;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static double bench_fork(void) {
+    double total = 0;
+    for (size_t i = 0; i < ITERATIONS; i++) {
+        const double start = now();
+        const pid_t  pid = fork();
+        if (pid == 0) {
+            execlp("true", "true", (char *) NULL);
+            _exit(127);
+        }
+        total += now() - start;
+        waitpid(pid, NULL, 0);
+    }
+    return total / ITERATIONS;
+}
+
+static double bench_spawn(void) {
+    char *const argv[] = {"true", NULL};
+
+    double total = 0;
+    for (size_t i = 0; i < ITERATIONS; i++) {
+        pid_t        pid;
+        const double start = now();
+        if (posix_spawnp(&pid, "true", NULL, NULL, argv, environ)) {
+            fprintf(stderr, "ERROR: Could not spawn 'true'\n");
+            exit(1);
+        }
+        total += now() - start;
+        waitpid(pid, NULL, 0);
+    }
+    return total / ITERATIONS;
+}
+
+static double bench_qbe(void) {
+    const char *flags[] = {"-c"};
+
+    Qbe   *q = qbe_new();
+    double total = 0;
+    for (size_t i = 0; i < ITERATIONS; i++) {
+        qbe_reset(q);
+        QbeFn *main = qbe_fn_new(q, qbe_sv_from_cstr("main"), qbe_type_basic(QBE_TYPE_I32));
+        qbe_build_return(q, main, qbe_atom_int(q, QBE_TYPE_I32, 0));
+
+        const double start = now();
+        QbeAsync    *a = qbe_generate_async(q, QBE_TARGET_DEFAULT, "/dev/null", flags, 1);
+        total += now() - start;
+
+        if (qbe_wait(a)) {
+            fprintf(stderr, "ERROR: Generation exited abnormally\n");
+            exit(1);
+        }
+    }
+    qbe_free(q);
+    return total / ITERATIONS;
+}
+
+int main(int argc, char **argv) {
+    const char *sizes_default[] = {"0", "256", "1024"};
+
+    const char **sizes = (const char **) argv + 1;
+    size_t       sizes_count = argc - 1;
+    if (!sizes_count) {
+        sizes = sizes_default;
+        sizes_count = sizeof(sizes_default) / sizeof(*sizes_default);
+    }
+
+    printf("%10s %14s %14s %14s\n", "RSS (MB)", "fork (us)", "spawn (us)", "qbe (us)");
+
+    char  *host = NULL;
+    size_t host_size = 0;
+    for (size_t i = 0; i < sizes_count; i++) {
+        const size_t size = strtoull(sizes[i], NULL, 10) << 20;
+        if (size > host_size) {
+            host = realloc(host, size);
+            if (!host) {
+                fprintf(stderr, "ERROR: Could not allocate %s MB\n", sizes[i]);
+                return 1;
+            }
+            memset(host + host_size, 1, size - host_size);
+            host_size = size;
+        }
+
+        printf("%10zu %14.1f %14.1f %14.1f\n", host_size >> 20, bench_fork(), bench_spawn(), bench_qbe());
+        fflush(stdout);
+    }
+
+    free(host);
+}
@@ -1,5 +1,8 @@
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "qbe.h"
 
@@ -13,6 +16,13 @@ static void generate_executable(Qbe *q, const char *name, const char **link_flag
     }
 }
 
+static void generate_end(Qbe *q, const char *name) {
+    const int code = qbe_generate_end(q);
+    if (code) {
+        fprintf(stderr, "ERROR: Generation of '%s' exited abnormally with code %d\n", name, code);
+    }
+}
+
 // Examples
 static void example_if(void) {
     Qbe *q = qbe_new();
@@ -463,6 +473,776 @@ static void example_var_init(void) {
     qbe_free(q);
 }
 
+static void example_stream(void) {
+    Qbe *q = qbe_new();
+
+    const int code = qbe_generate_begin(q, QBE_TARGET_DEFAULT, "example_stream", NULL, 0);
+    if (code) {
+        fprintf(stderr, "ERROR: Generation of 'example_stream' exited abnormally with code %d\n", code);
+        qbe_free(q);
+        return;
+    }
+
+    // The backend is done with each function before the next one is built
+    QbeFn *square = qbe_fn_new(q, (QbeSV) {0}, qbe_type_basic(QBE_TYPE_I64));
+    {
+        QbeNode *x = qbe_fn_add_arg(q, square, qbe_type_basic(QBE_TYPE_I64));
+        qbe_build_return(q, square, qbe_build_binary(q, square, QBE_BINARY_MUL, qbe_type_basic(QBE_TYPE_I64), x, x));
+    }
+    qbe_fn_finish(q, square);
+
+    QbeFn *main = qbe_fn_new(q, qbe_sv_from_cstr("main"), qbe_type_basic(QBE_TYPE_I32));
+    {
+        QbeCall *squared = qbe_call_new(q, (QbeNode *) square, qbe_type_basic(QBE_TYPE_I64));
+        qbe_call_add_arg(q, squared, qbe_atom_int(q, QBE_TYPE_I64, 12));
+        qbe_build_call(q, main, squared);
+
+        QbeNode *printf = qbe_atom_extern_fn(q, qbe_sv_from_cstr("printf"));
+        QbeCall *call = qbe_call_new(q, printf, qbe_type_basic(QBE_TYPE_I32));
+        qbe_call_add_arg(q, call, qbe_str_new(q, qbe_sv_from_cstr("%ld\n")));
+        qbe_call_start_variadic(q, call);
+        qbe_call_add_arg(q, call, (QbeNode *) squared);
+        qbe_build_call(q, main, call);
+
+        qbe_build_return(q, main, qbe_atom_int(q, QBE_TYPE_I32, 0));
+    }
+    qbe_fn_finish(q, main);
+
+    // The string literal is emitted here, along with the rest of the data
+    generate_end(q, "example_stream");
+    qbe_free(q);
+}
+
+static void example_binary(void) {
+    Qbe *q = qbe_new();
+
+    {
+        QbeFn   *main = qbe_fn_new(q, qbe_sv_from_cstr("main"), qbe_type_basic(QBE_TYPE_I32));
+        QbeNode *printf = qbe_atom_extern_fn(q, qbe_sv_from_cstr("printf"));
+
+        QbeCall *call = qbe_call_new(q, printf, qbe_type_basic(QBE_TYPE_I32));
+        qbe_call_add_arg(q, call, qbe_str_new(q, qbe_sv_from_cstr("%.17g\n")));
+        qbe_call_start_variadic(q, call);
+        qbe_call_add_arg(q, call, qbe_atom_float(q, QBE_TYPE_F64, 0.1 + 0.2));
+        qbe_build_call(q, main, call);
+
+        qbe_build_return(q, main, qbe_atom_int(q, QBE_TYPE_I32, 0));
+    }
+
+    // The binary IL can be saved and generated later, even by another process
+    QbeSV program = qbe_get_binary_program(q);
+
+    const int code = qbe_generate_binary(program, QBE_TARGET_DEFAULT, "example_binary", NULL, 0);
+    if (code) {
+        fprintf(stderr, "ERROR: Generation of 'example_binary' exited abnormally with code %d\n", code);
+    }
+    qbe_free(q);
+}
+
+static void example_reset(void) {
+    Qbe *q = qbe_new();
+
+    // The same context builds several programs, reusing its memory between them
+    const char *names[] = {"example_reset_first", "example_reset_second"};
+    for (size_t i = 0; i < len(names); i++) {
+        qbe_reset(q);
+
+        QbeFn   *main = qbe_fn_new(q, qbe_sv_from_cstr("main"), qbe_type_basic(QBE_TYPE_I32));
+        QbeNode *printf = qbe_atom_extern_fn(q, qbe_sv_from_cstr("printf"));
+
+        QbeCall *call = qbe_call_new(q, printf, qbe_type_basic(QBE_TYPE_I32));
+        qbe_call_add_arg(q, call, qbe_str_new(q, qbe_sv_from_cstr("%s\n")));
+        qbe_call_start_variadic(q, call);
+        qbe_call_add_arg(q, call, qbe_str_new(q, qbe_sv_from_cstr(names[i])));
+        qbe_build_call(q, main, call);
+
+        qbe_build_return(q, main, qbe_atom_int(q, QBE_TYPE_I32, 0));
+        generate_executable(q, names[i], NULL, 0);
+    }
+
+    qbe_free(q);
+}
+
+static void *example_threads_worker(void *arg) {
+    const char *name = arg;
+    Qbe        *q = qbe_new();
+
+    {
+        QbeFn   *main = qbe_fn_new(q, qbe_sv_from_cstr("main"), qbe_type_basic(QBE_TYPE_I32));
+        QbeNode *puts = qbe_atom_extern_fn(q, qbe_sv_from_cstr("puts"));
+
+        QbeCall *call = qbe_call_new(q, puts, qbe_type_basic(QBE_TYPE_I32));
+        qbe_call_add_arg(q, call, qbe_str_new(q, qbe_sv_from_cstr(name)));
+        qbe_build_call(q, main, call);
+
+        qbe_build_return(q, main, qbe_atom_int(q, QBE_TYPE_I32, 0));
+    }
+
+    // Compile
+    generate_executable(q, name, NULL, 0);
+    qbe_free(q);
+    return NULL;
+}
+
+static void example_threads(void) {
+    // Independent contexts can generate concurrently
+    const char *names[] = {"example_threads_0", "example_threads_1", "example_threads_2", "example_threads_3"};
+
+    pthread_t threads[len(names)];
+    for (size_t i = 0; i < len(names); i++) {
+        pthread_create(&threads[i], NULL, example_threads_worker, (void *) names[i]);
+    }
+
+    for (size_t i = 0; i < len(names); i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+static void example_parallel(void) {
+    Qbe *q = qbe_new();
+
+    {
+        QbeFn   *main = qbe_fn_new(q, qbe_sv_from_cstr("main"), qbe_type_basic(QBE_TYPE_I32));
+        QbeNode *printf = qbe_atom_extern_fn(q, qbe_sv_from_cstr("printf"));
+
+        QbeCall *print = qbe_call_new(q, printf, qbe_type_basic(QBE_TYPE_I32));
+        qbe_call_add_arg(q, print, qbe_str_new(q, qbe_sv_from_cstr("%g\n")));
+        qbe_call_start_variadic(q, print);
+
+        // scale(x) = x * factor, one function per factor
+        QbeNode *sum = qbe_atom_float(q, QBE_TYPE_F64, 0);
+        for (size_t i = 0; i < 4; i++) {
+            QbeFn   *scale = qbe_fn_new(q, (QbeSV) {0}, qbe_type_basic(QBE_TYPE_F64));
+            QbeNode *x = qbe_fn_add_arg(q, scale, qbe_type_basic(QBE_TYPE_F64));
+            QbeNode *factor = qbe_atom_float(q, QBE_TYPE_F64, 1.5 * (i + 1));
+            qbe_build_return(
+                q, scale, qbe_build_binary(q, scale, QBE_BINARY_MUL, qbe_type_basic(QBE_TYPE_F64), x, factor));
+
+            QbeCall *call = qbe_call_new(q, (QbeNode *) scale, qbe_type_basic(QBE_TYPE_F64));
+            qbe_call_add_arg(q, call, qbe_atom_float(q, QBE_TYPE_F64, 2));
+            qbe_build_call(q, main, call);
+            sum = qbe_build_binary(q, main, QBE_BINARY_ADD, qbe_type_basic(QBE_TYPE_F64), sum, (QbeNode *) call);
+        }
+
+        qbe_call_add_arg(q, print, sum);
+        qbe_build_call(q, main, print);
+        qbe_build_return(q, main, qbe_atom_int(q, QBE_TYPE_I32, 0));
+    }
+
+    // Compile
+    const int code = qbe_generate_parallel(q, QBE_TARGET_DEFAULT, "example_parallel", NULL, 0, 4);
+    if (code) {
+        fprintf(stderr, "ERROR: Generation of 'example_parallel' exited abnormally with code %d\n", code);
+    }
+    qbe_free(q);
+}
+
+static void example_object(void) {
+    Qbe *q = qbe_new();
+
+    {
+        QbeFn   *main = qbe_fn_new(q, qbe_sv_from_cstr("main"), qbe_type_basic(QBE_TYPE_I32));
+        QbeNode *printf = qbe_atom_extern_fn(q, qbe_sv_from_cstr("printf"));
+
+        // for (i = 1; i <= 5; i++) printf("%d! = %ld\n", i, fact *= i)
+        QbeNode *i = qbe_fn_add_var(q, main, qbe_type_basic(QBE_TYPE_I32));
+        QbeNode *fact = qbe_fn_add_var(q, main, qbe_type_basic(QBE_TYPE_I64));
+        qbe_build_store(q, main, i, qbe_atom_int(q, QBE_TYPE_I32, 1));
+        qbe_build_store(q, main, fact, qbe_atom_int(q, QBE_TYPE_I64, 1));
+
+        QbeBlock *cond = qbe_block_new(q);
+        QbeBlock *body = qbe_block_new(q);
+        QbeBlock *over = qbe_block_new(q);
+
+        qbe_build_block(q, main, cond);
+        QbeNode *iv = qbe_build_load(q, main, i, qbe_type_basic(QBE_TYPE_I32), true);
+        qbe_build_branch(
+            q,
+            main,
+            qbe_build_binary(
+                q, main, QBE_BINARY_SLE, qbe_type_basic(QBE_TYPE_I32), iv, qbe_atom_int(q, QBE_TYPE_I32, 5)),
+            body,
+            over);
+
+        qbe_build_block(q, main, body);
+        QbeNode *next = qbe_build_binary(
+            q,
+            main,
+            QBE_BINARY_MUL,
+            qbe_type_basic(QBE_TYPE_I64),
+            qbe_build_load(q, main, fact, qbe_type_basic(QBE_TYPE_I64), true),
+            qbe_build_cast(q, main, iv, QBE_TYPE_I64, true));
+        qbe_build_store(q, main, fact, next);
+
+        QbeCall *print = qbe_call_new(q, printf, qbe_type_basic(QBE_TYPE_I32));
+        qbe_call_add_arg(q, print, qbe_str_new(q, qbe_sv_from_cstr("%d! = %ld\n")));
+        qbe_call_start_variadic(q, print);
+        qbe_call_add_arg(q, print, iv);
+        qbe_call_add_arg(q, print, next);
+        qbe_build_call(q, main, print);
+
+        qbe_build_store(
+            q,
+            main,
+            i,
+            qbe_build_binary(q, main, QBE_BINARY_ADD, qbe_type_basic(QBE_TYPE_I32), iv, qbe_atom_int(q, QBE_TYPE_I32, 1)));
+        qbe_build_jump(q, main, cond);
+
+        qbe_build_block(q, main, over);
+        qbe_build_return(q, main, qbe_atom_int(q, QBE_TYPE_I32, 0));
+    }
+
+    // Compile, without going through the assembler
+    const int code = qbe_generate_object(q, QBE_TARGET_X86_64_LINUX, "example_object.o");
+    if (code) {
+        fprintf(stderr, "ERROR: Generation of 'example_object' exited abnormally with code %d\n", code);
+    } else if (system("cc -o example_object example_object.o")) {
+        fprintf(stderr, "ERROR: Linking of 'example_object' failed\n");
+    }
+    qbe_free(q);
+}
+
+static long example_jit_square(long x) {
+    return x * x;
+}
+
+static void *example_jit_resolve(void *user, const char *name) {
+    (void) user;
+    if (!strcmp(name, "square")) {
+        return (void *) example_jit_square;
+    }
+    return NULL; // Everything else comes from the host, like printf()
+}
+
+static void example_jit(void) {
+    Qbe *q = qbe_new();
+
+    {
+        // sum_squares(n) = square(1) + ... + square(n)
+        QbeFn   *sum = qbe_fn_new(q, qbe_sv_from_cstr("sum_squares"), qbe_type_basic(QBE_TYPE_I64));
+        QbeNode *n = qbe_fn_add_arg(q, sum, qbe_type_basic(QBE_TYPE_I64));
+        QbeNode *i = qbe_fn_add_var(q, sum, qbe_type_basic(QBE_TYPE_I64));
+        QbeNode *acc = qbe_fn_add_var(q, sum, qbe_type_basic(QBE_TYPE_I64));
+        qbe_build_store(q, sum, i, qbe_atom_int(q, QBE_TYPE_I64, 1));
+        qbe_build_store(q, sum, acc, qbe_atom_int(q, QBE_TYPE_I64, 0));
+
+        QbeBlock *cond = qbe_block_new(q);
+        QbeBlock *body = qbe_block_new(q);
+        QbeBlock *over = qbe_block_new(q);
+
+        qbe_build_block(q, sum, cond);
+        QbeNode *iv = qbe_build_load(q, sum, i, qbe_type_basic(QBE_TYPE_I64), true);
+        qbe_build_branch(
+            q, sum, qbe_build_binary(q, sum, QBE_BINARY_SLE, qbe_type_basic(QBE_TYPE_I32), iv, n), body, over);
+
+        qbe_build_block(q, sum, body);
+        QbeCall *square = qbe_call_new(q, qbe_atom_extern_fn(q, qbe_sv_from_cstr("square")), qbe_type_basic(QBE_TYPE_I64));
+        qbe_call_add_arg(q, square, iv);
+        qbe_build_call(q, sum, square);
+        qbe_build_store(
+            q,
+            sum,
+            acc,
+            qbe_build_binary(
+                q,
+                sum,
+                QBE_BINARY_ADD,
+                qbe_type_basic(QBE_TYPE_I64),
+                qbe_build_load(q, sum, acc, qbe_type_basic(QBE_TYPE_I64), true),
+                (QbeNode *) square));
+        qbe_build_store(
+            q,
+            sum,
+            i,
+            qbe_build_binary(q, sum, QBE_BINARY_ADD, qbe_type_basic(QBE_TYPE_I64), iv, qbe_atom_int(q, QBE_TYPE_I64, 1)));
+        qbe_build_jump(q, sum, cond);
+
+        qbe_build_block(q, sum, over);
+        QbeNode *result = qbe_build_load(q, sum, acc, qbe_type_basic(QBE_TYPE_I64), true);
+
+        QbeCall *print = qbe_call_new(q, qbe_atom_extern_fn(q, qbe_sv_from_cstr("printf")), qbe_type_basic(QBE_TYPE_I32));
+        qbe_call_add_arg(q, print, qbe_str_new(q, qbe_sv_from_cstr("sum_squares(%ld) = %ld\n")));
+        qbe_call_start_variadic(q, print);
+        qbe_call_add_arg(q, print, n);
+        qbe_call_add_arg(q, print, result);
+        qbe_build_call(q, sum, print);
+        qbe_build_return(q, sum, result);
+    }
+
+    // Compile into memory and call it right away
+    QbeJit *jit = qbe_jit_with_resolver(q, example_jit_resolve, NULL);
+    qbe_free(q);
+    if (!jit) {
+        fprintf(stderr, "ERROR: JIT compilation of 'example_jit' failed\n");
+        return;
+    }
+
+    long (*sum_squares)(long) = (long (*)(long)) qbe_jit_lookup(jit, "sum_squares");
+    printf("Returned %ld\n", sum_squares(10));
+    qbe_jit_free(jit);
+}
+
+static void example_asm(void) {
+    Qbe *q = qbe_new();
+
+    {
+        QbeFn   *main = qbe_fn_new(q, qbe_sv_from_cstr("main"), qbe_type_basic(QBE_TYPE_I32));
+        QbeNode *puts = qbe_atom_extern_fn(q, qbe_sv_from_cstr("puts"));
+
+        QbeCall *call = qbe_call_new(q, puts, qbe_type_basic(QBE_TYPE_I32));
+        qbe_call_add_arg(q, call, qbe_str_new(q, qbe_sv_from_cstr("Assembled from memory")));
+        qbe_build_call(q, main, call);
+        qbe_build_return(q, main, qbe_atom_int(q, QBE_TYPE_I32, 0));
+    }
+
+    // Generate the assembly into memory, it's up to the caller what to do with it
+    QbeSV     asm_text;
+    const int code = qbe_generate_asm(q, QBE_TARGET_DEFAULT, &asm_text);
+    if (code) {
+        fprintf(stderr, "ERROR: Generation of 'example_asm' exited abnormally with code %d\n", code);
+        qbe_free(q);
+        return;
+    }
+
+    FILE *f = fopen("example_asm.s", "w");
+    if (f) {
+        fwrite(asm_text.data, 1, asm_text.count, f);
+        fclose(f);
+    }
+
+    if (!f || system("cc -o example_asm example_asm.s")) {
+        fprintf(stderr, "ERROR: Assembling of 'example_asm' failed\n");
+    }
+    qbe_free(q);
+}
+
+static void example_cache(void) {
+    // Start out cold, so that the statistics are the same on every run
+    if (system("rm -rf example_cache.d")) {
+        fprintf(stderr, "ERROR: Could not clear the cache of 'example_cache'\n");
+        return;
+    }
+
+    // The second context generates the exact same program, so everything comes from the cache
+    for (size_t i = 0; i < 2; i++) {
+        Qbe *q = qbe_new();
+        qbe_set_cache_dir(q, "example_cache.d");
+
+        {
+            QbeFn   *main = qbe_fn_new(q, qbe_sv_from_cstr("main"), qbe_type_basic(QBE_TYPE_I32));
+            QbeNode *printf = qbe_atom_extern_fn(q, qbe_sv_from_cstr("printf"));
+
+            // half(x) = x * 0.5
+            QbeFn   *half = qbe_fn_new(q, qbe_sv_from_cstr("half"), qbe_type_basic(QBE_TYPE_F64));
+            QbeNode *x = qbe_fn_add_arg(q, half, qbe_type_basic(QBE_TYPE_F64));
+            qbe_build_return(
+                q,
+                half,
+                qbe_build_binary(
+                    q, half, QBE_BINARY_MUL, qbe_type_basic(QBE_TYPE_F64), x, qbe_atom_float(q, QBE_TYPE_F64, 0.5)));
+
+            QbeCall *call = qbe_call_new(q, (QbeNode *) half, qbe_type_basic(QBE_TYPE_F64));
+            qbe_call_add_arg(q, call, qbe_atom_float(q, QBE_TYPE_F64, 69));
+            qbe_build_call(q, main, call);
+
+            QbeCall *print = qbe_call_new(q, printf, qbe_type_basic(QBE_TYPE_I32));
+            qbe_call_add_arg(q, print, qbe_str_new(q, qbe_sv_from_cstr("%g\n")));
+            qbe_call_start_variadic(q, print);
+            qbe_call_add_arg(q, print, (QbeNode *) call);
+            qbe_build_call(q, main, print);
+            qbe_build_return(q, main, qbe_atom_int(q, QBE_TYPE_I32, 0));
+        }
+
+        generate_executable(q, "example_cache", NULL, 0);
+
+        size_t hits, misses;
+        qbe_get_cache_stats(q, &hits, &misses);
+        printf("Cache: %zu hits, %zu misses\n", hits, misses);
+        qbe_free(q);
+    }
+}
+
+// A module of a few functions, where only 'scale' depends on the factor
+static void example_incremental_build(Qbe *q, size_t factor) {
+    QbeFn   *main = qbe_fn_new(q, qbe_sv_from_cstr("main"), qbe_type_basic(QBE_TYPE_I32));
+    QbeNode *printf = qbe_atom_extern_fn(q, qbe_sv_from_cstr("printf"));
+
+    QbeFn   *scale = qbe_fn_new(q, qbe_sv_from_cstr("scale"), qbe_type_basic(QBE_TYPE_I64));
+    QbeNode *x = qbe_fn_add_arg(q, scale, qbe_type_basic(QBE_TYPE_I64));
+    qbe_build_return(
+        q,
+        scale,
+        qbe_build_binary(
+            q, scale, QBE_BINARY_MUL, qbe_type_basic(QBE_TYPE_I64), x, qbe_atom_int(q, QBE_TYPE_I64, factor)));
+
+    const char *names[] = {"inc1", "inc2", "inc3"};
+    QbeNode    *value = qbe_atom_int(q, QBE_TYPE_I64, 1);
+    for (size_t i = 0; i < len(names); i++) {
+        QbeFn   *inc = qbe_fn_new(q, qbe_sv_from_cstr(names[i]), qbe_type_basic(QBE_TYPE_I64));
+        QbeNode *y = qbe_fn_add_arg(q, inc, qbe_type_basic(QBE_TYPE_I64));
+        qbe_build_return(
+            q,
+            inc,
+            qbe_build_binary(
+                q, inc, QBE_BINARY_ADD, qbe_type_basic(QBE_TYPE_I64), y, qbe_atom_int(q, QBE_TYPE_I64, i + 1)));
+
+        QbeCall *call = qbe_call_new(q, (QbeNode *) inc, qbe_type_basic(QBE_TYPE_I64));
+        qbe_call_add_arg(q, call, value);
+        qbe_build_call(q, main, call);
+        value = (QbeNode *) call;
+    }
+
+    QbeCall *call = qbe_call_new(q, (QbeNode *) scale, qbe_type_basic(QBE_TYPE_I64));
+    qbe_call_add_arg(q, call, value);
+    qbe_build_call(q, main, call);
+
+    QbeCall *print = qbe_call_new(q, printf, qbe_type_basic(QBE_TYPE_I32));
+    qbe_call_add_arg(q, print, qbe_str_new(q, qbe_sv_from_cstr("%ld\n")));
+    qbe_call_start_variadic(q, print);
+    qbe_call_add_arg(q, print, (QbeNode *) call);
+    qbe_build_call(q, main, print);
+    qbe_build_return(q, main, qbe_atom_int(q, QBE_TYPE_I32, 0));
+}
+
+static void example_incremental(void) {
+    Qbe *q = qbe_new();
+    qbe_set_incremental(q, true);
+
+    // The module is rebuilt from scratch every time, like on every edit in an editor
+    size_t hits = 0, misses = 0;
+    for (size_t factor = 1; factor <= 2; factor++) {
+        qbe_reset(q);
+        example_incremental_build(q, factor);
+        generate_executable(q, "example_incremental", NULL, 0);
+
+        size_t total_hits, total_misses;
+        qbe_get_cache_stats(q, &total_hits, &total_misses);
+        printf("Incremental: %zu reused, %zu generated\n", total_hits - hits, total_misses - misses);
+        hits = total_hits;
+        misses = total_misses;
+    }
+    qbe_free(q);
+}
+
+static void example_async(void) {
+    const char *names[] = {"example_async_0", "example_async_1", "example_async_2", "example_async_3"};
+    QbeAsync   *handles[len(names)];
+
+    // Keep at most two toolchains running, the third generation waits for the first one
+    qbe_set_async_limit(2);
+
+    // The same context is reused for every module, while the previous ones are still being linked
+    Qbe *q = qbe_new();
+    for (size_t i = 0; i < len(names); i++) {
+        qbe_reset(q);
+
+        QbeFn   *main = qbe_fn_new(q, qbe_sv_from_cstr("main"), qbe_type_basic(QBE_TYPE_I32));
+        QbeNode *printf = qbe_atom_extern_fn(q, qbe_sv_from_cstr("printf"));
+
+        QbeCall *call = qbe_call_new(q, printf, qbe_type_basic(QBE_TYPE_I32));
+        qbe_call_add_arg(q, call, qbe_str_new(q, qbe_sv_from_cstr("Linked in the background: %d\n")));
+        qbe_call_start_variadic(q, call);
+        qbe_call_add_arg(q, call, qbe_atom_int(q, QBE_TYPE_I32, i));
+        qbe_build_call(q, main, call);
+        qbe_build_return(q, main, qbe_atom_int(q, QBE_TYPE_I32, 0));
+
+        handles[i] = qbe_generate_async(q, QBE_TARGET_DEFAULT, names[i], NULL, 0);
+    }
+    qbe_free(q);
+
+    for (size_t i = 0; i < len(names); i++) {
+        const int code = qbe_wait(handles[i]);
+        if (code) {
+            fprintf(stderr, "ERROR: Generation of '%s' exited abnormally with code %d\n", names[i], code);
+        }
+    }
+    qbe_set_async_limit(0);
+}
+
+static void example_toolchain(void) {
+    Qbe *q = qbe_new();
+
+    // Skip the compiler driver for assembling, and only use it for linking
+    const char *as[] = {"as", "-o", "{output}", NULL};
+    const char *ld[] = {"cc", "-o", "{output}", "{input}", "{flags}", NULL};
+    qbe_set_toolchain(q, as, ld);
+
+    const char *names[] = {"example_toolchain", "example_toolchain_object.o"};
+    for (size_t i = 0; i < len(names); i++) {
+        qbe_reset(q);
+
+        QbeFn   *main = qbe_fn_new(q, qbe_sv_from_cstr("main"), qbe_type_basic(QBE_TYPE_I32));
+        QbeNode *puts = qbe_atom_extern_fn(q, qbe_sv_from_cstr("puts"));
+
+        QbeCall    *call = qbe_call_new(q, puts, qbe_type_basic(QBE_TYPE_I32));
+        const char *message = i ? "Linked by hand" : "Assembled and linked directly";
+        qbe_call_add_arg(q, call, qbe_str_new(q, qbe_sv_from_cstr(message)));
+        qbe_build_call(q, main, call);
+        qbe_build_return(q, main, qbe_atom_int(q, QBE_TYPE_I32, 0));
+
+        // The second one stops at the object, for linking later
+        qbe_set_object_only(q, i == 1);
+        generate_executable(q, names[i], NULL, 0);
+    }
+    qbe_free(q);
+
+    if (system("cc -o example_toolchain_object example_toolchain_object.o")) {
+        fprintf(stderr, "ERROR: Linking of 'example_toolchain_object' failed\n");
+    }
+}
+
+// A chain of local functions, which end up in different shards: step(x) = previous(x) * 1.5
+static void example_shards_build(Qbe *q, const char *message) {
+    QbeFn   *main = qbe_fn_new(q, qbe_sv_from_cstr("main"), qbe_type_basic(QBE_TYPE_I32));
+    QbeNode *printf = qbe_atom_extern_fn(q, qbe_sv_from_cstr("printf"));
+
+    QbeFn *previous = NULL;
+    for (size_t i = 0; i < 6; i++) {
+        QbeFn   *step = qbe_fn_new(q, (QbeSV) {0}, qbe_type_basic(QBE_TYPE_F64));
+        QbeNode *x = qbe_fn_add_arg(q, step, qbe_type_basic(QBE_TYPE_F64));
+        if (previous) {
+            QbeCall *call = qbe_call_new(q, (QbeNode *) previous, qbe_type_basic(QBE_TYPE_F64));
+            qbe_call_add_arg(q, call, x);
+            qbe_build_call(q, step, call);
+            x = (QbeNode *) call;
+        }
+
+        QbeNode *factor = qbe_atom_float(q, QBE_TYPE_F64, 1.5);
+        qbe_build_return(
+            q, step, qbe_build_binary(q, step, QBE_BINARY_MUL, qbe_type_basic(QBE_TYPE_F64), x, factor));
+        previous = step;
+    }
+
+    QbeCall *call = qbe_call_new(q, (QbeNode *) previous, qbe_type_basic(QBE_TYPE_F64));
+    qbe_call_add_arg(q, call, qbe_atom_float(q, QBE_TYPE_F64, 2));
+    qbe_build_call(q, main, call);
+
+    QbeCall *print = qbe_call_new(q, printf, qbe_type_basic(QBE_TYPE_I32));
+    qbe_call_add_arg(q, print, qbe_str_new(q, qbe_sv_from_cstr(message)));
+    qbe_call_start_variadic(q, print);
+    qbe_call_add_arg(q, print, (QbeNode *) call);
+    qbe_build_call(q, main, print);
+    qbe_build_return(q, main, qbe_atom_int(q, QBE_TYPE_I32, 0));
+}
+
+static void example_shards(void) {
+    Qbe *q = qbe_new();
+    example_shards_build(q, "Assembled in 3 shards: %g\n");
+
+    // Compile
+    qbe_set_shards(q, 3);
+    generate_executable(q, "example_shards", NULL, 0);
+    qbe_free(q);
+}
+
+static void example_cache_shards(void) {
+    if (system("rm -rf example_cache_shards.d")) {
+        fprintf(stderr, "ERROR: Could not clear the cache of 'example_cache_shards'\n");
+        return;
+    }
+
+    // Sharding changes the emitted text of the local functions, so the sharded run must not reuse the
+    // entries of the unsharded one
+    for (size_t shards = 1; shards <= 3; shards += 2) {
+        Qbe *q = qbe_new();
+        qbe_set_cache_dir(q, "example_cache_shards.d");
+        example_shards_build(q, "Assembled with a shared cache: %g\n");
+
+        qbe_set_shards(q, shards);
+        generate_executable(q, "example_cache_shards", NULL, 0);
+
+        size_t hits, misses;
+        qbe_get_cache_stats(q, &hits, &misses);
+        printf("Cache: %zu hits, %zu misses\n", hits, misses);
+        qbe_free(q);
+    }
+}
+
+static void example_outputs_build(Qbe *q, const char *message) {
+    QbeFn   *main = qbe_fn_new(q, qbe_sv_from_cstr("main"), qbe_type_basic(QBE_TYPE_I32));
+    QbeNode *printf = qbe_atom_extern_fn(q, qbe_sv_from_cstr("printf"));
+    qbe_fn_set_debug(q, main, qbe_sv_from_cstr(__FILE__), __LINE__);
+
+    QbeFn   *area = qbe_fn_new(q, qbe_sv_from_cstr("area"), qbe_type_basic(QBE_TYPE_F64));
+    QbeNode *r = qbe_fn_add_arg(q, area, qbe_type_basic(QBE_TYPE_F64));
+    qbe_fn_set_debug(q, area, qbe_sv_from_cstr(__FILE__), __LINE__);
+
+    QbeNode *r2 = qbe_build_binary(q, area, QBE_BINARY_MUL, qbe_type_basic(QBE_TYPE_F64), r, r);
+    QbeNode *pi = qbe_atom_float(q, QBE_TYPE_F64, 3.14159);
+    qbe_build_return(q, area, qbe_build_binary(q, area, QBE_BINARY_MUL, qbe_type_basic(QBE_TYPE_F64), r2, pi));
+
+    QbeCall *call = qbe_call_new(q, (QbeNode *) area, qbe_type_basic(QBE_TYPE_F64));
+    qbe_call_add_arg(q, call, qbe_atom_float(q, QBE_TYPE_F64, 2));
+    qbe_build_call(q, main, call);
+
+    QbeCall *print = qbe_call_new(q, printf, qbe_type_basic(QBE_TYPE_I32));
+    qbe_call_add_arg(q, print, qbe_str_new(q, qbe_sv_from_cstr(message)));
+    qbe_call_start_variadic(q, print);
+    qbe_call_add_arg(q, print, (QbeNode *) call);
+    qbe_build_call(q, main, print);
+    qbe_build_return(q, main, qbe_atom_int(q, QBE_TYPE_I32, 0));
+}
+
+static void example_outputs(void) {
+    Qbe *q = qbe_new();
+    example_outputs_build(q, "Generated once for two outputs: %g\n");
+
+    // Compile
+    const char     *strip[] = {"-s"};
+    const QbeOutput outputs[] = {
+        {QBE_TARGET_DEFAULT, "example_outputs_debug", NULL, 0},
+        {QBE_TARGET_DEFAULT, "example_outputs_stripped", strip, 1},
+    };
+
+    int code = qbe_generate_many(q, outputs, 2);
+    if (code) {
+        fprintf(stderr, "ERROR: Generation of 'example_outputs' exited abnormally with code %d\n", code);
+    }
+    qbe_free(q);
+
+    // Another target comes first, so the native output is generated from the functions of arm64. The
+    // toolchain only keeps the assembly, which is then built by hand
+    q = qbe_new();
+    example_outputs_build(q, "Generated once for two targets: %g\n");
+
+    const char *as[] = {"cp", "/dev/stdin", "{output}", NULL};
+    qbe_set_toolchain(q, as, NULL);
+
+    const QbeOutput targets[] = {
+        {QBE_TARGET_ARM64_LINUX, "example_outputs_arm64.s", NULL, 0},
+        {QBE_TARGET_DEFAULT, "example_outputs_cross.s", NULL, 0},
+    };
+
+    code = qbe_generate_many(q, targets, 2);
+    if (code) {
+        fprintf(stderr, "ERROR: Generation of 'example_outputs_cross' exited abnormally with code %d\n", code);
+    }
+    qbe_free(q);
+
+    if (system("cc -o example_outputs_cross example_outputs_cross.s")) {
+        fprintf(stderr, "ERROR: Linking of 'example_outputs_cross' failed\n");
+    }
+}
+
+typedef struct {
+    size_t allocated; // Bytes held by the library, including the headers of the allocations
+    size_t calls;
+} ExampleAllocator;
+
+static void *example_allocator_alloc(void *user, size_t size) {
+    ExampleAllocator *a = user;
+    a->allocated += size;
+    a->calls++;
+    return malloc(size);
+}
+
+static void *example_allocator_realloc(void *user, void *data, size_t old_size, size_t new_size) {
+    ExampleAllocator *a = user;
+    a->allocated += new_size - old_size;
+    a->calls++;
+    return realloc(data, new_size);
+}
+
+static void example_allocator_free(void *user, void *data, size_t size) {
+    ExampleAllocator *a = user;
+    a->allocated -= size;
+    free(data);
+}
+
+static void example_allocator(void) {
+    ExampleAllocator a = {0};
+    qbe_set_allocator(example_allocator_alloc, example_allocator_realloc, example_allocator_free, &a);
+
+    Qbe *q = qbe_new();
+
+    {
+        QbeFn   *main = qbe_fn_new(q, qbe_sv_from_cstr("main"), qbe_type_basic(QBE_TYPE_I32));
+        QbeNode *printf = qbe_atom_extern_fn(q, qbe_sv_from_cstr("printf"));
+
+        QbeCall *print = qbe_call_new(q, printf, qbe_type_basic(QBE_TYPE_I32));
+        qbe_call_add_arg(q, print, qbe_str_new(q, qbe_sv_from_cstr("Generated with a custom allocator\n")));
+        qbe_build_call(q, main, print);
+        qbe_build_return(q, main, qbe_atom_int(q, QBE_TYPE_I32, 0));
+    }
+
+    const size_t built = qbe_get_memory_usage(q);
+    generate_executable(q, "example_allocator", NULL, 0);
+    const size_t generated = qbe_get_memory_usage(q);
+
+    printf("Allocator: %s while building, %s after generating\n",
+           built && built <= a.allocated ? "counted" : "not counted",
+           generated > built && generated <= a.allocated ? "grown" : "not grown");
+
+    qbe_free(q);
+    printf("Allocator: %s after freeing\n", !a.allocated && a.calls ? "everything returned" : "leaked");
+    qbe_set_allocator(NULL, NULL, NULL, NULL);
+}
+
+static void example_phi_many(void) {
+    // A merge of more predecessors than the parser used to take, lowered directly and through the
+    // textual IL
+    const char *names[] = {"example_phi_many", "example_phi_many_text"};
+
+    for (size_t n = 0; n < len(names); n++) {
+        Qbe *q = qbe_new();
+
+        {
+            // pick(x) = x * x for x in [0, 100), -1 otherwise
+            QbeFn   *pick = qbe_fn_new(q, qbe_sv_from_cstr("pick"), qbe_type_basic(QBE_TYPE_I64));
+            QbeNode *x = qbe_fn_add_arg(q, pick, qbe_type_basic(QBE_TYPE_I64));
+
+            QbeBlock    *merge = qbe_block_new(q);
+            QbePhiBranch branches[101];
+            for (size_t i = 0; i < 100; i++) {
+                QbeBlock *found = qbe_block_new(q);
+                QbeBlock *next = qbe_block_new(q);
+                QbeNode  *eq = qbe_build_binary(
+                    q, pick, QBE_BINARY_EQ, qbe_type_basic(QBE_TYPE_I64), x, qbe_atom_int(q, QBE_TYPE_I64, i));
+                qbe_build_branch(q, pick, eq, found, next);
+
+                qbe_build_block(q, pick, found);
+                qbe_build_jump(q, pick, merge);
+                branches[i] = (QbePhiBranch) {.block = found, .value = qbe_atom_int(q, QBE_TYPE_I64, i * i)};
+
+                qbe_build_block(q, pick, next);
+                branches[100] = (QbePhiBranch) {.block = next, .value = qbe_atom_int(q, QBE_TYPE_I64, -1)};
+            }
+            qbe_build_jump(q, pick, merge);
+
+            qbe_build_block(q, pick, merge);
+            QbeNode *y = qbe_build_phi_n(q, pick, qbe_type_basic(QBE_TYPE_I64), branches, len(branches));
+            qbe_build_return(q, pick, y);
+
+            QbeFn   *main = qbe_fn_new(q, qbe_sv_from_cstr("main"), qbe_type_basic(QBE_TYPE_I32));
+            QbeNode *printf = qbe_atom_extern_fn(q, qbe_sv_from_cstr("printf"));
+
+            const size_t inputs[] = {0, 7, 99, 100};
+            for (size_t i = 0; i < len(inputs); i++) {
+                QbeCall *call = qbe_call_new(q, (QbeNode *) pick, qbe_type_basic(QBE_TYPE_I64));
+                qbe_call_add_arg(q, call, qbe_atom_int(q, QBE_TYPE_I64, inputs[i]));
+                qbe_build_call(q, main, call);
+
+                QbeCall *print = qbe_call_new(q, printf, qbe_type_basic(QBE_TYPE_I32));
+                qbe_call_add_arg(q, print, qbe_str_new(q, qbe_sv_from_cstr("pick(%ld) = %ld\n")));
+                qbe_call_start_variadic(q, print);
+                qbe_call_add_arg(q, print, qbe_atom_int(q, QBE_TYPE_I64, inputs[i]));
+                qbe_call_add_arg(q, print, (QbeNode *) call);
+                qbe_build_call(q, main, print);
+            }
+
+            qbe_build_return(q, main, qbe_atom_int(q, QBE_TYPE_I32, 0));
+        }
+
+        if (n) {
+            qbe_compile(q);
+        }
+
+        // Compile
+        generate_executable(q, names[n], NULL, 0);
+        qbe_free(q);
+    }
+}
+
 int main(void) {
     example_if();
     example_struct();
@@ -473,4 +1253,21 @@ int main(void) {
     example_array();
     example_extern_var();
     example_var_init();
+    example_stream();
+    example_binary();
+    example_reset();
+    example_threads();
+    example_parallel();
+    example_object();
+    example_jit();
+    example_asm();
+    example_cache();
+    example_incremental();
+    example_async();
+    example_toolchain();
+    example_shards();
+    example_outputs();
+    example_allocator();
+    example_phi_many();
+    example_cache_shards();
 }
@@ -23,6 +23,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 
 typedef struct {
     const char *data;
@@ -155,6 +156,7 @@ QbeField *qbe_struct_add_field(Qbe *q, QbeStruct *st, QbeType field_type);
 
 // Builder
 QbeNode *qbe_build_phi(Qbe *q, QbeFn *fn, QbePhiBranch a, QbePhiBranch b);
+QbeNode *qbe_build_phi_n(Qbe *q, QbeFn *fn, QbeType type, const QbePhiBranch *branches, size_t count); // Copies the branches
 QbeNode *qbe_build_unary(Qbe *q, QbeFn *fn, QbeUnaryOp op, QbeType type, QbeNode *operand);
 QbeNode *qbe_build_binary(Qbe *q, QbeFn *fn, QbeBinaryOp op, QbeType type, QbeNode *lhs, QbeNode *rhs);
 QbeNode *qbe_build_load(Qbe *q, QbeFn *fn, QbeNode *ptr, QbeType type, bool is_signed);
@@ -184,12 +186,184 @@ void qbe_build_debug_line(Qbe *q, QbeFn *fn, size_t line);
 void qbe_fn_set_debug(Qbe *q, QbeFn *fn, QbeSV path, size_t line);
 
 // Primitives
+//
+// Each context owns its backend state, so different contexts can be used on different threads at the
+// same time. A single context must not be used by multiple threads at once
 Qbe *qbe_new(void);
 void qbe_free(Qbe *q);
-void qbe_compile(Qbe *q);
+void qbe_reset(Qbe *q); // Discard everything built so far, keeping the memory around for reuse
+void qbe_compile(Qbe *q); // Textual IL, only needed for debugging. Makes qbe_generate() go through the parser
 int  qbe_generate(Qbe *q, QbeTarget target, const char *output, const char **flags, size_t flags_count);
 
+// Streaming
+//
+// Functions passed to qbe_fn_finish() go through the backend right away and must be complete. The
+// rest of the program, including all the data, is generated by qbe_generate_end()
+int  qbe_generate_begin(Qbe *q, QbeTarget target, const char *output, const char **flags, size_t flags_count);
+void qbe_fn_finish(Qbe *q, QbeFn *fn);
+int  qbe_generate_end(Qbe *q);
+
 bool  qbe_has_been_compiled(Qbe *q);
 QbeSV qbe_get_compiled_program(Qbe *q);
 
+// Toolchain
+//
+// By default the assembly is piped into "cc -o <output> -x assembler - <flags>", which goes through the
+// compiler driver. The assembler and the linker can be invoked directly instead, given as NULL
+// terminated argument templates. "{output}" and "{input}" are replaced anywhere in an argument, and an
+// argument of exactly "{flags}" expands to the flags of the generation. The assembler reads the
+// assembly from standard input and writes '{output}'. With a linker, the assembler writes a temporary
+// object next to the output instead, which the linker gets as '{input}' and which is removed afterwards.
+// In object only mode the generation stops after assembling, so the output is the object itself and
+// the linker is not used. NULL restores the defaults. These apply to every generation that invokes
+// the toolchain, and are copied
+//
+//   const char *as[] = {"as", "-o", "{output}", NULL};
+//   const char *ld[] = {"cc", "-fuse-ld=mold", "-o", "{output}", "{input}", "{flags}", NULL};
+//   qbe_set_toolchain(q, as, ld);
+void qbe_set_toolchain(Qbe *q, const char **assembler, const char **linker);
+void qbe_set_object_only(Qbe *q, bool enabled);
+
+// Sharding
+//
+// Splits the functions and data into 'count' pieces of about the same size, each assembled by its own
+// process at the same time, and then links the objects together. An argument of exactly "{input}" in
+// the linker expands to all of them. In object only mode the objects are combined into one with a
+// partial link. The symbols that are not exported become hidden globals, so that the shards can refer
+// to each other. 0 and 1 turn sharding off
+void qbe_set_shards(Qbe *q, size_t count);
+
+// Asynchronous
+//
+// Generates the program like qbe_generate(), but returns as soon as the assembly has been handed over
+// to the toolchain, which keeps running in the background. The context can be reset and reused right
+// away. Every handle must be passed to qbe_wait() eventually, which returns the exit code and frees it,
+// while qbe_poll() tells whether that would block. No more than the limit of toolchains are kept in
+// flight across all the contexts, the oldest one is waited for to make room. The limit defaults to one
+// per processor, 0 restores that
+typedef struct QbeAsync QbeAsync;
+
+QbeAsync *qbe_generate_async(Qbe *q, QbeTarget target, const char *output, const char **flags, size_t flags_count);
+bool      qbe_poll(QbeAsync *a); // Whether the toolchain is done
+int       qbe_wait(QbeAsync *a);
+void      qbe_set_async_limit(size_t limit);
+
+// Parallel
+//
+// Runs the passes of the functions on 'nthreads' threads, including the calling one, or one per
+// processor if it's 0. The output is identical to qbe_generate(), which is used instead for compiled
+// contexts. All the functions are lowered upfront, so this trades memory for speed
+int qbe_generate_parallel(
+    Qbe *q, QbeTarget target, const char *output, const char **flags, size_t flags_count, size_t nthreads);
+
+// Multiple outputs
+//
+// Generates the same program for several outputs at once, which can differ in the target and the
+// flags. The program is parsed or lowered only once, and the target independent passes run once per
+// function for all the outputs, so only the target specific passes are repeated. The toolchains of the
+// outputs run at the same time. Returns the first nonzero exit code, after all of them are done. The
+// cache does not apply
+typedef struct {
+    QbeTarget    target;
+    const char  *output;
+    const char **flags;
+    size_t       flags_count;
+} QbeOutput;
+
+int qbe_generate_many(Qbe *q, const QbeOutput *outputs, size_t outputs_count);
+
+// Cache
+//
+// Keeps the assembly of every function in 'dir', keyed by its contents and the target, and reuses it
+// the next time the same function is generated. Applies to qbe_generate(), the streaming API and
+// qbe_generate_asm(), but not to the parallel generation, objects or the JIT. The directory can be
+// shared between processes. NULL disables the cache. The statistics count the functions since caching
+// was first enabled, on disk or incrementally
+void qbe_set_cache_dir(Qbe *q, const char *dir);
+void qbe_get_cache_stats(Qbe *q, size_t *hits, size_t *misses);
+
+// Incremental
+//
+// Keeps the assembly of every function in memory across qbe_reset(), keyed by its name and contents.
+// When the module is built and generated again, only the functions that changed go through the
+// backend, and the rest is spliced in from the previous generation. The functions that a generation
+// did not see are forgotten at its end. The same generations as the cache apply, and both can be used
+// together, in which case the memory is looked at first
+void qbe_set_incremental(Qbe *q, bool enabled);
+
+// Assembly
+//
+// Runs the same backend as qbe_generate(), but hands over the assembly instead of invoking the
+// toolchain. The buffer of qbe_generate_asm() is owned by the context and is valid until the next
+// call. A nonzero exit code is returned on failure
+int qbe_generate_asm(Qbe *q, QbeTarget target, QbeSV *out);
+int qbe_generate_asm_file(Qbe *q, QbeTarget target, FILE *f);
+
+// Objects
+//
+// Encodes the machine code directly into a relocatable object, without going through an assembler.
+// The object can then be linked with the system toolchain as usual. Only QBE_TARGET_X86_64_LINUX is
+// supported for now, a nonzero exit code is returned for the other targets. There is no debug
+// information in the object
+int qbe_generate_object(Qbe *q, QbeTarget target, const char *output);
+
+// JIT
+//
+// Compiles the program into executable memory of the current process, which stays valid until
+// qbe_jit_free(), even after the context is freed. The external symbols are looked up with the
+// resolver first, if any, and then with dlsym(), so link with -ldl on older systems. Only x86_64
+// hosts are supported, and there is no thread local storage. NULL is returned on failure
+typedef struct QbeJit QbeJit;
+typedef void *(*QbeJitResolver)(void *user, const char *name);
+
+QbeJit *qbe_jit(Qbe *q);
+QbeJit *qbe_jit_with_resolver(Qbe *q, QbeJitResolver resolver, void *user);
+void   *qbe_jit_lookup(QbeJit *jit, const char *name); // NULL if the symbol is not defined
+void    qbe_jit_free(QbeJit *jit);
+
+// Binary IL
+//
+// A compact and versioned encoding of the program, meant for caching and shipping it between
+// processes. The returned buffer is owned by the context and is valid until the next call.
+// qbe_generate_binary() reads the program in place, so it can come straight from mmap(). Programs
+// written by a different version of the library are rejected with a nonzero exit code
+QbeSV qbe_get_binary_program(Qbe *q);
+int   qbe_generate_binary(QbeSV program, QbeTarget target, const char *output, const char **flags, size_t flags_count);
+
+// Server
+//
+// Serves the generation of programs over a Unix domain socket at 'path', so that short lived tools
+// skip the startup and reuse warm contexts. The program is either the textual IL or the binary IL,
+// and the result is the assembly or an object, as from qbe_generate_asm() and qbe_generate_object().
+// The requests are handled by 'workers' processes, or one per processor if it's 0, and a connection
+// stays with its worker until it's closed. A worker that exits on a malformed program is replaced,
+// and its client gets a nonzero exit code. qbe_serve() blocks until SIGINT or SIGTERM, and returns
+// nonzero if the socket could not be set up
+int qbe_serve(const char *path, size_t workers);
+
+// The output of qbe_client_generate() is owned by the client and is valid until the next call. Once
+// the connection is lost, every call fails
+typedef struct QbeClient QbeClient;
+
+QbeClient *qbe_client_new(const char *path); // NULL if the server is not reachable
+int        qbe_client_generate(QbeClient *c, QbeSV program, QbeTarget target, bool object, QbeSV *out);
+void       qbe_client_free(QbeClient *c);
+
+// Allocator
+//
+// Routes the memory of the builder and the backend through the given functions, which get the size of
+// every block back when it's resized or freed. The allocator must not return NULL. It is shared by all
+// the contexts and must be set while none of them, and no JIT, is alive. NULL restores malloc(). The
+// toolchains and the buffers handed over by the C library, like the assembly, are not covered
+//
+// The usage is the bytes currently held by a context, including its backend state, not counting the
+// overhead of the allocator. It is safe to read from any thread. The handle itself is not counted, and
+// neither is the memory of a JIT, which outlives the context
+typedef void *(*QbeAllocFn)(void *user, size_t size);
+typedef void *(*QbeReallocFn)(void *user, void *data, size_t old_size, size_t new_size);
+typedef void (*QbeFreeFn)(void *user, void *data, size_t size);
+
+void   qbe_set_allocator(QbeAllocFn alloc, QbeReallocFn realloc, QbeFreeFn free, void *user);
+size_t qbe_get_memory_usage(Qbe *q);
+
 #endif // QBE_H
@@ -0,0 +1,20 @@
+// Compile server, see qbe_serve() in qbe.h
+//
+// Usage: ./qbed <socket> [workers]
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "qbe.h"
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s <socket> [workers]\n", argv[0]);
+        return 1;
+    }
+
+    const size_t workers = argc == 3 ? strtoull(argv[2], NULL, 10) : 0;
+    if (qbe_serve(argv[1], workers)) {
+        fprintf(stderr, "ERROR: Could not serve on '%s'\n", argv[1]);
+        return 1;
+    }
+}
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
 
 #define MAKESURE(what, x) typedef char make_sure_##what[(x)?1:-1]
 #define die(...) qbe_die_(__FILE__, __VA_ARGS__)
@@ -31,10 +32,23 @@ typedef struct Field Field;
 typedef struct Dat Dat;
 typedef struct Lnk Lnk;
 typedef struct Target Target;
+typedef struct Interns Interns; // @shoumodip
+typedef struct Asmbits Asmbits; // @shoumodip
+typedef struct Stash Stash; // @shoumodip
+typedef struct FnPool FnPool; // @shoumodip
+typedef struct Ctx Ctx; // @shoumodip
+typedef struct Obj Obj; // @shoumodip
+typedef struct ObjSec ObjSec; // @shoumodip
+typedef struct ObjSym ObjSym; // @shoumodip
+typedef struct ObjRel ObjRel; // @shoumodip
+typedef struct Image Image; // @shoumodip
+typedef struct Cache Cache; // @shoumodip
+typedef struct Run Run; // @shoumodip
+typedef struct Out Out; // @shoumodip
 
 enum {
 	NString = 80,
-	NIns    = 1 << 20,
+	NIns    = 1 << 12, /* @shoumodip: least room in the instruction buffer */
 	NAlign  = 3,
 	NField  = 32,
 	NBit    = CHAR_BIT * sizeof(bits),
@@ -59,6 +73,7 @@ struct Target {
 	void (*isel)(Fn *);
 	void (*emitfn)(Fn *, FILE *);
 	void (*emitfin)(FILE *);
+	void (*encodefn)(Fn *); /* @shoumodip: for objects, optional */
 	char asloc[4];
 	char assym[4];
 };
@@ -388,6 +403,9 @@ struct Fn {
 	char name[NString];
 	uint linenr; // @shoumodip
 	Lnk lnk;
+	int *conh; // @shoumodip: hash index of con, see qbe_newcon()
+	uint nconh;
+	int nconi; // @shoumodip: constants in the index
 };
 
 struct Typ {
@@ -439,9 +457,103 @@ struct Dat {
 	char isstr;
 };
 
-/* main.c */
-extern Target qbe_T;
-extern char qbe_debug['Z'+1];
+// Modification BEGIN
+// Copyright (C) 2025 Shoumodip Kar <shoumodipkar@gmail.com>
+//
+// All the state that outlives a single pass lives in a context, which is owned by the QBE context
+// being generated and installed for the calling thread by the generation entry points. Independent
+// contexts can thus generate concurrently on different threads. The scratch state of the passes
+// themselves never outlives a call, so it stays in thread local statics.
+enum {
+	NChunk = 1<<16,
+};
+
+typedef struct Chunk Chunk;
+
+struct Chunk {
+	Chunk *next;
+	size_t size; /* of the data that follows */
+};
+
+/* PFn allocations are bumped out of chunks, which are given back to
+ * the context in one go when the function is done */
+struct FnPool {
+	Chunk *head, *tail; /* newest first */
+	char *cur, *end;    /* free space in the head */
+};
+
+/* interned strings, numbered in the order they were added */
+struct Interns {
+	struct {
+		char *s;
+		uint32_t hash, len;
+	} *str; /* vector */
+	uint nstr;
+	uint32_t *tab; /* open addressing by hash, numbers plus one */
+	uint ntab;
+	Chunk *chunk; /* the strings themselves, newest first */
+	char *cur, *end;
+};
+
+/* constants of the module, numbered like their labels */
+struct Stash {
+	Asmbits *bits;
+	uint n;
+	uint *tab; /* hash index by contents, see qbe_stashbits() */
+	uint ntab;
+};
+
+struct Ctx {
+	/* compile.c */
+	Target T;
+	char debug['Z'+1];
+	FILE *outf;
+	Run *run; /* toolchain of the generation in progress */
+	char **as, **ld; /* toolchain templates, NULL for the defaults */
+	int objonly;
+	uint nshard;
+	int shared; /* local symbols are shared between shards */
+	Out *out; /* outputs of qbe_generate_many() */
+	uint nout;
+	char *asmbuf; /* output of qbe_generate_asm() */
+	size_t asmlen;
+
+	/* util.c */
+	size_t *mem; /* account of the allocations */
+	Typ *typ;
+	Ins *insb, *inse, *curi; /* instruction buffer, grown by qbe_insreset() */
+	FnPool pool; /* PFn allocations, can be handed over to another context */
+	Chunk *spare; /* chunks of the finished functions, kept for the next ones */
+	int ntmpname;
+	Interns itbl; /* string interning table */
+
+	/* emit.c */
+	uint curfile;
+	uint32_t *file;
+	uint nfile;
+	Stash stash;
+	int64_t zero;
+	int id0; /* first block label of the next function */
+
+	/* spill.c */
+	int *tarr, maxt;
+
+	/* elf.c */
+	Obj *obj; /* set when generating an object */
+
+	/* cache.c */
+	Cache *cache; /* set when caching the functions */
+};
+
+extern _Thread_local Ctx *qbe_ctx;
+
+#define qbe_T (qbe_ctx->T)
+#define qbe_debug (qbe_ctx->debug)
+#define qbe_typ (qbe_ctx->typ)
+#define qbe_insb (qbe_ctx->insb)
+#define qbe_inse (qbe_ctx->inse)
+#define qbe_curi (qbe_ctx->curi)
+// Modification END
 
 /* util.c */
 typedef enum {
@@ -449,11 +561,18 @@ typedef enum {
 	PFn, /* discarded after processing the function */
 } Pool;
 
-extern Typ *qbe_typ;
-extern Ins qbe_insb[NIns], *qbe_curi;
+void qbe_memhooks(void *(*)(void *, size_t), void *(*)(void *, void *, size_t, size_t), void (*)(void *, void *, size_t), void *); // @shoumodip
+void *qbe_memalloc(size_t *, size_t); // @shoumodip
+void *qbe_memrealloc(size_t *, void *, size_t); // @shoumodip
+void qbe_memfree(void *); // @shoumodip
+Ctx *qbe_ctxnew(size_t *); // @shoumodip
+void qbe_ctxfree(Ctx *); // @shoumodip
+Fn *qbe_fncopy(Fn *); // @shoumodip
 uint32_t qbe_hash(char *);
+uint32_t qbe_strhash(char *, uint32_t *); // @shoumodip
 void qbe_die_(char *, char *, ...) __attribute__((noreturn));
 void *qbe_emalloc(size_t);
+void *qbe_erealloc(void *, size_t); // @shoumodip
 void *qbe_alloc(size_t);
 void qbe_freeall(void);
 void qbe_util_resetall(void);
@@ -467,6 +586,9 @@ int qbe_argcls(Ins *, int);
 int qbe_isreg(Ref);
 int qbe_iscmp(int, int *, int *);
 void qbe_emit(int, int, Ref, Ref, Ref);
+void qbe_insreset(uint); // @shoumodip
+void qbe_insgrow(uint); // @shoumodip
+void qbe_insfit(uint); // @shoumodip
 void qbe_emiti(Ins);
 void qbe_idup(Ins **, Ins *, ulong);
 Ins *qbe_icpy(Ins *, Ins *, ulong);
@@ -508,6 +630,31 @@ void qbe_parse(FILE *, char *, void (char *), void (Dat *), void (Fn *));
 void qbe_printfn(Fn *, FILE *);
 void qbe_printref(Ref, Fn *, FILE *);
 void qbe_err(char *, ...) __attribute__((noreturn));
+void qbe_typecheck(Fn *); // @shoumodip
+
+/* parsebin.c */ // @shoumodip
+#define BinMagic "QBEB"
+enum {
+	BinVersion = 1,
+};
+enum {
+	BinEnd,
+	BinTyp,
+	BinDbg,
+	BinDat,
+	BinFn,
+};
+int qbe_bincheck(void *, size_t);
+void qbe_parsebin(void *, size_t, void (char *), void (Dat *), void (Fn *));
+
+/* builder.c */ // @shoumodip
+struct Qbe;
+struct QbeFn;
+void qbe_lower_begin(struct Qbe *);
+void qbe_lower_finish(struct Qbe *, struct QbeFn *, void (char *), void (Fn *));
+void qbe_lower_end(struct Qbe *, void (char *), void (Dat *), void (Fn *));
+void qbe_lower_free(struct Qbe *);
+Ctx *qbe_ctx_of(struct Qbe *);
 
 /* abi.c */
 void qbe_elimsb(Fn *);
@@ -577,3 +724,99 @@ int qbe_stashbits(void *, int);
 void qbe_elf_emitfnfin(char *, FILE *);
 void qbe_elf_emitfin(FILE *);
 void qbe_macho_emitfin(FILE *);
+void qbe_elf_objfin(void); // @shoumodip
+int qbe_stashget(int, void *); // @shoumodip
+
+// Modification BEGIN
+// Copyright (C) 2025 Shoumodip Kar <shoumodipkar@gmail.com>
+//
+// Relocatable objects, built in memory by the encoders of the targets
+enum {
+	ObjWrite  = 1,
+	ObjExec   = 2,
+	ObjTls    = 4,
+	ObjNobits = 8,
+};
+
+enum {
+	RelAbs64,   /* S + A */
+	RelAbs32,   /* S + A, zero extended */
+	RelAbs32S,  /* S + A, sign extended */
+	RelPc32,    /* S + A - P */
+	RelPlt32,   /* S + A - P, through the PLT if needed */
+	RelTpoff32, /* S + A - end of the TLS block */
+};
+
+struct ObjRel {
+	uint64_t off;
+	int type;
+	int sym; /* -1-n for section n once written */
+	int64_t add;
+};
+
+struct ObjSym {
+	uint32_t id; /* interned name, unquoted */
+	int sec;     /* -1 if undefined */
+	uint64_t off;
+	uint64_t size;
+	char global;
+	char func;
+	char tls;
+};
+
+struct ObjSec {
+	char *name;
+	int flags;
+	int align;
+	uchar *data;
+	uint64_t size, cap;
+	ObjRel *rel;
+	uint nrel;
+	uint shname, shrel;
+};
+
+struct Obj {
+	ObjSec *sec;
+	uint nsec;
+	ObjSym *sym;
+	uint nsym;
+	uint *symh; /* open addressing, by name */
+	uint nsymh;
+	int cur; /* section being filled */
+};
+
+/* elf.c */
+void qbe_objnew(void);
+void qbe_objfree(void);
+int qbe_objsym(char *);
+void qbe_objsec(char *, char *);
+uint64_t qbe_objpos(void);
+void qbe_objbytes(void *, uint64_t);
+void qbe_objle(int64_t, int);
+void qbe_objalign(int);
+void qbe_objrel(uint64_t, int, int, int64_t);
+void qbe_objlabel(char *, int);
+void qbe_objfnlnk(char *, Lnk *);
+void qbe_objfnfin(char *);
+void qbe_objdat(Dat *);
+int qbe_elf_objwrite(FILE *);
+
+/* jit.c */
+typedef void *Resolver(void *, const char *);
+Image *qbe_objload(Resolver *, void *);
+void *qbe_imagesym(Image *, char *);
+void qbe_imagefree(Image *);
+
+/* cache.c */
+void qbe_cachedir(char *);
+void qbe_cachemem(int);
+void qbe_cachesweep(void);
+void qbe_cachefree(void);
+void qbe_cachestash(int);
+void qbe_cachestats(size_t *, size_t *);
+int qbe_cacheget(Fn *);
+void qbe_cacheput(void);
+
+/* compile.c */
+int qbe_generate_request(void *, size_t, int, int, FILE *);
+// Modification END
@@ -67,4 +67,9 @@ void qbe_amd64_sysv_abi(Fn *);
 void qbe_amd64_isel(Fn *);
 
 /* emit.c */
+int qbe_amd64_slot(Ref, Fn *); // @shoumodip
+uint64_t qbe_amd64_framesz(Fn *); // @shoumodip
 void qbe_amd64_emitfn(Fn *, FILE *);
+
+/* encode.c */ // @shoumodip
+void qbe_amd64_encodefn(Fn *);
@@ -141,8 +141,8 @@ static char *rname[][4] = {
 };
 
 
-static int
-slot(Ref r, Fn *fn)
+int
+qbe_amd64_slot(Ref r, Fn *fn) // @shoumodip: shared with encode.c
 {
 	int s;
 
@@ -188,7 +188,7 @@ emitcon(Con *con, FILE *f)
 static char *
 regtoa(int reg, int sz)
 {
-	static char buf[6];
+	static _Thread_local char buf[6];
 
 	assert(reg <= XMM15);
 	if (reg >= XMM0) {
@@ -286,14 +286,14 @@ Next:
 			fprintf(f, "%%%s", regtoa(ref.val, sz));
 			break;
 		case RSlot:
-			fprintf(f, "%d(%%rbp)", slot(ref, fn));
+			fprintf(f, "%d(%%rbp)", qbe_amd64_slot(ref, fn));
 			break;
 		case RMem:
 		Mem:
 			m = &fn->mem[ref.val];
 			if (rtype(m->base) == RSlot) {
 				off.type = CBits;
-				off.bits.i = slot(m->base, fn);
+				off.bits.i = qbe_amd64_slot(m->base, fn);
 				qbe_addcon(&m->offset, &off);
 				m->base = TMP(RBP);
 			}
@@ -338,7 +338,7 @@ Next:
 		case RMem:
 			goto Mem;
 		case RSlot:
-			fprintf(f, "%d(%%rbp)", slot(ref, fn));
+			fprintf(f, "%d(%%rbp)", qbe_amd64_slot(ref, fn));
 			break;
 		case RCon:
 			off = fn->con[ref.val];
@@ -555,8 +555,8 @@ emitins(Ins i, Fn *fn, FILE *f)
 	}
 }
 
-static uint64_t
-framesz(Fn *fn)
+uint64_t
+qbe_amd64_framesz(Fn *fn) // @shoumodip: shared with encode.c
 {
 	uint64_t i, o, f;
 
@@ -576,7 +576,6 @@ qbe_amd64_emitfn(Fn *fn, FILE *f)
 		CMP(X)
 	#undef X
 	};
-	static int id0;
 	Blk *b, *s;
 	Ins *i, itmp;
 	int *r, c, o, n, lbl;
@@ -584,7 +583,7 @@ qbe_amd64_emitfn(Fn *fn, FILE *f)
 
 	qbe_emitfnlnk(fn->name, fn->linenr, &fn->lnk, f); // @shoumodip
 	fputs("\tpushq %rbp\n\tmovq %rsp, %rbp\n", f);
-	fs = framesz(fn);
+	fs = qbe_amd64_framesz(fn);
 	if (fs)
 		fprintf(f, "\tsubq $%"PRIu64", %%rsp\n", fs);
 	if (fn->vararg) {
@@ -603,7 +602,7 @@ qbe_amd64_emitfn(Fn *fn, FILE *f)
 
 	for (lbl=0, b=fn->start; b; b=b->link) {
 		if (lbl || b->npred > 1)
-			fprintf(f, "%sbb%d:\n", qbe_T.asloc, id0+b->id);
+			fprintf(f, "%sbb%d:\n", qbe_T.asloc, qbe_ctx->id0+b->id);
 		for (i=b->ins; i!=&b->ins[b->nins]; i++)
 			emitins(*i, fn, f);
 		lbl = 1;
@@ -632,7 +631,7 @@ qbe_amd64_emitfn(Fn *fn, FILE *f)
 		Jmp:
 			if (b->s1 != b->link)
 				fprintf(f, "\tjmp %sbb%d\n",
-					qbe_T.asloc, id0+b->s1->id);
+					qbe_T.asloc, qbe_ctx->id0+b->s1->id);
 			else
 				lbl = 0;
 			break;
@@ -646,13 +645,13 @@ qbe_amd64_emitfn(Fn *fn, FILE *f)
 				} else
 					c = qbe_cmpneg(c);
 				fprintf(f, "\tj%s %sbb%d\n", ctoa[c],
-					qbe_T.asloc, id0+b->s2->id);
+					qbe_T.asloc, qbe_ctx->id0+b->s2->id);
 				goto Jmp;
 			}
 			die("unhandled jump %d", b->jmp.type);
 		}
 	}
-	id0 += fn->nblk;
+	qbe_ctx->id0 += fn->nblk;
 	if (!qbe_T.apple)
 		qbe_elf_emitfnfin(fn->name, f);
 }
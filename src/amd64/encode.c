@@ -0,0 +1,977 @@
+// @shoumodip: Machine code for qbe_generate_object()
+//
+// Follows qbe_amd64_emitfn() instruction by instruction and picks the
+// encodings the GNU assembler picks, so the code is identical to what the
+// assembly path produces. The jumps are relaxed the same way: they start
+// short and only grow when their target ends up out of reach.
+#include "all.h"
+
+enum {
+	AReg,
+	AMem,
+	AImm,
+};
+
+enum {
+	NoReg = -1,
+	Rip = -2,
+};
+
+enum {
+	FW = 1, /* REX.W */
+	FBR = 2, /* byte register in ModRM.reg */
+	FBM = 4, /* byte register in ModRM.rm */
+};
+
+typedef struct Arg Arg;
+typedef struct Jmp Jmp;
+typedef struct Fix Fix;
+
+struct Arg {
+	int type;
+	int reg;
+	int base, index, scale;
+	int fs;
+	int64_t off; /* displacement or immediate */
+	int sym;     /* object symbol, -1 if none */
+	int tls;
+};
+
+struct Jmp {
+	uint pos;
+	int cc; /* -1 for jmp */
+	int blk;
+	int size;
+};
+
+struct Fix {
+	uint pos;
+	uint njmp; /* jumps before it */
+	int type;
+	int sym;
+	int64_t add;
+};
+
+static int cctab[] = {
+	[Ciule]      = 0x6,
+	[Ciult]      = 0x2,
+	[Cisle]      = 0xe,
+	[Cislt]      = 0xc,
+	[Cisgt]      = 0xf,
+	[Cisge]      = 0xd,
+	[Ciugt]      = 0x7,
+	[Ciuge]      = 0x3,
+	[Cieq]       = 0x4,
+	[Cine]       = 0x5,
+	[NCmpI+Cfle] = 0x6,
+	[NCmpI+Cflt] = 0x2,
+	[NCmpI+Cfgt] = 0x7,
+	[NCmpI+Cfge] = 0x3,
+	[NCmpI+Cfeq] = 0x4,
+	[NCmpI+Cfne] = 0x5,
+	[NCmpI+Cfo]  = 0xb,
+	[NCmpI+Cfuo] = 0xa,
+};
+
+static int hw[] = {
+	[RAX] = 0,  [RCX] = 1,  [RDX] = 2,  [RBX] = 3,
+	[RSP] = 4,  [RBP] = 5,  [RSI] = 6,  [RDI] = 7,
+	[R8]  = 8,  [R9]  = 9,  [R10] = 10, [R11] = 11,
+	[R12] = 12, [R13] = 13, [R14] = 14, [R15] = 15,
+};
+
+static void *negmask[4] = {
+	[Ks] = (uint32_t[4]){ 0x80000000 },
+	[Kd] = (uint64_t[2]){ 0x8000000000000000 },
+};
+
+static _Thread_local uchar *code;
+static _Thread_local uint ncode;
+static _Thread_local Jmp *jmp;
+static _Thread_local uint njmp;
+static _Thread_local Fix *fix;
+static _Thread_local uint nfix;
+
+static void
+out(uint64_t v, int n)
+{
+	qbe_vgrow(&code, ncode+n);
+	for (; n>0; n--, v>>=8)
+		code[ncode++] = v;
+}
+
+static void
+reloc(int type, int sym, int64_t add)
+{
+	qbe_vgrow(&fix, nfix+1);
+	fix[nfix++] = (Fix){ncode, njmp, type, sym, add};
+}
+
+static Arg
+reg(int r)
+{
+	assert(r <= XMM15);
+	return (Arg){
+		.type = AReg,
+		.reg = r >= XMM0 ? r - XMM0 : hw[r],
+		.base = NoReg,
+		.index = NoReg,
+		.sym = -1,
+	};
+}
+
+static Arg
+imm(int64_t v)
+{
+	return (Arg){.type = AImm, .off = v, .sym = -1};
+}
+
+static Arg
+mem(int base, int64_t off)
+{
+	return (Arg){
+		.type = AMem,
+		.base = base,
+		.index = NoReg,
+		.off = off,
+		.sym = -1,
+	};
+}
+
+static int
+consym(Con *c)
+{
+	return qbe_objsym(qbe_str(c->sym.id));
+}
+
+static Arg
+memarg(Mem *m, Fn *fn)
+{
+	Con off;
+	Arg a;
+
+	if (rtype(m->base) == RSlot) {
+		off.type = CBits;
+		off.bits.i = qbe_amd64_slot(m->base, fn);
+		qbe_addcon(&m->offset, &off);
+		m->base = TMP(RBP);
+	}
+	a = mem(NoReg, 0);
+	if (m->offset.type != CUndef)
+		a.off = m->offset.bits.i;
+	if (m->offset.type == CAddr) {
+		a.sym = consym(&m->offset);
+		a.fs = a.tls = m->offset.sym.type == SThr;
+	}
+	if (!req(m->base, R))
+		a.base = reg(m->base.val).reg;
+	else if (m->offset.type == CAddr && !a.tls)
+		a.base = Rip;
+	if (!req(m->index, R)) {
+		a.index = reg(m->index.val).reg;
+		a.scale = m->scale;
+	}
+	return a;
+}
+
+/* operands of the %0, %1 and %= kind */
+static Arg
+arg(Ref r, Fn *fn)
+{
+	Con *c;
+	Arg a;
+
+	switch (rtype(r)) {
+	case RTmp:
+		assert(qbe_isreg(r));
+		return reg(r.val);
+	case RSlot:
+		return mem(hw[RBP], qbe_amd64_slot(r, fn));
+	case RMem:
+		return memarg(&fn->mem[r.val], fn);
+	case RCon:
+		c = &fn->con[r.val];
+		a = imm(c->bits.i);
+		if (c->type == CAddr) {
+			if (c->sym.type == SThr)
+				die("invalid thread local immediate");
+			a.sym = consym(c);
+		}
+		return a;
+	default:
+		die("unreachable");
+	}
+}
+
+/* operands of the %M kind */
+static Arg
+marg(Ref r, Fn *fn)
+{
+	Con *c;
+	Arg a;
+
+	switch (rtype(r)) {
+	case RCon:
+		c = &fn->con[r.val];
+		a = mem(NoReg, c->bits.i);
+		if (c->type == CAddr) {
+			a.sym = consym(c);
+			if (c->sym.type == SThr)
+				a.fs = a.tls = 1;
+			else
+				a.base = Rip;
+		}
+		return a;
+	case RTmp:
+		assert(qbe_isreg(r));
+		return mem(reg(r.val).reg, 0);
+	default:
+		return arg(r, fn);
+	}
+}
+
+static void
+immediate(Arg *i, int sz, int fl)
+{
+	if (i->sym >= 0) {
+		assert(sz == 4);
+		reloc(fl & FW ? RelAbs32S : RelAbs32, i->sym, i->off);
+		out(0, 4);
+	} else
+		out(i->off, sz);
+}
+
+/* the instructions with a ModRM operand; the
+ * opcode is one byte, or two with the 0f escape */
+static void
+encode(int pfx, uint op, int fl, int r, Arg *m, int isz, Arg *i)
+{
+	int rex, mod, b, x;
+
+	rex = 0;
+	if (fl & FW)
+		rex |= 8;
+	if (r & 8)
+		rex |= 4;
+	if ((fl & FBR) && 4 <= r && r < 8)
+		rex |= 0x40;
+	if (m->type == AReg) {
+		if (m->reg & 8)
+			rex |= 1;
+		if ((fl & FBM) && 4 <= m->reg && m->reg < 8)
+			rex |= 0x40;
+	} else {
+		if (m->index >= 0 && (m->index & 8))
+			rex |= 2;
+		if (m->base >= 0 && (m->base & 8))
+			rex |= 1;
+	}
+	if (m->fs)
+		out(0x64, 1);
+	if (pfx)
+		out(pfx, 1);
+	if (rex)
+		out(0x40 | rex, 1);
+	if (op > 0xff)
+		out(op >> 8, 1);
+	out(op & 0xff, 1);
+
+	r &= 7;
+	if (m->type == AReg) {
+		out(0xc0 | r<<3 | (m->reg & 7), 1);
+		goto Imm;
+	}
+	x = m->index == NoReg ? 4 : m->index & 7;
+	x = x<<3 | (m->scale == 8 ? 3 : m->scale == 4 ? 2 : m->scale == 2) << 6;
+	if (m->base == Rip) {
+		out(0x05 | r<<3, 1);
+		mod = 2;
+	} else if (m->base == NoReg) {
+		out(0x04 | r<<3, 1);
+		out(x | 5, 1);
+		mod = 2;
+	} else {
+		b = m->base & 7;
+		if (m->sym >= 0 || m->off != (int8_t)m->off)
+			mod = 2;
+		else if (m->off == 0 && b != 5)
+			mod = 0;
+		else
+			mod = 1;
+		if (m->index != NoReg || b == 4) {
+			out(mod<<6 | r<<3 | 4, 1);
+			out(x | b, 1);
+		} else
+			out(mod<<6 | r<<3 | b, 1);
+	}
+	if (mod == 1)
+		out(m->off, 1);
+	else if (mod == 2) {
+		if (m->sym < 0)
+			out(m->off, 4);
+		else {
+			if (m->tls)
+				reloc(RelTpoff32, m->sym, m->off);
+			else if (m->base == Rip)
+				reloc(RelPc32, m->sym, m->off - 4 - isz);
+			else
+				reloc(RelAbs32S, m->sym, m->off);
+			out(0, 4);
+		}
+	}
+Imm:
+	if (i)
+		immediate(i, isz, fl);
+}
+
+/* the instructions without ModRM, the register if
+ * any is in the low bits of the opcode */
+static void
+encodeo(int sz, uint op, int r, int isz, Arg *i)
+{
+	int rex;
+
+	if (sz == 2)
+		out(0x66, 1);
+	rex = sz == 8 ? 8 : 0;
+	if (r >= 0 && (r & 8))
+		rex |= 1;
+	if (rex)
+		out(0x40 | rex, 1);
+	out(op + (r >= 0 ? r & 7 : 0), 1);
+	if (i)
+		immediate(i, isz, sz == 8 ? FW : 0);
+}
+
+static void
+encodei(int sz, uint op, int r, Arg *m, int isz, Arg *i)
+{
+	int fl;
+
+	fl = sz == 8 ? FW : sz == 1 ? FBR|FBM : 0;
+	encode(sz == 2 ? 0x66 : 0, op, fl, r, m, isz, i);
+}
+
+static int
+immsz(int sz)
+{
+	return sz == 8 ? 4 : sz;
+}
+
+static int
+isimm8(int64_t v, int sz)
+{
+	switch (sz) {
+	case 1: v = (int8_t)v; break;
+	case 2: v = (int16_t)v; break;
+	case 4: v = (int32_t)v; break;
+	}
+	return v == (int8_t)v;
+}
+
+/* add, or, and, sub, xor and cmp by ModRM.reg */
+static void
+alu(int op, int sz, Arg s, Arg d)
+{
+	int b;
+
+	b = sz == 1 ? 0 : 1;
+	if (s.type == AImm) {
+		if (s.sym < 0 && isimm8(s.off, sz))
+			encodei(sz, b ? 0x83 : 0x80, op, &d, 1, &s);
+		else if (d.type == AReg && d.reg == 0)
+			encodeo(sz, op*8 + 4 + b, -1, immsz(sz), &s);
+		else
+			encodei(sz, 0x80 + b, op, &d, immsz(sz), &s);
+	} else if (s.type == AReg)
+		encodei(sz, op*8 + b, s.reg, &d, 0, 0);
+	else
+		encodei(sz, op*8 + 2 + b, d.reg, &s, 0, 0);
+}
+
+static void
+shift(int op, int sz, Arg s, Arg d)
+{
+	if (s.type == AImm) {
+		if (s.off == 1)
+			encodei(sz, 0xd1, op, &d, 0, 0);
+		else
+			encodei(sz, 0xc1, op, &d, 1, &s);
+	} else
+		encodei(sz, 0xd3, op, &d, 0, 0);
+}
+
+static void
+test(int sz, Arg s, Arg d)
+{
+	if (s.type == AImm) {
+		if (d.type == AReg && d.reg == 0)
+			encodeo(sz, 0xa9, -1, immsz(sz), &s);
+		else
+			encodei(sz, 0xf7, 0, &d, immsz(sz), &s);
+	} else if (s.type == AReg)
+		encodei(sz, 0x85, s.reg, &d, 0, 0);
+	else
+		encodei(sz, 0x85, d.reg, &s, 0, 0);
+}
+
+static void
+mov(int sz, Arg s, Arg d)
+{
+	int b;
+
+	b = sz == 1 ? 0 : 1;
+	if (s.type == AImm) {
+		if (d.type != AReg)
+			encodei(sz, 0xc6 + b, 0, &d, immsz(sz), &s);
+		else if (sz != 8)
+			encodeo(sz, b ? 0xb8 : 0xb0, d.reg, sz, &s);
+		else if (s.sym >= 0 || s.off == (int32_t)s.off)
+			encodei(sz, 0xc7, 0, &d, 4, &s);
+		else
+			encodeo(sz, 0xb8, d.reg, 8, &s);
+	} else if (s.type == AReg)
+		encodei(sz, 0x88 + b, s.reg, &d, 0, 0);
+	else
+		encodei(sz, 0x8a + b, d.reg, &s, 0, 0);
+}
+
+/* movss and movsd */
+static void
+fmov(int k, Arg s, Arg d)
+{
+	int pfx;
+
+	pfx = k == Ks ? 0xf3 : 0xf2;
+	if (d.type == AReg)
+		encode(pfx, 0x0f10, 0, d.reg, &s, 0, 0);
+	else
+		encode(pfx, 0x0f11, 0, s.reg, &d, 0, 0);
+}
+
+static void
+movk(int k, Arg s, Arg d)
+{
+	if (KBASE(k) == 0)
+		mov(KWIDE(k) ? 8 : 4, s, d);
+	else
+		fmov(k, s, d);
+}
+
+/* addss, subss, mulss, divss and the sd ones */
+static void
+fop(int k, uint op, Arg s, Arg d)
+{
+	encode(k == Ks ? 0xf3 : 0xf2, op, 0, d.reg, &s, 0, 0);
+}
+
+static void encins(Ins, Fn *);
+
+static void
+enccopy(Ref r1, Ref r2, int k, Fn *fn)
+{
+	Ins icp;
+
+	icp.op = Ocopy;
+	icp.arg[0] = r2;
+	icp.to = r1;
+	icp.cls = k;
+	encins(icp, fn);
+}
+
+/* the same conversion to 2-address as emitf() */
+static void
+twoaddr(Ins *i, int comm, Fn *fn)
+{
+	Ref r;
+
+	if (comm && req(i->arg[1], i->to)) {
+		r = i->arg[0];
+		i->arg[0] = i->arg[1];
+		i->arg[1] = r;
+	}
+	assert((!req(i->arg[1], i->to) || req(i->arg[0], i->to)) &&
+		"cannot convert to 2-address");
+	enccopy(i->to, i->arg[0], i->cls, fn);
+}
+
+static void
+encins(Ins i, Fn *fn)
+{
+	static uchar aluop[NOp] = {
+		[Oadd] = 0, [Oor] = 1, [Oand] = 4, [Osub] = 5, [Oxor] = 6,
+	};
+	static uchar shop[NOp] = {
+		[Oshl] = 4, [Oshr] = 5, [Osar] = 7,
+	};
+	static uint fltop[NOp] = {
+		[Oadd] = 0x0f58, [Omul] = 0x0f59, [Osub] = 0x0f5c, [Odiv] = 0x0f5e,
+	};
+	static uint extop[NOp] = {
+		[Oloadsh] = 0x0fbf, [Oloaduh] = 0x0fb7,
+		[Oloadsb] = 0x0fbe, [Oloadub] = 0x0fb6,
+		[Oextsh] = 0x0fbf, [Oextuh] = 0x0fb7,
+		[Oextsb] = 0x0fbe, [Oextub] = 0x0fb6,
+	};
+	Ref r;
+	Arg a0, a1, to;
+	int64_t val;
+	int sz, t0, k;
+	Ins ineg;
+	Con *con;
+	char name[16];
+
+	sz = KWIDE(i.cls) ? 8 : 4;
+	switch (i.op) {
+	default:
+		if (Oflag <= i.op && i.op <= Oflag1 && KBASE(i.cls) == 0) {
+			to = reg(i.to.val);
+			encode(0, 0x0f90 | cctab[i.op-Oflag], FBM, 0, &to, 0, 0);
+			encode(0, 0x0fb6, (sz == 8 ? FW : 0) | FBM, to.reg, &to, 0, 0);
+			break;
+		}
+		die("no match for %s(%c)",
+			qbe_optab[i.op].name, "wlsd"[i.cls]);
+	case Onop:
+		break;
+	case Oadd:
+	case Oand:
+	case Oor:
+	case Oxor:
+		twoaddr(&i, 1, fn);
+	Alu:
+		if (KBASE(i.cls) == 0)
+			alu(aluop[i.op], sz, arg(i.arg[1], fn), arg(i.to, fn));
+		else
+			fop(i.cls, fltop[i.op], arg(i.arg[1], fn), arg(i.to, fn));
+		break;
+	case Osub:
+		/* we have to use the negation trick to handle
+		 * some 3-address subtractions */
+		if (req(i.to, i.arg[1]) && !req(i.arg[0], i.to)) {
+			ineg = (Ins){Oneg, i.cls, i.to, {i.to}};
+			encins(ineg, fn);
+			i.op = Oadd;
+			i.arg[1] = i.arg[0];
+			goto Alu;
+		}
+		twoaddr(&i, 0, fn);
+		goto Alu;
+	case Osar:
+	case Oshr:
+	case Oshl:
+		twoaddr(&i, 0, fn);
+		shift(shop[i.op], sz, arg(i.arg[1], fn), arg(i.to, fn));
+		break;
+	case Omul:
+		if (rtype(i.arg[1]) == RCon) {
+			r = i.arg[0];
+			i.arg[0] = i.arg[1];
+			i.arg[1] = r;
+		}
+		if (KBASE(i.cls) == 0
+		&& rtype(i.arg[0]) == RCon
+		&& rtype(i.arg[1]) == RTmp) {
+			a0 = arg(i.arg[0], fn);
+			a1 = arg(i.arg[1], fn);
+			goto Imul3;
+		}
+		twoaddr(&i, 1, fn);
+		if (KBASE(i.cls) != 0) {
+			fop(i.cls, fltop[i.op], arg(i.arg[1], fn), arg(i.to, fn));
+			break;
+		}
+		a0 = arg(i.arg[1], fn);
+		a1 = arg(i.to, fn);
+		if (a0.type == AImm) {
+		Imul3:
+			to = arg(i.to, fn);
+			if (isimm8(a0.off, sz))
+				encodei(sz, 0x6b, to.reg, &a1, 1, &a0);
+			else
+				encodei(sz, 0x69, to.reg, &a1, 4, &a0);
+		} else
+			encodei(sz, 0x0faf, a1.reg, &a0, 0, 0);
+		break;
+	case Odiv:
+		/* use xmm15 to adjust the instruction when the
+		 * conversion to 2-address would fail */
+		if (KBASE(i.cls) == 0)
+			die("no match for %s(%c)",
+				qbe_optab[i.op].name, "wlsd"[i.cls]);
+		if (req(i.to, i.arg[1])) {
+			i.arg[1] = TMP(XMM0+15);
+			movk(i.cls, arg(i.to, fn), arg(i.arg[1], fn));
+			movk(i.cls, arg(i.arg[0], fn), arg(i.to, fn));
+			i.arg[0] = i.to;
+		}
+		twoaddr(&i, 0, fn);
+		fop(i.cls, fltop[i.op], arg(i.arg[1], fn), arg(i.to, fn));
+		break;
+	case Ostorel:
+	case Ostorew:
+	case Ostoreh:
+	case Ostoreb:
+		sz = i.op == Ostorel ? 8 : i.op == Ostorew ? 4 : i.op == Ostoreh ? 2 : 1;
+		a0 = arg(i.arg[0], fn);
+		a1 = marg(i.arg[1], fn);
+		if (rtype(i.arg[0]) == RTmp && i.arg[0].val >= XMM0)
+			/* movq %xmm, m64 */
+			encode(0x66, 0x0fd6, 0, a0.reg, &a1, 0, 0);
+		else
+			mov(sz, a0, a1);
+		break;
+	case Ostores:
+	case Ostored:
+		fmov(i.op == Ostores ? Ks : Kd, arg(i.arg[0], fn), marg(i.arg[1], fn));
+		break;
+	case Oload:
+		movk(i.cls, marg(i.arg[0], fn), arg(i.to, fn));
+		break;
+	case Oloadsw:
+	case Oextsw:
+		if (i.op == Oloadsw)
+			a0 = marg(i.arg[0], fn);
+		else
+			a0 = arg(i.arg[0], fn);
+		to = arg(i.to, fn);
+		if (i.cls == Kl)
+			encodei(8, 0x63, to.reg, &a0, 0, 0);
+		else
+			mov(4, a0, to);
+		break;
+	case Oloaduw:
+		mov(4, marg(i.arg[0], fn), arg(i.to, fn));
+		break;
+	case Oextuw:
+		mov(4, arg(i.arg[0], fn), arg(i.to, fn));
+		break;
+	case Oloadsh:
+	case Oloaduh:
+	case Oloadsb:
+	case Oloadub:
+		a0 = marg(i.arg[0], fn);
+		to = arg(i.to, fn);
+		encodei(sz, extop[i.op], to.reg, &a0, 0, 0);
+		break;
+	case Oextsh:
+	case Oextuh:
+	case Oextsb:
+	case Oextub:
+		a0 = arg(i.arg[0], fn);
+		to = arg(i.to, fn);
+		k = i.op == Oextsb || i.op == Oextub ? FBM : 0;
+		encode(0, extop[i.op], (sz == 8 ? FW : 0) | k, to.reg, &a0, 0, 0);
+		break;
+	case Oexts:
+	case Otruncd:
+		a0 = arg(i.arg[0], fn);
+		to = arg(i.to, fn);
+		encode(i.op == Oexts ? 0xf3 : 0xf2, 0x0f5a, 0, to.reg, &a0, 0, 0);
+		break;
+	case Ostosi:
+	case Odtosi:
+		a0 = arg(i.arg[0], fn);
+		to = arg(i.to, fn);
+		encode(i.op == Ostosi ? 0xf3 : 0xf2, 0x0f2c, sz == 8 ? FW : 0, to.reg, &a0, 0, 0);
+		break;
+	case Oswtof:
+	case Osltof:
+		a0 = arg(i.arg[0], fn);
+		to = arg(i.to, fn);
+		k = i.op == Osltof ? FW : 0;
+		encode(i.cls == Ks ? 0xf3 : 0xf2, 0x0f2a, k, to.reg, &a0, 0, 0);
+		break;
+	case Ocast:
+		a0 = arg(i.arg[0], fn);
+		to = arg(i.to, fn);
+		if (a0.type != AReg) {
+			if (KBASE(i.cls) == 0)
+				mov(8, a0, to);
+			else
+				encode(0xf3, 0x0f7e, 0, to.reg, &a0, 0, 0);
+		} else if (KBASE(i.cls) == 0)
+			encode(0x66, 0x0f7e, FW, a0.reg, &to, 0, 0);
+		else
+			encode(0x66, 0x0f6e, FW, to.reg, &a0, 0, 0);
+		break;
+	case Oaddr:
+		to = arg(i.to, fn);
+		if (rtype(i.arg[0]) == RCon
+		&& fn->con[i.arg[0].val].sym.type == SThr) {
+			/* derive the symbol address from the TCB
+			 * address at offset 0 of %fs */
+			con = &fn->con[i.arg[0].val];
+			a0 = mem(NoReg, 0);
+			a0.fs = 1;
+			mov(8, a0, to);
+			a0 = mem(to.reg, con->bits.i);
+			a0.sym = consym(con);
+			a0.tls = 1;
+			encodei(8, 0x8d, to.reg, &a0, 0, 0);
+			break;
+		}
+		a0 = marg(i.arg[0], fn);
+		encodei(sz, 0x8d, to.reg, &a0, 0, 0);
+		break;
+	case Oswap:
+		if (KBASE(i.cls) == 0) {
+			a0 = arg(i.arg[0], fn);
+			a1 = arg(i.arg[1], fn);
+			if (a0.type == AReg && a1.type == AReg
+			&& (a0.reg == 0 || a1.reg == 0))
+				encodeo(sz, 0x90, a0.reg | a1.reg, 0, 0);
+			else if (a0.type == AReg)
+				encodei(sz, 0x87, a0.reg, &a1, 0, 0);
+			else
+				encodei(sz, 0x87, a1.reg, &a0, 0, 0);
+			break;
+		}
+		/* for floats, there is no swap instruction
+		 * so we use xmm15 as a temporary
+		 */
+		enccopy(TMP(XMM0+15), i.arg[0], i.cls, fn);
+		enccopy(i.arg[0], i.arg[1], i.cls, fn);
+		enccopy(i.arg[1], TMP(XMM0+15), i.cls, fn);
+		break;
+	case Osign:
+		encodeo(sz, 0x99, -1, 0, 0);
+		break;
+	case Oxdiv:
+	case Oxidiv:
+		a0 = arg(i.arg[0], fn);
+		encodei(sz, 0xf7, i.op == Oxdiv ? 6 : 7, &a0, 0, 0);
+		break;
+	case Oxcmp:
+		if (KBASE(i.cls) == 0) {
+			alu(7, sz, arg(i.arg[0], fn), arg(i.arg[1], fn));
+			break;
+		}
+		a0 = arg(i.arg[0], fn);
+		a1 = arg(i.arg[1], fn);
+		encode(i.cls == Ks ? 0 : 0x66, 0x0f2e, 0, a1.reg, &a0, 0, 0);
+		break;
+	case Oxtest:
+		test(sz, arg(i.arg[0], fn), arg(i.arg[1], fn));
+		break;
+	case Oneg:
+		if (!req(i.to, i.arg[0]))
+			movk(i.cls, arg(i.arg[0], fn), arg(i.to, fn));
+		to = arg(i.to, fn);
+		if (KBASE(i.cls) == 0)
+			encodei(sz, 0xf7, 3, &to, 0, 0);
+		else {
+			sprintf(name, "%sfp%d", qbe_T.asloc,
+				qbe_stashbits(negmask[i.cls], 16));
+			a0 = mem(Rip, 0);
+			a0.sym = qbe_objsym(name);
+			encode(i.cls == Kd ? 0x66 : 0, 0x0f57, 0, to.reg, &a0, 0, 0);
+		}
+		break;
+	case Ocopy:
+		/* see qbe_amd64_emitfn() */
+		assert(rtype(i.to) != RMem);
+		if (req(i.to, R) || req(i.arg[0], R))
+			break;
+		if (req(i.to, i.arg[0]))
+			break;
+		t0 = rtype(i.arg[0]);
+		if (i.cls == Kl
+		&& t0 == RCon
+		&& fn->con[i.arg[0].val].type == CBits) {
+			val = fn->con[i.arg[0].val].bits.i;
+			if (qbe_isreg(i.to))
+			if (val >= 0 && val <= UINT32_MAX) {
+				mov(4, imm(val), arg(i.to, fn));
+				break;
+			}
+			if (rtype(i.to) == RSlot)
+			if (val < INT32_MIN || val > INT32_MAX) {
+				to = arg(i.to, fn);
+				mov(4, imm(val), to);
+				to.off += 4;
+				mov(4, imm(val >> 32), to);
+				break;
+			}
+		}
+		if (qbe_isreg(i.to)
+		&& t0 == RCon
+		&& fn->con[i.arg[0].val].type == CAddr) {
+			a0 = marg(i.arg[0], fn);
+			to = arg(i.to, fn);
+			encodei(sz, 0x8d, to.reg, &a0, 0, 0);
+			break;
+		}
+		if (rtype(i.to) == RSlot
+		&& (t0 == RSlot || t0 == RMem)) {
+			k = KWIDE(i.cls) ? Kd : Ks;
+			movk(k, arg(i.arg[0], fn), reg(XMM15));
+			movk(k, reg(XMM15), arg(i.to, fn));
+			break;
+		}
+		movk(i.cls, arg(i.arg[0], fn), arg(i.to, fn));
+		break;
+	case Ocall:
+		switch (rtype(i.arg[0])) {
+		case RCon:
+			con = &fn->con[i.arg[0].val];
+			out(0xe8, 1);
+			reloc(RelPlt32, consym(con), con->bits.i - 4);
+			out(0, 4);
+			break;
+		case RTmp:
+			a0 = arg(i.arg[0], fn);
+			encode(0, 0xff, 0, 2, &a0, 0, 0);
+			break;
+		default:
+			die("invalid call argument");
+		}
+		break;
+	case Osalloc:
+		alu(5, 8, arg(i.arg[0], fn), reg(RSP));
+		if (!req(i.to, R))
+			enccopy(i.to, TMP(RSP), Kl, fn);
+		break;
+	case Odbgloc:
+		/* no debug information in objects */
+		break;
+	}
+}
+
+static void
+encjmp(int cc, Blk *b)
+{
+	qbe_vgrow(&jmp, njmp+1);
+	jmp[njmp++] = (Jmp){ncode, cc, b->id, 2};
+}
+
+/* moves the code to the object, with the
+ * jumps as short as their targets allow */
+static void
+flush(uint *lblpos, uint *lbljmp)
+{
+	uint *sum, n, pos;
+	int64_t d;
+	uint64_t start;
+	int grown;
+
+	sum = qbe_alloc((njmp+1) * sizeof sum[0]);
+	do {
+		grown = 0;
+		for (sum[0]=0, n=0; n<njmp; n++)
+			sum[n+1] = sum[n] + jmp[n].size;
+		for (n=0; n<njmp; n++) {
+			if (jmp[n].size != 2)
+				continue;
+			d = (int64_t)lblpos[jmp[n].blk] + sum[lbljmp[jmp[n].blk]]
+				- (jmp[n].pos + sum[n] + 2);
+			if (d != (int8_t)d) {
+				jmp[n].size = jmp[n].cc < 0 ? 5 : 6;
+				grown = 1;
+			}
+		}
+	} while (grown);
+
+	start = qbe_objpos();
+	for (pos=0, n=0; n<njmp; n++) {
+		qbe_objbytes(&code[pos], jmp[n].pos - pos);
+		pos = jmp[n].pos;
+		d = (int64_t)lblpos[jmp[n].blk] + sum[lbljmp[jmp[n].blk]]
+			- (jmp[n].pos + sum[n] + jmp[n].size);
+		if (jmp[n].size == 2) {
+			qbe_objle(jmp[n].cc < 0 ? 0xeb : 0x70 | jmp[n].cc, 1);
+			qbe_objle(d, 1);
+		} else {
+			if (jmp[n].cc < 0)
+				qbe_objle(0xe9, 1);
+			else
+				qbe_objle((0x80 | jmp[n].cc) << 8 | 0x0f, 2);
+			qbe_objle(d, 4);
+		}
+	}
+	qbe_objbytes(&code[pos], ncode - pos);
+	for (n=0; n<nfix; n++)
+		qbe_objrel(start + fix[n].pos + sum[fix[n].njmp],
+			fix[n].type, fix[n].sym, fix[n].add);
+}
+
+void
+qbe_amd64_encodefn(Fn *fn)
+{
+	Blk *b, *s;
+	Ins *i;
+	int *r, c, o, n;
+	uint *lblpos, *lbljmp;
+	uint64_t fs;
+	Arg m;
+
+	code = qbe_vnew(0, 1, PFn);
+	jmp = qbe_vnew(0, sizeof jmp[0], PFn);
+	fix = qbe_vnew(0, sizeof fix[0], PFn);
+	ncode = njmp = nfix = 0;
+	lblpos = qbe_alloc(fn->nblk * sizeof lblpos[0]);
+	lbljmp = qbe_alloc(fn->nblk * sizeof lbljmp[0]);
+
+	qbe_objfnlnk(fn->name, &fn->lnk);
+	out(0x55, 1); /* pushq %rbp */
+	out(0xe58948, 3); /* movq %rsp, %rbp */
+	fs = qbe_amd64_framesz(fn);
+	if (fs)
+		alu(5, 8, imm(fs), reg(RSP));
+	if (fn->vararg) {
+		o = -176;
+		for (r=qbe_amd64_sysv_rsave; r<&qbe_amd64_sysv_rsave[6]; r++, o+=8)
+			mov(8, reg(*r), mem(hw[RBP], o));
+		for (n=0; n<8; ++n, o+=16) {
+			m = mem(hw[RBP], o);
+			encode(0, 0x0f29, 0, n, &m, 0, 0); /* movaps */
+		}
+	}
+	for (r=qbe_amd64_sysv_rclob; r<&qbe_amd64_sysv_rclob[NCLR]; r++)
+		if (fn->reg & BIT(*r)) {
+			encodeo(4, 0x50, hw[*r], 0, 0);
+			fs += 8;
+		}
+
+	for (b=fn->start; b; b=b->link) {
+		lblpos[b->id] = ncode;
+		lbljmp[b->id] = njmp;
+		for (i=b->ins; i!=&b->ins[b->nins]; i++)
+			encins(*i, fn);
+		switch (b->jmp.type) {
+		case Jhlt:
+			out(0x0b0f, 2); /* ud2 */
+			break;
+		case Jret0:
+			if (fn->dynalloc) {
+				mov(8, reg(RBP), reg(RSP));
+				alu(5, 8, imm(fs), reg(RSP));
+			}
+			for (r=&qbe_amd64_sysv_rclob[NCLR]; r>qbe_amd64_sysv_rclob;)
+				if (fn->reg & BIT(*--r))
+					encodeo(4, 0x58, hw[*r], 0, 0);
+			out(0xc3c9, 2); /* leave; ret */
+			break;
+		case Jjmp:
+		Jmp:
+			if (b->s1 != b->link)
+				encjmp(-1, b->s1);
+			break;
+		default:
+			c = b->jmp.type - Jjf;
+			if (0 <= c && c <= NCmp) {
+				if (b->link == b->s2) {
+					s = b->s1;
+					b->s1 = b->s2;
+					b->s2 = s;
+				} else
+					c = qbe_cmpneg(c);
+				encjmp(cctab[c], b->s2);
+				goto Jmp;
+			}
+			die("unhandled jump %d", b->jmp.type);
+		}
+	}
+	flush(lblpos, lbljmp);
+	qbe_objfnfin(fn->name);
+}
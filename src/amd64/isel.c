@@ -748,7 +748,7 @@ qbe_amd64_isel(Fn *fn)
 	n = fn->ntmp;
 	ainfo = qbe_emalloc(n * sizeof ainfo[0]);
 	for (b=fn->start; b; b=b->link) {
-		qbe_curi = &qbe_insb[NIns];
+		qbe_insreset(b->nins); // @shoumodip
 		for (sb=(Blk*[3]){b->s1, b->s2, 0}; *sb; sb++)
 			for (p=(*sb)->phi; p; p=p->link) {
 				for (a=0; p->blk[a] != b; a++)
@@ -760,10 +760,10 @@ qbe_amd64_isel(Fn *fn)
 		seljmp(b, fn);
 		for (i=&b->ins[b->nins]; i!=b->ins;)
 			sel(*--i, ainfo, fn);
-		b->nins = &qbe_insb[NIns] - qbe_curi;
+		b->nins = qbe_inse - qbe_curi;
 		qbe_idup(&b->ins, qbe_curi, b->nins);
 	}
-	free(ainfo);
+	qbe_memfree(ainfo); // @shoumodip
 
 	if (qbe_debug['I']) {
 		fprintf(stderr, "\n> After instruction selection:\n");
@@ -435,7 +435,7 @@ selpar(Fn *fn, Ins *i0, Ins *i1)
 
 	env = R;
 	ac = qbe_alloc((i1-i0) * sizeof ac[0]);
-	qbe_curi = &qbe_insb[NIns];
+	qbe_insreset(i1-i0); // @shoumodip
 	ni = ns = 0;
 
 	if (fn->retty >= 0) {
@@ -508,9 +508,9 @@ split(Fn *fn, Blk *b)
 
 	++fn->nblk;
 	bn = qbe_newblk();
-	bn->nins = &qbe_insb[NIns] - qbe_curi;
+	bn->nins = qbe_inse - qbe_curi;
 	qbe_idup(&bn->ins, qbe_curi, bn->nins);
-	qbe_curi = &qbe_insb[NIns];
+	qbe_insreset(0); // @shoumodip
 	bn->visit = ++b->visit;
 	qbe_strf(bn->name, "%s.%d", b->name, b->visit);
 	bn->loop = b->loop;
@@ -669,9 +669,9 @@ qbe_amd64_sysv_abi(Fn *fn)
 		if (!ispar(i->op))
 			break;
 	fa = selpar(fn, b->ins, i);
-	n = b->nins - (i - b->ins) + (&qbe_insb[NIns] - qbe_curi);
+	n = b->nins - (i - b->ins) + (qbe_inse - qbe_curi);
 	i0 = qbe_alloc(n * sizeof(Ins));
-	ip = qbe_icpy(ip = i0, qbe_curi, &qbe_insb[NIns] - qbe_curi);
+	ip = qbe_icpy(ip = i0, qbe_curi, qbe_inse - qbe_curi);
 	ip = qbe_icpy(ip, i, &b->ins[b->nins] - i);
 	b->nins = n;
 	b->ins = i0;
@@ -684,7 +684,7 @@ qbe_amd64_sysv_abi(Fn *fn)
 			b = fn->start; /* do it last */
 		if (b->visit)
 			continue;
-		qbe_curi = &qbe_insb[NIns];
+		qbe_insreset(b->nins); // @shoumodip
 		selret(b, fn);
 		for (i=&b->ins[b->nins]; i!=b->ins;)
 			switch ((--i)->op) {
@@ -711,7 +711,7 @@ qbe_amd64_sysv_abi(Fn *fn)
 		if (b == fn->start)
 			for (; ral; ral=ral->link)
 				qbe_emiti(ral->i);
-		b->nins = &qbe_insb[NIns] - qbe_curi;
+		b->nins = qbe_inse - qbe_curi;
 		qbe_idup(&b->ins, qbe_curi, b->nins);
 	} while (b != fn->start);
 
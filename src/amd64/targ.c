@@ -32,6 +32,7 @@ amd64_memargs(int op)
 Target qbe_T_amd64_sysv = {
 	.name = "amd64_sysv",
 	.emitfin = qbe_elf_emitfin,
+	.encodefn = qbe_amd64_encodefn, // @shoumodip
 	.asloc = ".L",
 	AMD64_COMMON
 };
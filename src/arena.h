@@ -31,13 +31,28 @@
 #    define ARENA_MINIMUM_CAPACITY 16000
 #endif // ARENA_MINIMUM_CAPACITY
 
+// The regions are allocated with ARENA_MALLOC(a, size) and released with ARENA_FREE(a, ptr), which
+// may use the context of the arena. A NULL from ARENA_MALLOC() fails the allocation
+#ifndef ARENA_MALLOC
+#    define ARENA_MALLOC(a, size) ((void) (a), malloc(size))
+#endif // ARENA_MALLOC
+
+#ifndef ARENA_FREE
+#    define ARENA_FREE(a, ptr) ((void) (a), free(ptr))
+#endif // ARENA_FREE
+
 typedef struct ArenaRegion ArenaRegion;
 
+// Allocations bump a pointer in the current region. Regions double in capacity as the arena grows,
+// and are kept around by arena_reset() to be reused
 typedef struct {
     ArenaRegion *head;
+    ArenaRegion *current;
+    void        *context; // Of the user, for ARENA_MALLOC() and ARENA_FREE()
 } Arena;
 
 ARENA_API void  arena_free(Arena *a);
+ARENA_API void  arena_reset(Arena *a);
 ARENA_API void *arena_alloc(Arena *a, size_t size);
 
 #endif // ARENA_H
@@ -57,34 +72,57 @@ ARENA_API void arena_free(Arena *a) {
     ArenaRegion *it = a->head;
     while (it) {
         ArenaRegion *next = it->next;
-        free(it);
+        ARENA_FREE(a, it);
         it = next;
     }
+
+    a->head = NULL;
+    a->current = NULL;
 }
 
-ARENA_API void *arena_alloc(Arena *a, size_t size) {
-    ArenaRegion *region = NULL;
+ARENA_API void arena_reset(Arena *a) {
     for (ArenaRegion *it = a->head; it; it = it->next) {
-        if (it->count + size <= it->capacity) {
-            region = it;
-            break;
-        }
+        it->count = 0;
     }
 
+    a->current = a->head;
+}
+
+ARENA_API void *arena_alloc(Arena *a, size_t size) {
     size = (size + 7) & -8; // Alignment
+
+    // Regions are only skipped after a reset, each of them at most once until the next one
+    ArenaRegion *prev = NULL;
+    ArenaRegion *region = a->current;
+    while (region && region->count + size > region->capacity) {
+        prev = region;
+        region = region->next;
+    }
+
     if (!region) {
-        size_t capacity = size;
-        if (capacity < ARENA_MINIMUM_CAPACITY) {
-            capacity = ARENA_MINIMUM_CAPACITY;
+        size_t capacity = prev ? prev->capacity * 2 : ARENA_MINIMUM_CAPACITY;
+        if (capacity < size) {
+            capacity = size;
+        }
+
+        region = ARENA_MALLOC(a, sizeof(ArenaRegion) + capacity);
+        if (!region) {
+            return NULL;
         }
 
-        region = malloc(sizeof(ArenaRegion) + capacity);
-        region->next = a->head;
+        region->next = NULL;
         region->count = 0;
         region->capacity = capacity;
-        a->head = region;
+
+        if (prev) {
+            prev->next = region;
+        } else {
+            a->head = region;
+        }
     }
 
+    a->current = region;
+
     void *ptr = &region->data[region->count];
     region->count += size;
     return ptr;
@@ -478,7 +478,7 @@ selpar(Fn *fn, Ins *i0, Ins *i1)
 	Ref r, tmp[16], *t;
 
 	ca = qbe_alloc((i1-i0) * sizeof ca[0]);
-	qbe_curi = &qbe_insb[NIns];
+	qbe_insreset(i1-i0); // @shoumodip
 
 	cty = argsclass(i0, i1, ca);
 	fn->reg = qbe_arm64_argregs(CALL(cty), 0);
@@ -543,9 +543,9 @@ split(Fn *fn, Blk *b)
 
 	++fn->nblk;
 	bn = qbe_newblk();
-	bn->nins = &qbe_insb[NIns] - qbe_curi;
+	bn->nins = qbe_inse - qbe_curi;
 	qbe_idup(&bn->ins, qbe_curi, bn->nins);
-	qbe_curi = &qbe_insb[NIns];
+	qbe_insreset(0); // @shoumodip
 	bn->visit = ++b->visit;
 	qbe_strf(bn->name, "%s.%d", b->name, b->visit);
 	bn->loop = b->loop;
@@ -741,9 +741,9 @@ qbe_arm64_abi(Fn *fn)
 		if (!ispar(i->op))
 			break;
 	p = selpar(fn, b->ins, i);
-	n = b->nins - (i - b->ins) + (&qbe_insb[NIns] - qbe_curi);
+	n = b->nins - (i - b->ins) + (qbe_inse - qbe_curi);
 	i0 = qbe_alloc(n * sizeof(Ins));
-	ip = qbe_icpy(ip = i0, qbe_curi, &qbe_insb[NIns] - qbe_curi);
+	ip = qbe_icpy(ip = i0, qbe_curi, qbe_inse - qbe_curi);
 	ip = qbe_icpy(ip, i, &b->ins[b->nins] - i);
 	b->nins = n;
 	b->ins = i0;
@@ -756,7 +756,7 @@ qbe_arm64_abi(Fn *fn)
 			b = fn->start; /* do it last */
 		if (b->visit)
 			continue;
-		qbe_curi = &qbe_insb[NIns];
+		qbe_insreset(b->nins); // @shoumodip
 		selret(b, fn);
 		for (i=&b->ins[b->nins]; i!=b->ins;)
 			switch ((--i)->op) {
@@ -789,7 +789,7 @@ qbe_arm64_abi(Fn *fn)
 		if (b == fn->start)
 			for (; il; il=il->link)
 				qbe_emiti(il->i);
-		b->nins = &qbe_insb[NIns] - qbe_curi;
+		b->nins = qbe_inse - qbe_curi;
 		qbe_idup(&b->ins, qbe_curi, b->nins);
 	} while (b != fn->start);
 
@@ -812,7 +812,7 @@ qbe_apple_extsb(Fn *fn)
 	Ref r;
 
 	for (b=fn->start; b; b=b->link) {
-		qbe_curi = &qbe_insb[NIns];
+		qbe_insreset(b->nins); // @shoumodip
 		j = b->jmp.type;
 		if (isretbh(j)) {
 			r = qbe_newtmp("abi", Kw, fn);
@@ -841,7 +841,7 @@ qbe_apple_extsb(Fn *fn)
 					qbe_emit(op, Kw, i->to, i->arg[0], R);
 				}
 		}
-		b->nins = &qbe_insb[NIns] - qbe_curi;
+		b->nins = qbe_inse - qbe_curi;
 		qbe_idup(&b->ins, qbe_curi, b->nins);
 	}
 
@@ -112,7 +112,7 @@ static struct {
 static char *
 rname(int r, int k)
 {
-	static char buf[4];
+	static _Thread_local char buf[4];
 
 	if (r == SP) {
 		assert(k == Kl);
@@ -511,7 +511,6 @@ qbe_arm64_emitfn(Fn *fn, FILE *out)
 		CMP(X)
 	#undef X
 	};
-	static int id0;
 	int s, n, c, lbl, *r;
 	uint64_t o;
 	Blk *b, *t;
@@ -569,7 +568,7 @@ qbe_arm64_emitfn(Fn *fn, FILE *out)
 
 	for (lbl=0, b=e->fn->start; b; b=b->link) {
 		if (lbl || b->npred > 1)
-			fprintf(e->f, "%s%d:\n", qbe_T.asloc, id0+b->id);
+			fprintf(e->f, "%s%d:\n", qbe_T.asloc, qbe_ctx->id0+b->id);
 		for (i=b->ins; i!=&b->ins[b->nins]; i++)
 			emitins(i, e);
 		lbl = 1;
@@ -624,7 +623,7 @@ qbe_arm64_emitfn(Fn *fn, FILE *out)
 			if (b->s1 != b->link)
 				fprintf(e->f,
 					"\tb\t%s%d\n",
-					qbe_T.asloc, id0+b->s1->id
+					qbe_T.asloc, qbe_ctx->id0+b->s1->id
 				);
 			else
 				lbl = 0;
@@ -641,12 +640,12 @@ qbe_arm64_emitfn(Fn *fn, FILE *out)
 				c = qbe_cmpneg(c);
 			fprintf(e->f,
 				"\tb%s\t%s%d\n",
-				ctoa[c], qbe_T.asloc, id0+b->s2->id
+				ctoa[c], qbe_T.asloc, qbe_ctx->id0+b->s2->id
 			);
 			goto Jmp;
 		}
 	}
-	id0 += e->fn->nblk;
+	qbe_ctx->id0 += e->fn->nblk;
 	if (!qbe_T.apple)
 		qbe_elf_emitfnfin(fn->name, out);
 }
@@ -296,7 +296,7 @@ qbe_arm64_isel(Fn *fn)
 			}
 
 	for (b=fn->start; b; b=b->link) {
-		qbe_curi = &qbe_insb[NIns];
+		qbe_insreset(b->nins); // @shoumodip
 		for (sb=(Blk*[3]){b->s1, b->s2, 0}; *sb; sb++)
 			for (p=(*sb)->phi; p; p=p->link) {
 				for (n=0; p->blk[n] != b; n++)
@@ -306,7 +306,7 @@ qbe_arm64_isel(Fn *fn)
 		seljmp(b, fn);
 		for (i=&b->ins[b->nins]; i!=b->ins;)
 			sel(*--i, fn);
-		b->nins = &qbe_insb[NIns] - qbe_curi;
+		b->nins = qbe_inse - qbe_curi;
 		qbe_idup(&b->ins, qbe_curi, b->nins);
 	}
 
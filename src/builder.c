@@ -25,8 +25,13 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "all.h"
+
+// The regions of the arena are charged to the handle, like everything else the builder allocates
 #define ARENA_API static
 #define ARENA_IMPLEMENTATION
+#define ARENA_MALLOC(a, size) qbe_memalloc((a)->context, (size))
+#define ARENA_FREE(a, ptr)    qbe_memfree(ptr)
 #include "arena.h"
 #include "qbe.h"
 
@@ -76,6 +81,7 @@ struct QbeNode {
         double real;
     };
 
+    size_t   epoch;
     QbeNode *next;
 };
 
@@ -106,9 +112,9 @@ typedef struct {
 } QbeArg;
 
 typedef struct {
-    QbeNode      node;
-    QbePhiBranch a;
-    QbePhiBranch b;
+    QbeNode       node;
+    QbePhiBranch *branches;
+    size_t        count;
 } QbePhi;
 
 struct QbeCall {
@@ -167,6 +173,7 @@ struct QbeFn {
     size_t  debug_line;
 
     QbeBlock *current_block;
+    size_t    finished; // Epoch in which the function was pushed through the backend
 };
 
 typedef struct QbeVarInit QbeVarInit;
@@ -242,6 +249,9 @@ typedef struct {
     size_t           count;
     size_t           capacity;
     size_t           iota;
+
+    QbeStruct **order; // Canonical structs, indexed by iota
+    size_t      order_capacity;
 } QbeStructCache;
 
 typedef struct {
@@ -270,12 +280,19 @@ struct Qbe {
 
     size_t blocks;
     size_t locals;
+    size_t globals;
+    size_t epoch;
+    size_t typs; // Structures lowered into qbe_typ so far
 
     QbeArrayCache  array_cache;
     QbeStructCache struct_cache;
 
     bool  compiled;
     QbeSB sb;
+    QbeSB bin;
+
+    Ctx   *ctx;    // Backend state, created on the first generation
+    size_t memory; // Bytes in use by the builder and the backend state, see qbe_get_memory_usage()
 };
 
 static bool qbe_type_kind_is_float(QbeTypeKind k) {
@@ -354,6 +371,7 @@ static QbeNode *qbe_node_alloc(Qbe *q, QbeNodeKind kind, QbeType type) {
     size_t size = sizes[kind];
 
     QbeNode *node = arena_alloc(&q->arena, size);
+    assert(node && "Out of memory");
     memset(node, 0, size);
     node->kind = kind;
     node->type = type;
@@ -366,6 +384,30 @@ static QbeNode *qbe_node_build(Qbe *q, QbeFn *fn, QbeNodeKind kind, QbeType type
     return node;
 }
 
+// Unnamed globals are numbered on creation, so their names stay the same no matter when and how many
+// times the program is lowered
+static void qbe_global_name(Qbe *q, QbeNode *node, QbeSV name) {
+    node->ssa = QBE_SSA_GLOBAL;
+    node->sv = name;
+    if (!name.data) {
+        node->iota = q->globals++;
+    }
+}
+
+static void qbe_sb_reserve(Qbe *q, QbeSB *sb, size_t n) {
+    if (sb->count + n > sb->capacity) {
+        if (sb->capacity == 0) {
+            sb->capacity = 128;
+        }
+
+        while (sb->count + n > sb->capacity) {
+            sb->capacity *= 2;
+        }
+
+        sb->data = qbe_memrealloc(&q->memory, sb->data, sb->capacity * sizeof(*sb->data));
+    }
+}
+
 __attribute__((format(printf, 2, 3))) static void qbe_sb_fmt(Qbe *q, const char *fmt, ...) {
     va_list args;
     va_start(args, fmt);
@@ -373,19 +415,7 @@ __attribute__((format(printf, 2, 3))) static void qbe_sb_fmt(Qbe *q, const char
     va_end(args);
 
     assert(n >= 0);
-
-    if (q->sb.count + n + 1 > q->sb.capacity) {
-        if (q->sb.capacity == 0) {
-            q->sb.capacity = 128;
-        }
-
-        while (q->sb.count + n + 1 > q->sb.capacity) {
-            q->sb.capacity *= 2;
-        }
-
-        q->sb.data = realloc(q->sb.data, q->sb.capacity * sizeof(*q->sb.data));
-        assert(q->sb.data);
-    }
+    qbe_sb_reserve(q, &q->sb, n + 1);
 
     va_start(args, fmt);
     vsnprintf(q->sb.data + q->sb.count, n + 1, fmt, args);
@@ -524,11 +554,16 @@ static inline void qbe_sb_quote_sv(Qbe *q, QbeSV sv) {
     qbe_sb_fmt(q, "\"");
 }
 
+static inline bool qbe_node_compiled(Qbe *q, QbeNode *n) {
+    return n->kind == QBE_NODE_ATOM || n->epoch == q->epoch;
+}
+
 static_assert(QBE_COUNT_NODES == 18, "");
 static void qbe_compile_node(Qbe *q, QbeNode *n) {
-    if (!n || n->ssa) {
+    if (!n || qbe_node_compiled(q, n)) {
         return;
     }
+    n->epoch = q->epoch;
 
     switch (n->kind) {
     case QBE_NODE_ATOM:
@@ -749,11 +784,13 @@ static void qbe_compile_node(Qbe *q, QbeNode *n) {
 
     case QBE_NODE_PHI: {
         QbePhi *phi = (QbePhi *) n;
-        qbe_compile_node(q, phi->a.value);
-        qbe_compile_node(q, phi->b.value);
+        for (size_t i = 0; i < phi->count; i++) {
+            qbe_compile_node(q, phi->branches[i].value);
+        }
 
-        size_t a_block = qbe_block_iota(q, phi->a.block);
-        size_t b_block = qbe_block_iota(q, phi->b.block);
+        for (size_t i = 0; i < phi->count; i++) {
+            qbe_block_iota(q, phi->branches[i].block);
+        }
 
         n->ssa = QBE_SSA_LOCAL;
         n->iota = q->locals++;
@@ -768,10 +805,11 @@ static void qbe_compile_node(Qbe *q, QbeNode *n) {
             qbe_sb_type_ssa(q, n->type);
         }
 
-        qbe_sb_fmt(q, " phi @.%zu ", a_block);
-        qbe_sb_node_ssa(q, phi->a.value);
-        qbe_sb_fmt(q, ", @.%zu ", b_block);
-        qbe_sb_node_ssa(q, phi->b.value);
+        qbe_sb_fmt(q, " phi");
+        for (size_t i = 0; i < phi->count; i++) {
+            qbe_sb_fmt(q, "%s @.%zu ", i ? "," : "", qbe_block_iota(q, phi->branches[i].block));
+            qbe_sb_node_ssa(q, phi->branches[i].value);
+        }
         qbe_sb_fmt(q, "\n");
     } break;
 
@@ -1160,10 +1198,10 @@ static bool qbe_struct_cache_lookup(QbeStructCache *cache, QbeStruct *st) {
     return false;
 }
 
-static void qbe_struct_cache_insert(QbeStructCache *cache, QbeStruct *st) {
+static void qbe_struct_cache_insert(Qbe *q, QbeStructCache *cache, QbeStruct *st) {
     if (!cache->capacity || (double) (cache->count + 1) / cache->capacity > 0.8) {
         size_t           new_capacity = cache->capacity ? cache->capacity * 2 : 128;
-        QbeStructHashed *new_data = calloc(new_capacity, sizeof(QbeStructHashed));
+        QbeStructHashed *new_data = qbe_memalloc(&q->memory, new_capacity * sizeof(QbeStructHashed));
 
         for (size_t i = 0; i < cache->capacity; i++) {
             if (!cache->data[i].st) {
@@ -1178,7 +1216,7 @@ static void qbe_struct_cache_insert(QbeStructCache *cache, QbeStruct *st) {
             new_data[index] = cache->data[i];
         }
 
-        free(cache->data);
+        qbe_memfree(cache->data);
         cache->data = new_data;
         cache->capacity = new_capacity;
     }
@@ -1189,6 +1227,12 @@ static void qbe_struct_cache_insert(QbeStructCache *cache, QbeStruct *st) {
         index = (index + 1) & (cache->capacity - 1);
     }
 
+    if (cache->iota >= cache->order_capacity) {
+        cache->order_capacity = cache->order_capacity ? cache->order_capacity * 2 : 128;
+        cache->order = qbe_memrealloc(&q->memory, cache->order, cache->order_capacity * sizeof(*cache->order));
+    }
+    cache->order[cache->iota] = st;
+
     st->node.iota = cache->iota++;
     cache->data[index].st = st;
     cache->data[index].hash = hash;
@@ -1230,10 +1274,10 @@ static bool qbe_array_cache_lookup(QbeArrayCache *cache, QbeArrayKey key, QbeTyp
     return false;
 }
 
-static void qbe_array_cache_insert(QbeArrayCache *cache, QbeArrayKey key, QbeType type) {
+static void qbe_array_cache_insert(Qbe *q, QbeArrayCache *cache, QbeArrayKey key, QbeType type) {
     if (!cache->capacity || (double) (cache->count + 1) / cache->capacity > 0.8) {
         size_t         new_capacity = cache->capacity ? cache->capacity * 2 : 128;
-        QbeArrayEntry *new_entries = calloc(new_capacity, sizeof(QbeArrayEntry));
+        QbeArrayEntry *new_entries = qbe_memalloc(&q->memory, new_capacity * sizeof(QbeArrayEntry));
 
         for (size_t i = 0; i < cache->capacity; ++i) {
             QbeArrayEntry *old = &cache->data[i];
@@ -1250,7 +1294,7 @@ static void qbe_array_cache_insert(QbeArrayCache *cache, QbeArrayKey key, QbeTyp
             new_entries[index] = *old;
         }
 
-        free(cache->data);
+        qbe_memfree(cache->data);
         cache->data = new_entries;
         cache->capacity = new_capacity;
     }
@@ -1332,7 +1376,7 @@ QbeType qbe_type_array(Qbe *q, QbeType element_type, size_t count) {
     element->repeat = count;
 
     const QbeType array_type = qbe_type_struct(st);
-    qbe_array_cache_insert(&q->array_cache, key, array_type);
+    qbe_array_cache_insert(q, &q->array_cache, key, array_type);
     return array_type;
 }
 
@@ -1380,7 +1424,7 @@ QbeFn *qbe_fn_new(Qbe *q, QbeSV name, QbeType return_type) {
     }
 
     QbeFn *fn = (QbeFn *) qbe_node_alloc(q, QBE_NODE_FN, qbe_type_basic(QBE_TYPE_I64));
-    fn->node.sv = name;
+    qbe_global_name(q, (QbeNode *) fn, name);
     fn->return_type = return_type;
     qbe_build_block(q, fn, qbe_block_new(q));
 
@@ -1390,7 +1434,7 @@ QbeFn *qbe_fn_new(Qbe *q, QbeSV name, QbeType return_type) {
 
 QbeNode *qbe_str_new(Qbe *q, QbeSV sv) {
     QbeVar *var = (QbeVar *) qbe_node_alloc(q, QBE_NODE_VAR, qbe_type_basic(QBE_TYPE_I64));
-    var->node.ssa = QBE_SSA_GLOBAL;
+    qbe_global_name(q, (QbeNode *) var, (QbeSV) {0});
     var->str = sv;
     var->type = qbe_type_basic(QBE_TYPE_I64);
     qbe_nodes_push(&q->vars, (QbeNode *) var);
@@ -1410,7 +1454,7 @@ QbeStruct *qbe_struct_new(Qbe *q, bool packed) {
 
 QbeVar *qbe_var_new(Qbe *q, QbeSV name, QbeType type) {
     QbeVar *var = (QbeVar *) qbe_node_alloc(q, QBE_NODE_VAR, qbe_type_basic(QBE_TYPE_I64));
-    var->node.sv = name;
+    qbe_global_name(q, (QbeNode *) var, name);
     var->type = type;
     qbe_nodes_push(&q->vars, (QbeNode *) var);
     return var;
@@ -1497,9 +1541,19 @@ QbeField *qbe_struct_add_field(Qbe *q, QbeStruct *st, QbeType field_type) {
 }
 
 QbeNode *qbe_build_phi(Qbe *q, QbeFn *fn, QbePhiBranch a, QbePhiBranch b) {
-    QbePhi *phi = (QbePhi *) qbe_node_build(q, fn, QBE_NODE_PHI, a.value->type);
-    phi->a = a;
-    phi->b = b;
+    return qbe_build_phi_n(q, fn, a.value->type, (QbePhiBranch[]) {a, b}, 2);
+}
+
+QbeNode *qbe_build_phi_n(Qbe *q, QbeFn *fn, QbeType type, const QbePhiBranch *branches, size_t count) {
+    assert(count && "A phi needs at least one branch");
+
+    QbePhiBranch *copy = arena_alloc(&q->arena, count * sizeof(*copy));
+    assert(copy && "Out of memory");
+    memcpy(copy, branches, count * sizeof(*copy));
+
+    QbePhi *phi = (QbePhi *) qbe_node_build(q, fn, QBE_NODE_PHI, type);
+    phi->branches = copy;
+    phi->count = count;
     return (QbeNode *) phi;
 }
 
@@ -1613,18 +1667,64 @@ void qbe_build_debug_line(Qbe *q, QbeFn *fn, size_t line) {
 }
 
 Qbe *qbe_new(void) {
-    return calloc(1, sizeof(Qbe));
+    // The handle itself is not charged, so that the usage of a fresh one is zero
+    Qbe *q = qbe_memalloc(NULL, sizeof(Qbe));
+    q->arena.context = &q->memory;
+    return q;
 }
 
 void qbe_free(Qbe *q) {
     arena_free(&q->arena);
-    free(q->sb.data);
-    free(q->array_cache.data);
-    free(q->struct_cache.data);
-    free(q);
+    qbe_memfree(q->sb.data);
+    qbe_memfree(q->bin.data);
+    qbe_memfree(q->array_cache.data);
+    qbe_memfree(q->struct_cache.data);
+    qbe_memfree(q->struct_cache.order);
+    qbe_ctxfree(q->ctx);
+    qbe_memfree(q);
+}
+
+void qbe_reset(Qbe *q) {
+    arena_reset(&q->arena);
+
+    q->fns = (QbeNodes) {0};
+    q->vars = (QbeNodes) {0};
+    q->structs = (QbeNodes) {0};
+
+    q->blocks = 0;
+    q->locals = 0;
+    q->globals = 0;
+    q->typs = 0;
+    q->epoch++; // Keep the epochs of the discarded nodes from ever matching again
+
+    if (q->array_cache.data) {
+        memset(q->array_cache.data, 0, q->array_cache.capacity * sizeof(*q->array_cache.data));
+    }
+    q->array_cache.count = 0;
+
+    if (q->struct_cache.data) {
+        memset(q->struct_cache.data, 0, q->struct_cache.capacity * sizeof(*q->struct_cache.data));
+    }
+    q->struct_cache.count = 0;
+    q->struct_cache.iota = 0;
+
+    q->compiled = false;
+    q->sb.count = 0;
+    q->bin.count = 0;
 }
 
-static void qbe_compile_struct(Qbe *q, QbeStruct *st) {
+void qbe_set_allocator(QbeAllocFn alloc, QbeReallocFn realloc, QbeFreeFn free, void *user) {
+    assert(!alloc == !realloc && !alloc == !free && "The allocator must be given in full");
+    qbe_memhooks(alloc, realloc, free, user);
+}
+
+size_t qbe_get_memory_usage(Qbe *q) {
+    return __atomic_load_n(&q->memory, __ATOMIC_RELAXED);
+}
+
+// Deduplicates the struct against the ones seen so far. Canonical structs are numbered in definition
+// order, with nested structs always coming before the structs that contain them.
+static void qbe_canonicalize_struct(Qbe *q, QbeStruct *st) {
     if (!st->info_ready || st->compiled) {
         return;
     }
@@ -1637,12 +1737,21 @@ static void qbe_compile_struct(Qbe *q, QbeStruct *st) {
     if (!st->packed) {
         for (QbeNode *it = st->fields.head; it; it = it->next) {
             if (it->type.kind == QBE_TYPE_STRUCT) {
-                qbe_compile_struct(q, it->type.spec);
+                qbe_canonicalize_struct(q, it->type.spec);
             }
         }
     }
 
-    qbe_struct_cache_insert(&q->struct_cache, st);
+    qbe_struct_cache_insert(q, &q->struct_cache, st);
+}
+
+static void qbe_canonicalize_structs(Qbe *q) {
+    for (QbeNode *it = q->structs.head; it; it = it->next) {
+        qbe_canonicalize_struct(q, (QbeStruct *) it);
+    }
+}
+
+static void qbe_compile_struct(Qbe *q, QbeStruct *st) {
     qbe_sb_fmt(q, "type :.%zu = align %zu { ", st->node.iota, st->info.align);
     if (st->packed) {
         qbe_sb_fmt(q, "%zu", st->info.size);
@@ -1666,31 +1775,14 @@ static void qbe_compile_struct(Qbe *q, QbeStruct *st) {
 void qbe_compile(Qbe *q) {
     assert(!q->compiled && "This QBE context is already compiled");
     q->compiled = true;
+    q->epoch++;
 
-    {
-        size_t iota = 0;
-
-        for (QbeNode *it = q->fns.head; it; it = it->next) {
-            it->ssa = QBE_SSA_GLOBAL;
-            if (!it->sv.data) {
-                it->iota = iota++;
-            }
-        }
-
-        for (QbeNode *it = q->vars.head; it; it = it->next) {
-            it->ssa = QBE_SSA_GLOBAL;
-            if (!it->sv.data) {
-                it->iota = iota++;
-            }
-        }
-    }
-
-    for (QbeNode *it = q->structs.head; it; it = it->next) {
-        qbe_compile_struct(q, (QbeStruct *) it);
+    qbe_canonicalize_structs(q);
+    for (size_t i = 0; i < q->struct_cache.iota; i++) {
+        qbe_compile_struct(q, q->struct_cache.order[i]);
     }
 
     for (QbeNode *it = q->vars.head; it; it = it->next) {
-        it->ssa = QBE_SSA_NIL;
         QbeVar *var = (QbeVar *) it;
 
         if (it->sv.data) {
@@ -1698,7 +1790,6 @@ void qbe_compile(Qbe *q) {
         }
 
         qbe_sb_fmt(q, "data ");
-        qbe_compile_node(q, it);
         qbe_sb_node_ssa(q, it);
 
         if (var->str.data) {
@@ -1781,7 +1872,6 @@ void qbe_compile(Qbe *q) {
     }
 
     for (QbeNode *it = q->fns.head; it; it = it->next) {
-        it->ssa = QBE_SSA_NIL;
         QbeFn *fn = (QbeFn *) it;
 
         if (fn->debug_file.data) {
@@ -1801,7 +1891,6 @@ void qbe_compile(Qbe *q) {
             qbe_sb_fmt(q, " ");
         }
 
-        qbe_compile_node(q, it);
         qbe_sb_node_ssa(q, it);
         qbe_sb_fmt(q, "(");
 
@@ -1847,6 +1936,1252 @@ void qbe_compile(Qbe *q) {
     }
 }
 
+// Direct lowering
+//
+// Walks the builder graph and constructs the backend records straight away, producing exactly what
+// qbe_parse() would build from the output of qbe_compile(), without the print-then-parse round trip.
+// Temporaries, blocks, constants and types are numbered in the same order as in the textual IL.
+typedef enum {
+    QBE_LOWER_LABEL,
+    QBE_LOWER_PHI,
+    QBE_LOWER_INS,
+} QbeLowerState;
+
+typedef struct {
+    Qbe *q;
+    Fn  *fn;
+
+    Blk  *curb;
+    Blk **blink;
+    Phi **plink;
+    Blk  **blocks; // Indexed by block iota
+    size_t nblocks;
+    uint   nblk;
+    int    ret; // Jump used by return statements
+
+    QbeLowerState state;
+    QbeSB         str;
+} QbeLower;
+
+static_assert(QBE_COUNT_TYPES == 8, "");
+static int qbe_lower_cls(QbeType type) {
+    switch (type.kind) {
+    case QBE_TYPE_I8:
+    case QBE_TYPE_I16:
+    case QBE_TYPE_I32:
+        return Kw;
+
+    case QBE_TYPE_I64:
+        return Kl;
+
+    case QBE_TYPE_F32:
+        return Ks;
+
+    case QBE_TYPE_F64:
+        return Kd;
+
+    default:
+        assert(false && "unreachable");
+    }
+}
+
+static void qbe_lower_name(char name[NString], QbeNode *n) {
+    assert(n->ssa == QBE_SSA_GLOBAL || n->ssa == QBE_SSA_EXTERN);
+
+    if (!n->sv.data) {
+        snprintf(name, NString, ".%zu", n->iota);
+        return;
+    }
+
+    const size_t prefix = n->ssa == QBE_SSA_EXTERN;
+    if (n->sv.count + prefix >= NString - 1) {
+        qbe_err("identifier too long");
+    }
+
+    name[0] = '$';
+    memcpy(name + prefix, n->sv.data, n->sv.count);
+    name[prefix + n->sv.count] = '\0';
+}
+
+static char *qbe_lower_quote(QbeLower *l, QbeSV sv) {
+    // Worst case is "\xffffffff" for every byte
+    const size_t size = sv.count * 10 + 3;
+    if (l->str.capacity < size) {
+        l->str.capacity = size;
+        l->str.data = qbe_memrealloc(&l->q->memory, l->str.data, l->str.capacity);
+    }
+
+    char *p = l->str.data;
+    *p++ = '"';
+    for (size_t i = 0; i < sv.count; i++) {
+        const char it = sv.data[i];
+        if (it == '"') {
+            *p++ = '\\';
+            *p++ = '"';
+        } else if (isprint(it)) {
+            *p++ = it;
+        } else {
+            p += sprintf(p, "\\x%x", it);
+        }
+    }
+    *p++ = '"';
+    *p = '\0';
+    return l->str.data;
+}
+
+static Ref qbe_lower_int(QbeLower *l, int64_t n) {
+    Con c = {.type = CBits, .bits.i = n};
+    return qbe_newcon(&c, l->fn);
+}
+
+static Ref qbe_lower_ref(QbeLower *l, QbeNode *n) {
+    char name[NString];
+    Con  c = {0};
+
+    switch (n->ssa) {
+    case QBE_SSA_INT:
+        c.type = CBits;
+        c.bits.i = (int64_t) n->iota;
+        break;
+
+    case QBE_SSA_FLOAT:
+        c.type = CBits;
+        if (n->type.kind == QBE_TYPE_F32) {
+            c.bits.s = n->real;
+            c.flt = 1;
+        } else {
+            c.bits.d = n->real;
+            c.flt = 2;
+        }
+        break;
+
+    case QBE_SSA_LOCAL:
+        assert(!n->sv.data);
+        return TMP(Tmp0 + n->iota);
+
+    case QBE_SSA_GLOBAL:
+    case QBE_SSA_EXTERN:
+        qbe_lower_name(name, n);
+        c.type = CAddr;
+        c.sym.id = qbe_intern(name);
+        break;
+
+    default:
+        assert(false && "unreachable");
+    }
+
+    return qbe_newcon(&c, l->fn);
+}
+
+static Ref qbe_lower_local(QbeLower *l, QbeNode *n) {
+    n->ssa = QBE_SSA_LOCAL;
+    n->iota = l->q->locals++;
+
+    const Ref r = qbe_newtmp(NULL, Kx, l->fn);
+    assert(r.val == Tmp0 + n->iota);
+    qbe_strf(l->fn->tmp[r.val].name, ".%zu", n->iota);
+    return r;
+}
+
+static Blk *qbe_lower_blk(QbeLower *l, QbeBlock *block) {
+    const size_t id = qbe_block_iota(l->q, block);
+    if (id >= l->nblocks) {
+        qbe_vgrow(&l->blocks, id + 1);
+        memset(&l->blocks[l->nblocks], 0, (id + 1 - l->nblocks) * sizeof(*l->blocks));
+        l->nblocks = id + 1;
+    }
+
+    Blk *b = l->blocks[id];
+    if (!b) {
+        b = qbe_newblk();
+        b->id = l->nblk++;
+        qbe_strf(b->name, ".%zu", id);
+        l->blocks[id] = b;
+    }
+
+    return b;
+}
+
+static void qbe_lower_ins(QbeLower *l, int op, int k, Ref to, Ref arg0, Ref arg1) {
+    if (l->state == QBE_LOWER_LABEL) {
+        qbe_err("label or } expected");
+    }
+
+    qbe_insfit(1);
+    *qbe_curi++ = (Ins) {.op = op, .cls = k, .to = to, .arg = {arg0, arg1}};
+    l->state = QBE_LOWER_INS;
+}
+
+static void qbe_lower_close(QbeLower *l) {
+    l->curb->nins = qbe_curi - qbe_insb;
+    qbe_idup(&l->curb->ins, qbe_insb, l->curb->nins);
+    l->blink = &l->curb->link;
+    l->state = QBE_LOWER_LABEL;
+    qbe_curi = qbe_insb;
+}
+
+static void qbe_lower_label(QbeLower *l, QbeBlock *block) {
+    Blk *b = qbe_lower_blk(l, block);
+    if (l->curb && l->curb->jmp.type == Jxxx) {
+        qbe_lower_close(l);
+        l->curb->jmp.type = Jjmp;
+        l->curb->s1 = b;
+    }
+
+    if (b->jmp.type != Jxxx) {
+        qbe_err("multiple definitions of block @%s", b->name);
+    }
+
+    *l->blink = b;
+    l->curb = b;
+    l->plink = &b->phi;
+    l->state = QBE_LOWER_PHI;
+}
+
+static void qbe_lower_jump(QbeLower *l, int type, Ref arg, QbeBlock *s1, QbeBlock *s2) {
+    if (l->state == QBE_LOWER_LABEL) {
+        qbe_err("label or } expected");
+    }
+
+    Blk *b = l->curb;
+    b->jmp.type = type;
+    b->jmp.arg = arg;
+    if (s1) {
+        b->s1 = qbe_lower_blk(l, s1);
+    }
+
+    if (s2) {
+        b->s2 = qbe_lower_blk(l, s2);
+    }
+
+    if (b->s1 == l->fn->start || b->s2 == l->fn->start) {
+        qbe_err("invalid jump to the start block");
+    }
+
+    qbe_lower_close(l);
+}
+
+static Ref qbe_lower_offset(QbeLower *l, QbeStore *store, size_t i, size_t stored, Ref ptr) {
+    const Ref to = qbe_lower_local(l, (QbeNode *) store);
+    const Ref base = i == 1 ? qbe_lower_ref(l, store->dst) : ptr;
+    qbe_lower_ins(l, Oadd, qbe_lower_cls(store->dst->type), to, base, qbe_lower_int(l, stored));
+    return to;
+}
+
+static_assert(QBE_COUNT_NODES == 18, "");
+static void qbe_lower_node(QbeLower *l, QbeNode *n) {
+    Qbe *q = l->q;
+    if (!n || qbe_node_compiled(q, n)) {
+        return;
+    }
+    n->epoch = q->epoch;
+
+    switch (n->kind) {
+    case QBE_NODE_ATOM:
+        assert(false && "unreachable");
+        break;
+
+    case QBE_NODE_UNARY: {
+        QbeUnary *unary = (QbeUnary *) n;
+        qbe_lower_node(l, unary->operand);
+
+        const int k = qbe_lower_cls(n->type);
+        const Ref to = qbe_lower_local(l, n);
+        const Ref arg = qbe_lower_ref(l, unary->operand);
+
+        static_assert(QBE_COUNT_UNARYS == 4, "");
+        switch (unary->op) {
+        case QBE_UNARY_NOP:
+            assert(false && "NOP");
+            break;
+
+        case QBE_UNARY_NEG:
+            qbe_lower_ins(l, Oneg, k, to, arg, R);
+            break;
+
+        case QBE_UNARY_BNOT:
+            qbe_lower_ins(l, Oxor, k, to, arg, qbe_lower_int(l, -1));
+            break;
+
+        case QBE_UNARY_LNOT:
+            qbe_lower_ins(l, Oceqw, k, to, arg, qbe_lower_int(l, 0));
+            break;
+
+        default:
+            assert(false && "unreachable");
+        }
+    } break;
+
+    case QBE_NODE_BINARY: {
+        QbeBinary *binary = (QbeBinary *) n;
+        qbe_lower_node(l, binary->lhs);
+        qbe_lower_node(l, binary->rhs);
+
+        const int k = qbe_lower_cls(n->type);
+        const Ref to = qbe_lower_local(l, n);
+
+        static_assert(QBE_COUNT_BINARYS == 24, "");
+        static const int ops[QBE_COUNT_BINARYS] = {
+            [QBE_BINARY_ADD] = Oadd,
+            [QBE_BINARY_SUB] = Osub,
+            [QBE_BINARY_MUL] = Omul,
+            [QBE_BINARY_SDIV] = Odiv,
+            [QBE_BINARY_UDIV] = Oudiv,
+            [QBE_BINARY_SMOD] = Orem,
+            [QBE_BINARY_UMOD] = Ourem,
+
+            [QBE_BINARY_OR] = Oor,
+            [QBE_BINARY_AND] = Oand,
+            [QBE_BINARY_XOR] = Oxor,
+            [QBE_BINARY_SHL] = Oshl,
+            [QBE_BINARY_SSHR] = Osar,
+            [QBE_BINARY_USHR] = Oshr,
+        };
+
+        static const int icmps[QBE_COUNT_BINARYS][2] = {
+            [QBE_BINARY_SGT] = {Cisgt, Cfgt},
+            [QBE_BINARY_UGT] = {Ciugt, Cfgt},
+            [QBE_BINARY_SGE] = {Cisge, Cfge},
+            [QBE_BINARY_UGE] = {Ciuge, Cfge},
+            [QBE_BINARY_SLT] = {Cislt, Cflt},
+            [QBE_BINARY_ULT] = {Ciult, Cflt},
+            [QBE_BINARY_SLE] = {Cisle, Cfle},
+            [QBE_BINARY_ULE] = {Ciule, Cfle},
+            [QBE_BINARY_EQ] = {Cieq, Cfeq},
+            [QBE_BINARY_NE] = {Cine, Cfne},
+        };
+
+        int op = 0;
+        if (binary->op == QBE_BINARY_NOP) {
+            assert(false && "NOP");
+        } else if (binary->op < QBE_BINARY_SGT) {
+            op = ops[binary->op];
+        } else {
+            static const int cmps[] = {[Kw] = Ocmpw, [Kl] = Ocmpl, [Ks] = Ocmps, [Kd] = Ocmpd};
+
+            const int lk = qbe_lower_cls(binary->lhs->type);
+            op = cmps[lk] + icmps[binary->op][KBASE(lk)];
+        }
+
+        const Ref lhs = qbe_lower_ref(l, binary->lhs);
+        const Ref rhs = qbe_lower_ref(l, binary->rhs);
+        qbe_lower_ins(l, op, k, to, lhs, rhs);
+    } break;
+
+    case QBE_NODE_ARG:
+        assert(false && "unreachable");
+        break;
+
+    case QBE_NODE_PHI: {
+        QbePhi *phi = (QbePhi *) n;
+        for (size_t i = 0; i < phi->count; i++) {
+            qbe_lower_node(l, phi->branches[i].value);
+        }
+
+        for (size_t i = 0; i < phi->count; i++) {
+            qbe_block_iota(q, phi->branches[i].block);
+        }
+
+        const int k = n->type.kind == QBE_TYPE_STRUCT ? Kl : qbe_lower_cls(n->type);
+        const Ref to = qbe_lower_local(l, n);
+
+        if (l->state != QBE_LOWER_PHI || l->curb == l->fn->start) {
+            qbe_err("unexpected phi instruction");
+        }
+
+        Phi *p = qbe_alloc(sizeof(*p));
+        p->to = to;
+        p->cls = k;
+        p->narg = phi->count;
+        p->arg = qbe_vnew(p->narg, sizeof(*p->arg), PFn);
+        p->blk = qbe_vnew(p->narg, sizeof(*p->blk), PFn);
+        for (size_t i = 0; i < phi->count; i++) {
+            p->blk[i] = qbe_lower_blk(l, phi->branches[i].block);
+            p->arg[i] = qbe_lower_ref(l, phi->branches[i].value);
+        }
+
+        *l->plink = p;
+        l->plink = &p->link;
+    } break;
+
+    case QBE_NODE_CALL: {
+        QbeCall *call = (QbeCall *) n;
+        qbe_lower_node(l, call->fn);
+        for (QbeArg *it = (QbeArg *) call->args.head; it; it = (QbeArg *) it->node.next) {
+            if (!it->start_variadic) {
+                qbe_lower_node(l, it->value);
+            }
+        }
+
+        int k = Kw;
+        Ref to = R;
+        Ref ty = R;
+        if (n->type.kind != QBE_TYPE_I0) {
+            to = qbe_lower_local(l, n);
+            if (n->type.kind == QBE_TYPE_STRUCT) {
+                k = Kl;
+                ty = TYPE(n->type.spec->node.iota);
+            } else {
+                k = qbe_lower_cls(n->type);
+            }
+        } else {
+            n->ssa = QBE_SSA_LOCAL;
+        }
+
+        const Ref callee = qbe_lower_ref(l, call->fn);
+        for (QbeArg *it = (QbeArg *) call->args.head; it; it = (QbeArg *) it->node.next) {
+            if (it->start_variadic) {
+                if (it->node.next) {
+                    qbe_lower_ins(l, Oargv, Kw, R, R, R);
+                }
+            } else if (it->value->type.kind == QBE_TYPE_STRUCT) {
+                const Ref arg_ty = TYPE(it->value->type.spec->node.iota);
+                qbe_lower_ins(l, Oargc, Kl, R, arg_ty, qbe_lower_ref(l, it->value));
+            } else {
+                qbe_lower_ins(l, Oarg, qbe_lower_cls(it->value->type), R, qbe_lower_ref(l, it->value), R);
+            }
+        }
+
+        qbe_lower_ins(l, Ocall, k, to, callee, ty);
+    } break;
+
+    case QBE_NODE_CAST: {
+        QbeCast *cast = (QbeCast *) n;
+        qbe_lower_node(l, cast->value);
+
+        const int k = qbe_lower_cls(n->type);
+        const Ref to = qbe_lower_local(l, n);
+
+        int op = 0;
+        if (qbe_type_kind_is_float(cast->value->type.kind)) {
+            if (n->type.kind == QBE_TYPE_F32) {
+                op = Otruncd;
+            } else if (n->type.kind == QBE_TYPE_F64) {
+                op = Oexts;
+            } else if (cast->value->type.kind == QBE_TYPE_F32) {
+                op = cast->is_signed ? Ostosi : Ostoui;
+            } else {
+                op = cast->is_signed ? Odtosi : Odtoui;
+            }
+        } else if (qbe_type_kind_is_float(n->type.kind)) {
+            if (qbe_lower_cls(cast->value->type) == Kw) {
+                op = cast->is_signed ? Oswtof : Ouwtof;
+            } else {
+                op = cast->is_signed ? Osltof : Oultof;
+            }
+        } else {
+            static const int exts[QBE_COUNT_TYPES] = {
+                [QBE_TYPE_I8] = Oextsb,
+                [QBE_TYPE_I16] = Oextsh,
+                [QBE_TYPE_I32] = Oextsw,
+            };
+
+            op = exts[cast->value->type.kind];
+            assert(op && "Invalid integer extension");
+            if (!cast->is_signed) {
+                op++; // Oext{u}{b,h,w} directly follow their signed versions
+            }
+        }
+
+        qbe_lower_ins(l, op, k, to, qbe_lower_ref(l, cast->value), R);
+    } break;
+
+    case QBE_NODE_LOAD: {
+        QbeLoad *load = (QbeLoad *) n;
+        qbe_lower_node(l, load->src);
+
+        if (n->type.kind == QBE_TYPE_STRUCT) {
+            n->ssa = load->src->ssa;
+            n->iota = load->src->iota;
+            n->sv = load->src->sv;
+            return;
+        }
+
+        const int k = qbe_lower_cls(n->type);
+        const Ref to = qbe_lower_local(l, n);
+
+        int op = Oload;
+        if (n->type.kind == QBE_TYPE_I8) {
+            op = load->is_signed ? Oloadsb : Oloadub;
+        } else if (n->type.kind == QBE_TYPE_I16) {
+            op = load->is_signed ? Oloadsh : Oloaduh;
+        } else if (n->type.kind == QBE_TYPE_I32) {
+            op = Oloadsw;
+        }
+
+        qbe_lower_ins(l, op, k, to, qbe_lower_ref(l, load->src), R);
+    } break;
+
+    case QBE_NODE_STORE: {
+        QbeStore *store = (QbeStore *) n;
+        qbe_lower_node(l, store->dst);
+        n->ssa = QBE_SSA_LOCAL;
+
+        if (store->data || !store->src) {
+            const size_t size = qbe_sizeof(n->type);
+            if (!store->data && size > 128) {
+                Con c = {.type = CAddr, .sym.id = qbe_intern("memset")};
+                const Ref callee = qbe_newcon(&c, l->fn);
+                const Ref dst = qbe_lower_ref(l, store->dst);
+                qbe_lower_ins(l, Oarg, qbe_lower_cls(store->dst->type), R, dst, R);
+                qbe_lower_ins(l, Oarg, Kw, R, qbe_lower_int(l, 0), R);
+                qbe_lower_ins(l, Oarg, Kl, R, qbe_lower_int(l, size), R);
+                qbe_lower_ins(l, Ocall, Kw, R, callee, R);
+                return;
+            }
+
+            size_t stored = 0;
+            size_t remaining = size;
+
+            Ref           ptr = R;
+            const int8_t *data = store->data;
+            for (size_t i = 0; remaining; i++) {
+                if (i) {
+                    ptr = qbe_lower_offset(l, store, i, stored, ptr);
+                }
+
+                int64_t value = 0;
+                int     op = 0;
+                if (remaining >= 8) {
+                    if (data) {
+                        int64_t v;
+                        memcpy(&v, data, sizeof(v));
+                        value = v;
+                    }
+                    op = Ostorel;
+                    stored = 8;
+                } else if (remaining >= 4) {
+                    if (data) {
+                        int32_t v;
+                        memcpy(&v, data, sizeof(v));
+                        value = v;
+                    }
+                    op = Ostorew;
+                    stored = 4;
+                } else if (remaining >= 2) {
+                    if (data) {
+                        int16_t v;
+                        memcpy(&v, data, sizeof(v));
+                        value = v;
+                    }
+                    op = Ostoreh;
+                    stored = 2;
+                } else {
+                    if (data) {
+                        value = *data;
+                    }
+                    op = Ostoreb;
+                    stored = 1;
+                }
+
+                if (data) {
+                    data += stored;
+                }
+                remaining -= stored;
+
+                const Ref v = qbe_lower_int(l, value);
+                qbe_lower_ins(l, op, Kw, R, v, i ? ptr : qbe_lower_ref(l, store->dst));
+            }
+
+            return;
+        }
+
+        qbe_lower_node(l, store->src);
+        if (store->src->type.kind == QBE_TYPE_STRUCT) {
+            const Ref src = qbe_lower_ref(l, store->src);
+            const Ref dst = qbe_lower_ref(l, store->dst);
+            const Ref size = qbe_lower_int(l, qbe_type_info(store->src->type).size);
+
+            qbe_lower_ins(l, Oblit0, Kw, R, src, dst);
+            qbe_lower_ins(l, Oblit1, Kw, R, INT(l->fn->con[size.val].bits.i), R);
+            return;
+        }
+
+        static const int ops[QBE_COUNT_TYPES] = {
+            [QBE_TYPE_I8] = Ostoreb,
+            [QBE_TYPE_I16] = Ostoreh,
+            [QBE_TYPE_I32] = Ostorew,
+            [QBE_TYPE_I64] = Ostorel,
+            [QBE_TYPE_F32] = Ostores,
+            [QBE_TYPE_F64] = Ostored,
+        };
+
+        const Ref src = qbe_lower_ref(l, store->src);
+        const Ref dst = qbe_lower_ref(l, store->dst);
+        qbe_lower_ins(l, ops[store->src->type.kind], Kw, R, src, dst);
+    } break;
+
+    case QBE_NODE_JUMP: {
+        QbeJump *jump = (QbeJump *) n;
+        qbe_lower_jump(l, Jjmp, R, jump->block, NULL);
+    } break;
+
+    case QBE_NODE_BRANCH: {
+        QbeBranch *branch = (QbeBranch *) n;
+        qbe_lower_node(l, branch->cond);
+
+        qbe_block_iota(q, branch->then_block);
+        qbe_block_iota(q, branch->else_block);
+        qbe_lower_jump(l, Jjnz, qbe_lower_ref(l, branch->cond), branch->then_block, branch->else_block);
+    } break;
+
+    case QBE_NODE_RETURN: {
+        QbeReturn *ret = (QbeReturn *) n;
+        if (ret->value) {
+            qbe_lower_node(l, ret->value);
+            if (l->ret == Jret0) {
+                qbe_err("invalid return value");
+            }
+            qbe_lower_jump(l, l->ret, qbe_lower_ref(l, ret->value), NULL, NULL);
+        } else {
+            qbe_lower_jump(l, Jret0, R, NULL, NULL);
+        }
+    } break;
+
+    case QBE_NODE_FN:
+        n->ssa = QBE_SSA_GLOBAL;
+        break;
+
+    case QBE_NODE_VAR: {
+        QbeVar *var = (QbeVar *) n;
+        n->ssa = var->local ? QBE_SSA_LOCAL : QBE_SSA_GLOBAL;
+    } break;
+
+    case QBE_NODE_BLOCK:
+        qbe_lower_label(l, (QbeBlock *) n);
+        break;
+
+    case QBE_NODE_FIELD:
+        assert(false && "unreachable");
+        break;
+
+    case QBE_NODE_STRUCT:
+        assert(false && "unreachable");
+        break;
+
+    case QBE_NODE_DEBUG: {
+        QbeDebug *debug = (QbeDebug *) n;
+        const Ref line = INT(debug->line);
+        if (line.val != debug->line) {
+            qbe_err("line number too big");
+        }
+        qbe_lower_ins(l, Odbgloc, Kw, R, line, INT(0));
+    } break;
+
+    default:
+        assert(false && "unreachable");
+    }
+}
+
+static_assert(QBE_COUNT_TYPES == 8, "");
+static void qbe_lower_struct(QbeStruct *st, Typ *ty) {
+    memset(ty, 0, sizeof(*ty));
+    snprintf(ty->name, sizeof(ty->name), ".%zu", st->node.iota);
+
+    int al = 0;
+    for (size_t align = st->info.align; align /= 2; al++) {
+    }
+    ty->align = al;
+
+    if (st->packed) {
+        ty->isdark = 1;
+        ty->size = st->info.size;
+        return;
+    }
+
+    // Same layout rules as parsefields() in parse.c
+    ty->fields = qbe_vnew(1, sizeof(ty->fields[0]), PHeap);
+    ty->nunion = 1;
+
+    Field   *fld = ty->fields[0];
+    uint64_t sz = 0;
+    int      n = 0;
+    for (QbeNode *it = st->fields.head; it; it = it->next) {
+        int      type = 0;
+        int      a = 0;
+        uint64_t s = 0;
+        switch (it->type.kind) {
+        case QBE_TYPE_I8:
+            type = Fb, s = 1, a = 0;
+            break;
+
+        case QBE_TYPE_I16:
+            type = Fh, s = 2, a = 1;
+            break;
+
+        case QBE_TYPE_I32:
+            type = Fw, s = 4, a = 2;
+            break;
+
+        case QBE_TYPE_I64:
+            type = Fl, s = 8, a = 3;
+            break;
+
+        case QBE_TYPE_F32:
+            type = Fs, s = 4, a = 2;
+            break;
+
+        case QBE_TYPE_F64:
+            type = Fd, s = 8, a = 3;
+            break;
+
+        case QBE_TYPE_STRUCT: {
+            Typ *ty1 = &qbe_typ[it->type.spec->node.iota];
+            type = FTyp;
+            s = ty1->size;
+            a = ty1->align;
+        } break;
+
+        default:
+            assert(false && "unreachable");
+        }
+
+        if (a > al) {
+            al = a;
+        }
+        a = (1 << a) - 1;
+        a = ((sz + a) & ~a) - sz;
+        if (a && n < NField) {
+            fld[n].type = FPad;
+            fld[n].len = a;
+            n++;
+        }
+
+        int c = ((QbeField *) it)->repeat;
+        sz += a + c * s;
+        if (type == FTyp) {
+            s = it->type.spec->node.iota;
+        }
+
+        for (; c > 0 && n < NField; c--, n++) {
+            fld[n].type = type;
+            fld[n].len = s;
+        }
+    }
+
+    fld[n].type = FEnd;
+    const int a = 1 << al;
+    ty->size = (sz + a - 1) & -a;
+    ty->align = al;
+}
+
+static void qbe_lower_var(QbeLower *l, QbeVar *var, void data(Dat *)) {
+    char name[NString];
+    char ref[NString];
+    qbe_lower_name(name, (QbeNode *) var);
+
+    Lnk lnk = {.export = var->node.sv.data != NULL};
+    Dat d = {.type = DStart, .name = name, .lnk = &lnk};
+
+    if (var->str.data) {
+        lnk.align = 1;
+        data(&d);
+
+        d.type = DB;
+        d.isstr = 1;
+        d.u.str = qbe_lower_quote(l, var->str);
+        data(&d);
+
+        d.isstr = 0;
+        d.u.num = 0;
+        data(&d);
+
+        d.type = DEnd;
+        data(&d);
+        return;
+    }
+
+    QbeTypeInfo info = qbe_type_info(var->type);
+    lnk.align = info.align;
+    data(&d);
+
+    if (!var->init_head) {
+        d.type = DZ;
+        d.u.num = info.size;
+        data(&d);
+
+        d.type = DEnd;
+        data(&d);
+        return;
+    }
+
+    size_t written = 0;
+    for (QbeVarInit *init = var->init_head; init; init = init->next) {
+        if (init->node) {
+            QbeNode *node = init->node;
+
+            d.type = DL;
+            memset(&d.u, 0, sizeof(d.u));
+            switch (node->ssa) {
+            case QBE_SSA_INT:
+                d.u.num = (int64_t) node->iota;
+                break;
+
+            case QBE_SSA_FLOAT:
+                if (node->type.kind == QBE_TYPE_F32) {
+                    d.u.flts = node->real;
+                } else {
+                    d.u.fltd = node->real;
+                }
+                break;
+
+            case QBE_SSA_GLOBAL:
+            case QBE_SSA_EXTERN:
+                qbe_lower_name(ref, node);
+                d.isref = 1;
+                d.u.ref.name = ref;
+                d.u.ref.off = 0;
+                break;
+
+            default:
+                qbe_err("constant literal expected");
+            }
+
+            data(&d);
+            d.isref = 0;
+            written += 8;
+            continue;
+        }
+
+        size_t        remaining = init->size;
+        const int8_t *bytes = init->data;
+        while (remaining) {
+            if (*bytes == 0) {
+                size_t count = 0;
+                for (size_t i = 0; i < remaining && !bytes[i]; i++) {
+                    count++;
+                }
+
+                if (count >= 8 || remaining < 8) {
+                    d.type = DZ;
+                    d.u.num = count;
+                    data(&d);
+
+                    bytes += count;
+                    remaining -= count;
+                    if (!remaining) {
+                        break;
+                    }
+                }
+            }
+
+            if (remaining >= 8) {
+                int64_t v;
+                memcpy(&v, bytes, sizeof(v));
+                d.type = DL;
+                d.u.num = v;
+                bytes += 8;
+                remaining -= 8;
+            } else if (remaining >= 4) {
+                int32_t v;
+                memcpy(&v, bytes, sizeof(v));
+                d.type = DW;
+                d.u.num = v;
+                bytes += 4;
+                remaining -= 4;
+            } else if (remaining >= 2) {
+                int16_t v;
+                memcpy(&v, bytes, sizeof(v));
+                d.type = DH;
+                d.u.num = v;
+                bytes += 2;
+                remaining -= 2;
+            } else {
+                d.type = DB;
+                d.u.num = *bytes;
+                bytes += 1;
+                remaining -= 1;
+            }
+            data(&d);
+        }
+        written += init->size;
+    }
+
+    if (written < info.size) {
+        d.type = DZ;
+        d.u.num = info.size - written;
+        data(&d);
+    }
+
+    d.type = DEnd;
+    data(&d);
+}
+
+static Fn *qbe_lower_fn(QbeLower *l, QbeFn *fn) {
+    Qbe *q = l->q;
+
+    Fn *f = qbe_alloc(sizeof(*f));
+    f->linenr = fn->debug_file.data ? fn->debug_line : 0;
+    f->ntmp = 0;
+    f->ncon = 2;
+    f->tmp = qbe_vnew(f->ntmp, sizeof(f->tmp[0]), PFn);
+    f->con = qbe_vnew(f->ncon, sizeof(f->con[0]), PFn);
+    for (int i = 0; i < Tmp0; ++i) {
+        if (qbe_T.fpr0 <= i && i < qbe_T.fpr0 + qbe_T.nfpr) {
+            qbe_newtmp(NULL, Kd, f);
+        } else {
+            qbe_newtmp(NULL, Kl, f);
+        }
+    }
+    f->con[0].type = CBits;
+    f->con[0].bits.i = 0xdeaddead; // UNDEF
+    f->con[1].type = CBits;
+    f->lnk.export = fn->node.sv.data != NULL;
+    f->retty = Kx;
+    qbe_lower_name(f->name, (QbeNode *) fn);
+
+    l->fn = f;
+    l->curb = NULL;
+    l->blink = &f->start;
+    l->nblk = 0;
+    l->blocks = qbe_vnew(0, sizeof(*l->blocks), PFn);
+    l->nblocks = 0;
+    l->state = QBE_LOWER_INS;
+    qbe_curi = qbe_insb;
+
+    switch (fn->return_type.kind) {
+    case QBE_TYPE_I0:
+        l->ret = Jret0;
+        break;
+
+    case QBE_TYPE_STRUCT:
+        l->ret = Jretc;
+        f->retty = fn->return_type.spec->node.iota;
+        break;
+
+    default:
+        l->ret = Jretw + qbe_lower_cls(fn->return_type);
+    }
+
+    q->locals = 0;
+    q->blocks = 1;
+    for (QbeNode *arg = fn->args.head; arg; arg = arg->next) {
+        arg->epoch = q->epoch;
+
+        const Ref r = qbe_lower_local(l, arg);
+        if (arg->type.kind == QBE_TYPE_STRUCT) {
+            qbe_lower_ins(l, Oparc, Kl, r, TYPE(arg->type.spec->node.iota), R);
+        } else {
+            qbe_lower_ins(l, Opar, qbe_lower_cls(arg->type), r, R, R);
+        }
+    }
+
+    l->state = QBE_LOWER_LABEL;
+    assert(fn->body.head && fn->body.head->kind == QBE_NODE_BLOCK);
+    qbe_lower_node(l, fn->body.head);
+
+    for (QbeNode *var = fn->vars.head; var; var = var->next) {
+        var->epoch = q->epoch;
+
+        QbeTypeInfo info = qbe_type_info(((QbeVar *) var)->type);
+        if (info.align < 4) {
+            // Typical C compilers usually align stack variables by 4
+            info.align = 4;
+        }
+
+        int op = 0;
+        switch (info.align) {
+        case 4:
+            op = Oalloc4;
+            break;
+
+        case 8:
+            op = Oalloc8;
+            break;
+
+        case 16:
+            op = Oalloc16;
+            break;
+
+        default:
+            assert(false && "Unsupported stack variable alignment");
+        }
+
+        const Ref to = qbe_lower_local(l, var);
+        qbe_lower_ins(l, op, Kl, to, qbe_lower_int(l, info.size), R);
+    }
+
+    for (QbeNode *stmt = fn->body.head->next; stmt; stmt = stmt->next) {
+        qbe_lower_node(l, stmt);
+    }
+
+    if (l->curb->jmp.type == Jxxx) {
+        qbe_err("last block misses jump");
+    }
+
+    f->mem = qbe_vnew(0, sizeof(f->mem[0]), PFn);
+    f->nmem = 0;
+    f->nblk = l->nblk;
+    f->rpo = NULL;
+    qbe_typecheck(f);
+    return f;
+}
+
+static void qbe_lower_types(Qbe *q) {
+    qbe_canonicalize_structs(q);
+
+    qbe_vgrow(&qbe_typ, q->struct_cache.iota);
+    for (; q->typs < q->struct_cache.iota; q->typs++) {
+        qbe_lower_struct(q->struct_cache.order[q->typs], &qbe_typ[q->typs]);
+    }
+}
+
+void qbe_lower_begin(Qbe *q) {
+    q->epoch++;
+    q->typs = 0;
+    qbe_typ = qbe_vnew(0, sizeof(qbe_typ[0]), PHeap);
+}
+
+void qbe_lower_finish(Qbe *q, QbeFn *fn, void dbgfile(char *), void func(Fn *)) {
+    assert(fn->finished != q->epoch && "This function has already been finished");
+    fn->finished = q->epoch;
+
+    QbeLower l = {.q = q};
+    qbe_lower_types(q);
+
+    if (fn->debug_file.data) {
+        dbgfile(qbe_lower_quote(&l, fn->debug_file));
+    }
+
+    func(qbe_lower_fn(&l, fn));
+    qbe_memfree(l.str.data);
+}
+
+void qbe_lower_end(Qbe *q, void dbgfile(char *), void data(Dat *), void func(Fn *)) {
+    QbeLower l = {.q = q};
+    qbe_lower_types(q);
+
+    for (QbeNode *it = q->vars.head; it; it = it->next) {
+        qbe_lower_var(&l, (QbeVar *) it, data);
+    }
+    qbe_memfree(l.str.data);
+
+    for (QbeNode *it = q->fns.head; it; it = it->next) {
+        QbeFn *fn = (QbeFn *) it;
+        if (fn->finished != q->epoch) {
+            qbe_lower_finish(q, fn, dbgfile, func);
+        }
+    }
+}
+
+// Separate from qbe_lower_end(), since the backend still reads the types of the lowered functions
+void qbe_lower_free(Qbe *q) {
+    for (size_t i = 0; i < q->typs; i++) {
+        if (qbe_typ[i].nunion) {
+            qbe_vfree(qbe_typ[i].fields);
+        }
+    }
+    qbe_vfree(qbe_typ);
+}
+
+Ctx *qbe_ctx_of(Qbe *q) {
+    if (!q->ctx) {
+        q->ctx = qbe_ctxnew(&q->memory);
+    }
+
+    return q->ctx;
+}
+
+// Binary IL
+//
+// Compact encoding of the lowered program, read back by qbe_parsebin() in parsebin.c. Integers are
+// LEB128 varints (zigzag encoded if signed), strings are length prefixed and NUL terminated so the
+// reader can use them in place.
+static _Thread_local struct {
+    Qbe   *q;
+    QbeSB *sb;
+    size_t typs;
+} qbe_writer;
+
+static void qbe_write_uint(uint64_t n) {
+    qbe_sb_reserve(qbe_writer.q, qbe_writer.sb, 10);
+    while (n >= 0x80) {
+        qbe_writer.sb->data[qbe_writer.sb->count++] = (n & 0x7f) | 0x80;
+        n >>= 7;
+    }
+    qbe_writer.sb->data[qbe_writer.sb->count++] = n;
+}
+
+static void qbe_write_int(int64_t n) {
+    qbe_write_uint(((uint64_t) n << 1) ^ (uint64_t) (n >> 63));
+}
+
+static void qbe_write_str(const char *s) {
+    const size_t n = strlen(s);
+    qbe_write_uint(n);
+
+    qbe_sb_reserve(qbe_writer.q, qbe_writer.sb, n + 1);
+    memcpy(qbe_writer.sb->data + qbe_writer.sb->count, s, n + 1);
+    qbe_writer.sb->count += n + 1;
+}
+
+// Only the kinds of references the lowering produces are encodable. Temporaries are numbered from
+// Tmp0, as registers never show up before the backend runs
+static void qbe_write_ref(Ref r) {
+    assert(r.type <= RType);
+
+    uint64_t val = r.val;
+    if (r.type == RTmp) {
+        assert(val == 0 || val >= Tmp0);
+        val = val ? val - Tmp0 + 1 : 0;
+    }
+
+    qbe_write_uint(val << 2 | r.type);
+}
+
+static void qbe_write_typs(void) {
+    for (; qbe_writer.typs < qbe_writer.q->typs; qbe_writer.typs++) {
+        const Typ *ty = &qbe_typ[qbe_writer.typs];
+        qbe_write_uint(BinTyp);
+        qbe_write_str(ty->name);
+        qbe_write_uint(ty->isdark);
+        qbe_write_uint(ty->isunion);
+        qbe_write_int(ty->align);
+        qbe_write_uint(ty->size);
+        if (ty->isdark) {
+            continue;
+        }
+
+        qbe_write_uint(ty->nunion);
+        for (uint i = 0; i < ty->nunion; i++) {
+            const Field *fld = ty->fields[i];
+
+            uint n = 0;
+            while (fld[n].type != FEnd) {
+                n++;
+            }
+
+            qbe_write_uint(n);
+            for (uint j = 0; j < n; j++) {
+                qbe_write_uint(fld[j].type);
+                qbe_write_uint(fld[j].len);
+            }
+        }
+    }
+}
+
+static void qbe_write_dbgfile(char *path) {
+    qbe_write_uint(BinDbg);
+    qbe_write_str(path);
+}
+
+static void qbe_write_dat(Dat *d) {
+    qbe_write_typs();
+
+    qbe_write_uint(BinDat);
+    qbe_write_uint(d->type);
+    switch (d->type) {
+    case DStart:
+        qbe_write_str(d->name);
+        qbe_write_uint(d->lnk->export);
+        qbe_write_uint(d->lnk->align);
+        break;
+
+    case DEnd:
+        break;
+
+    default:
+        qbe_write_uint(d->isstr);
+        qbe_write_uint(d->isref);
+        if (d->isstr) {
+            qbe_write_str(d->u.str);
+        } else if (d->isref) {
+            qbe_write_str(d->u.ref.name);
+            qbe_write_int(d->u.ref.off);
+        } else {
+            // Raw bits, so floats survive exactly
+            qbe_write_int(d->u.num);
+        }
+    }
+}
+
+static void qbe_write_fn(Fn *fn) {
+    qbe_write_typs();
+
+    qbe_write_uint(BinFn);
+    qbe_write_str(fn->name);
+    qbe_write_uint(fn->lnk.export);
+    qbe_write_uint(fn->vararg);
+    qbe_write_int(fn->retty);
+    qbe_write_uint(fn->linenr);
+
+    // The registers and the first two constants are the same for every function
+    qbe_write_uint(fn->ntmp - Tmp0);
+    qbe_write_uint(fn->ncon - 2);
+    for (int i = 2; i < fn->ncon; i++) {
+        const Con *c = &fn->con[i];
+        qbe_write_uint(c->type << 2 | c->flt);
+        if (c->type == CAddr) {
+            qbe_write_uint(c->sym.type);
+            qbe_write_str(qbe_str(c->sym.id));
+        }
+        qbe_write_int(c->bits.i);
+    }
+
+    qbe_write_uint(fn->nblk);
+    for (Blk *b = fn->start; b; b = b->link) {
+        qbe_write_uint(b->id);
+        qbe_write_str(b->name);
+
+        uint nphi = 0;
+        for (Phi *p = b->phi; p; p = p->link) {
+            nphi++;
+        }
+
+        qbe_write_uint(nphi);
+        for (Phi *p = b->phi; p; p = p->link) {
+            qbe_write_ref(p->to);
+            qbe_write_uint(p->cls);
+            qbe_write_uint(p->narg);
+            for (uint i = 0; i < p->narg; i++) {
+                qbe_write_uint(p->blk[i]->id);
+                qbe_write_ref(p->arg[i]);
+            }
+        }
+
+        qbe_write_uint(b->nins);
+        for (Ins *i = b->ins; i < &b->ins[b->nins]; i++) {
+            qbe_write_uint(i->op << 2 | i->cls);
+            qbe_write_ref(i->to);
+            qbe_write_ref(i->arg[0]);
+            qbe_write_ref(i->arg[1]);
+        }
+
+        qbe_write_uint(b->jmp.type);
+        qbe_write_ref(b->jmp.arg);
+        qbe_write_uint(b->s1 ? b->s1->id + 1 : 0);
+        qbe_write_uint(b->s2 ? b->s2->id + 1 : 0);
+    }
+
+    qbe_freeall();
+}
+
+QbeSV qbe_get_binary_program(Qbe *q) {
+    Ctx *prev = qbe_ctx;
+    qbe_ctx = qbe_ctx_of(q);
+    assert(!qbe_ctx->run && "A generation is in progress for this QBE context");
+
+    qbe_writer.q = q;
+    qbe_writer.sb = &q->bin;
+    qbe_writer.typs = 0;
+
+    q->bin.count = 0;
+    qbe_sb_reserve(q, &q->bin, 5);
+    memcpy(q->bin.data, BinMagic, 4);
+    q->bin.data[4] = BinVersion;
+    q->bin.count = 5;
+
+    qbe_lower_begin(q);
+    qbe_lower_end(q, qbe_write_dbgfile, qbe_write_dat, qbe_write_fn);
+    qbe_lower_free(q);
+    qbe_write_uint(BinEnd);
+
+    qbe_writer.q = NULL;
+    qbe_writer.sb = NULL;
+    qbe_ctx = prev;
+    return (QbeSV) {.data = q->bin.data, .count = q->bin.count};
+}
+
 bool qbe_has_been_compiled(Qbe *q) {
     return q->compiled;
 }
@@ -0,0 +1,712 @@
+// @shoumodip: On-disk cache of the assembly of functions
+//
+// A function is keyed by everything the backend looks at: its blocks,
+// temporaries and constants, the aggregate types it refers to, the target
+// and the current debug file. Entries keep the whole key, so a collision of
+// the hash is a miss and never wrong code. The block labels and floating
+// point constants are numbered across the whole output, so entries are
+// stored with their own numbering, which is shifted into place on a hit.
+// Entries are written to a temporary file and renamed into place, so any
+// number of processes can share a directory.
+//
+// The same entries can also be kept in memory, indexed by the name of the
+// function, for the incremental generation of a context. Every generation
+// that looks at them drops the functions it did not generate.
+#include <ctype.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "all.h"
+
+enum {
+	CVersion = 1,
+};
+
+typedef struct Buf Buf;
+typedef struct Ent Ent;
+
+struct Buf {
+	uchar *p;
+	size_t n, cap;
+};
+
+struct Ent {
+	char *name;
+	uchar *p;
+	size_t n;
+	uint gen;
+	Ent *link;
+};
+
+struct Cache {
+	char *dir;
+	size_t hit, miss;
+
+	/* in memory, by name */
+	int mem;
+	Ent **tab;
+	uint ntab, nent;
+	uint gen;
+	int used;
+
+	/* function being generated */
+	Buf key;
+	uint64_t hash;
+	char name[NString];
+	int id0;
+	FILE *outf;
+	char *text;
+	size_t ntext;
+	uint *fp; /* constants stashed, in order */
+	uint nfp;
+	int log;
+};
+
+static char magic[8] = "qbecache";
+
+static void
+bput(Buf *b, void *p, size_t n)
+{
+	if (n == 0)
+		return;
+	if (b->n + n > b->cap) {
+		b->cap = b->cap ? b->cap : 4096;
+		while (b->cap < b->n + n)
+			b->cap *= 2;
+		b->p = qbe_erealloc(b->p, b->cap); // @shoumodip
+	}
+	memcpy(&b->p[b->n], p, n);
+	b->n += n;
+}
+
+static void
+bu32(Buf *b, uint32_t v)
+{
+	bput(b, &v, 4);
+}
+
+static void
+bstr(Buf *b, char *s)
+{
+	uint32_t n;
+
+	n = s ? strlen(s) + 1 : 0;
+	bu32(b, n);
+	bput(b, s, n);
+}
+
+/* by value, the indices in typ[] depend on the
+ * order the types were defined in */
+static void
+btyp(Buf *b, int t)
+{
+	Typ *ty;
+	struct Field *f;
+	uint n;
+
+	if (t < 0) {
+		bu32(b, -1);
+		return;
+	}
+	ty = &qbe_typ[t];
+	bstr(b, ty->name);
+	bu32(b, ty->isdark);
+	bu32(b, ty->isunion);
+	bu32(b, ty->align);
+	bput(b, &ty->size, sizeof ty->size);
+	bu32(b, ty->nunion);
+	if (ty->isdark)
+		return;
+	for (n=0; n<ty->nunion; n++)
+		for (f=ty->fields[n];; f++) {
+			bu32(b, f->type);
+			if (f->type == FTyp)
+				btyp(b, f->len);
+			else
+				bu32(b, f->len);
+			if (f->type == FEnd)
+				break;
+		}
+}
+
+static void
+bref(Buf *b, Ref r)
+{
+	bu32(b, rtype(r));
+	if (rtype(r) == RType)
+		btyp(b, r.val);
+	else
+		bu32(b, r.val);
+}
+
+static void
+keyfn(Buf *b, Fn *fn)
+{
+	Blk *bl, **blk;
+	Phi *p;
+	Ins *i;
+	Con *c;
+	uint n, nblk, *id;
+	int t;
+
+	bput(b, magic, sizeof magic);
+	bu32(b, CVersion);
+	bstr(b, __DATE__ " " __TIME__);
+	bstr(b, qbe_T.name);
+	bu32(b, qbe_T.apple);
+	bu32(b, qbe_ctx->curfile);
+	bu32(b, qbe_ctx->shared);
+
+	bstr(b, fn->name);
+	bu32(b, fn->linenr);
+	bu32(b, fn->vararg);
+	bu32(b, fn->dynalloc);
+	btyp(b, fn->retty);
+	bu32(b, fn->lnk.export);
+	bu32(b, fn->lnk.thread);
+	bu32(b, fn->lnk.align);
+	bstr(b, fn->lnk.sec);
+	bstr(b, fn->lnk.secf);
+
+	bu32(b, fn->ntmp);
+	for (t=Tmp0; t<fn->ntmp; t++)
+		bu32(b, fn->tmp[t].cls);
+	bu32(b, fn->ncon);
+	for (c=fn->con; c<&fn->con[fn->ncon]; c++) {
+		bu32(b, c->type);
+		bu32(b, c->flt);
+		bput(b, &c->bits.i, sizeof c->bits.i);
+		if (c->type == CAddr) {
+			bu32(b, c->sym.type);
+			bstr(b, qbe_str(c->sym.id));
+		}
+	}
+
+	/* the blocks are numbered in their order for the
+	 * key, the ids are put back for the passes */
+	nblk = 0;
+	for (bl=fn->start; bl; bl=bl->link)
+		nblk++;
+	bu32(b, nblk);
+	id = qbe_emalloc(nblk * sizeof id[0] + 1);
+	blk = qbe_emalloc(nblk * sizeof blk[0] + 1);
+	for (n=0, bl=fn->start; bl; bl=bl->link, n++) {
+		id[n] = bl->id;
+		blk[n] = bl;
+		bl->id = n;
+	}
+	for (bl=fn->start; bl; bl=bl->link) {
+		for (p=bl->phi; p; p=p->link) {
+			bref(b, p->to);
+			bu32(b, p->cls);
+			bu32(b, p->narg);
+			for (n=0; n<p->narg; n++) {
+				bu32(b, p->blk[n]->id);
+				bref(b, p->arg[n]);
+			}
+		}
+		bu32(b, -1);
+		bu32(b, bl->nins);
+		for (i=bl->ins; i<&bl->ins[bl->nins]; i++) {
+			bu32(b, i->op);
+			bu32(b, i->cls);
+			bref(b, i->to);
+			bref(b, i->arg[0]);
+			bref(b, i->arg[1]);
+		}
+		bu32(b, bl->jmp.type);
+		bref(b, bl->jmp.arg);
+		bu32(b, bl->s1 ? bl->s1->id : -1u);
+		bu32(b, bl->s2 ? bl->s2->id : -1u);
+	}
+	for (n=0; n<nblk; n++)
+		blk[n]->id = id[n];
+	qbe_memfree(id);
+	qbe_memfree(blk);
+}
+
+static uint64_t
+hash(uchar *p, size_t n)
+{
+	uint64_t h;
+
+	h = 0xcbf29ce484222325;
+	while (n--)
+		h = (h ^ *p++) * 0x100000001b3;
+	return h;
+}
+
+typedef struct Lbl Lbl;
+
+struct Lbl {
+	int store;   /* normalizing for an entry */
+	int64_t bb;  /* added to the block labels */
+	int nblk;
+	uint *fp;    /* constant n of the entry is fp[n] */
+	uint nfp;
+};
+
+static int
+symchr(int c)
+{
+	return isalnum(c) || c == '_' || c == '.' || c == '$';
+}
+
+/* rewrites the local labels of a function,
+ * returns 0 if one is out of place */
+static int
+relabel(char *s, size_t n, Lbl *l, Buf *out)
+{
+	char *e, *q, *a, num[24];
+	uint64_t v;
+	uint k;
+	int fp;
+
+	a = qbe_T.asloc;
+	for (e=&s[n], q=s; q<e;) {
+		if ((q != s && symchr((uchar)q[-1]))
+		|| (size_t)(e-q) <= strlen(a)
+		|| strncmp(q, a, strlen(a)) != 0) {
+			bput(out, q++, 1);
+			continue;
+		}
+		bput(out, a, strlen(a));
+		q += strlen(a);
+		fp = e-q > 2 && q[0] == 'f' && q[1] == 'p' && isdigit((uchar)q[2]);
+		if (fp || (e-q > 2 && q[0] == 'b' && q[1] == 'b' && isdigit((uchar)q[2]))) {
+			bput(out, q, 2);
+			q += 2;
+		} else if (q == e || !isdigit((uchar)*q))
+			continue;
+		for (v=0; q<e && isdigit((uchar)*q); q++)
+			v = v*10 + (*q-'0');
+		if (fp && l->store) {
+			for (k=0; k<l->nfp; k++)
+				if (l->fp[k] == v)
+					break;
+			if (k == l->nfp) {
+				l->fp = qbe_erealloc(l->fp, (l->nfp+1) * sizeof l->fp[0]); // @shoumodip
+				l->fp[l->nfp++] = v;
+			}
+			v = k;
+		} else if (fp) {
+			if (v >= l->nfp)
+				return 0;
+			v = l->fp[v];
+		} else {
+			v += l->bb;
+			if (l->store && v >= (uint64_t)l->nblk)
+				return 0;
+		}
+		bput(out, num, sprintf(num, "%"PRIu64, v));
+	}
+	return 1;
+}
+
+static char *
+entpath(Cache *c, char *buf, size_t n)
+{
+	snprintf(buf, n, "%s/%016"PRIx64, c->dir, c->hash);
+	return buf;
+}
+
+static uchar *
+readall(char *path, size_t *n)
+{
+	FILE *f;
+	uchar *p;
+	long sz;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return 0;
+	p = 0;
+	if (fseek(f, 0, SEEK_END) == 0 && (sz = ftell(f)) > 0 && fseek(f, 0, SEEK_SET) == 0) {
+		p = qbe_emalloc(sz); // @shoumodip
+		if (fread(p, 1, sz, f) != (size_t)sz) {
+			qbe_memfree(p);
+			p = 0;
+		}
+		*n = sz;
+	}
+	fclose(f);
+	return p;
+}
+
+static int
+take(uchar **p, uchar *e, void *v, size_t n)
+{
+	if ((size_t)(e - *p) < n)
+		return 0;
+	memcpy(v, *p, n);
+	*p += n;
+	return 1;
+}
+
+/* an entry is the key, the number of blocks, the
+ * floating point constants and the assembly */
+static int
+load(Cache *c, uchar *p, size_t n)
+{
+	Buf out;
+	Lbl l;
+	uchar *e, *fp, bits[16];
+	uint32_t nkey, nblk, nfp, sz, ntext;
+	uint k;
+	int ok;
+
+	e = &p[n];
+	if (!take(&p, e, &nkey, 4) || nkey != c->key.n
+	|| (size_t)(e - p) < nkey || memcmp(p, c->key.p, nkey) != 0)
+		return 0;
+	p += nkey;
+	if (!take(&p, e, &nblk, 4) || !take(&p, e, &nfp, 4)
+	|| nfp > (size_t)(e - p) / 8)
+		return 0;
+	fp = p;
+	for (k=0; k<nfp; k++)
+		if (!take(&p, e, &sz, 4) || (sz != 4 && sz != 8 && sz != 16)
+		|| !take(&p, e, bits, sz))
+			return 0;
+	if (!take(&p, e, &ntext, 4) || (size_t)(e - p) != ntext)
+		return 0;
+
+	/* the text is checked with the constants of the entry
+	 * as they are, so that a bad one leaves the stash alone */
+	l = (Lbl){.bb = qbe_ctx->id0, .nblk = nblk, .nfp = nfp};
+	l.fp = qbe_emalloc(nfp * sizeof l.fp[0] + 1);
+	for (k=0; k<nfp; k++)
+		l.fp[k] = k;
+	out = (Buf){0};
+	ok = relabel((char *)p, ntext, &l, &out);
+	if (ok && nfp) {
+		for (k=0; k<nfp; k++) {
+			memcpy(&sz, fp, 4);
+			memcpy(bits, &fp[4], sz);
+			l.fp[k] = qbe_stashbits(bits, sz);
+			fp += 4 + sz;
+		}
+		out.n = 0;
+		relabel((char *)p, ntext, &l, &out);
+	}
+	if (ok) {
+		fwrite(out.p, 1, out.n, qbe_ctx->outf);
+		qbe_ctx->id0 += nblk;
+	}
+	qbe_memfree(out.p);
+	qbe_memfree(l.fp);
+	return ok;
+}
+
+static uint
+hname(char *s)
+{
+	return hash((uchar *)s, strlen(s));
+}
+
+static Ent **
+lookup(Cache *c, char *name)
+{
+	Ent **pe;
+
+	if (!c->ntab)
+		return 0;
+	pe = &c->tab[hname(name) & (c->ntab-1)];
+	for (; *pe; pe=&(*pe)->link)
+		if (strcmp((*pe)->name, name) == 0)
+			return pe;
+	return pe;
+}
+
+/* takes ownership of p */
+static void
+keep(Cache *c, char *name, uchar *p, size_t n)
+{
+	Ent **pe, *e, **tab;
+	uint k, ntab;
+
+	if (c->nent >= c->ntab) {
+		ntab = c->ntab ? 2*c->ntab : 64;
+		tab = qbe_emalloc(ntab * sizeof tab[0]);
+		for (k=0; k<c->ntab; k++)
+			while ((e = c->tab[k])) {
+				c->tab[k] = e->link;
+				e->link = tab[hname(e->name) & (ntab-1)];
+				tab[hname(e->name) & (ntab-1)] = e;
+			}
+		qbe_memfree(c->tab);
+		c->tab = tab;
+		c->ntab = ntab;
+	}
+	pe = lookup(c, name);
+	if (!(e = *pe)) {
+		e = qbe_emalloc(sizeof *e);
+		e->name = qbe_emalloc(strlen(name) + 1);
+		strcpy(e->name, name);
+		*pe = e;
+		c->nent++;
+	}
+	qbe_memfree(e->p);
+	e->p = p;
+	e->n = n;
+	e->gen = c->gen;
+}
+
+static void
+save(Cache *c, Buf *ent)
+{
+	FILE *f;
+	char tmp[4096], path[4096];
+	int fd, ok;
+
+	snprintf(tmp, sizeof tmp, "%s/.tmpXXXXXX", c->dir);
+	fd = mkstemp(tmp);
+	f = fd < 0 ? 0 : fdopen(fd, "wb");
+	if (f) {
+		ok = fwrite(ent->p, 1, ent->n, f) == ent->n;
+		ok &= fclose(f) == 0;
+		if (!ok || rename(tmp, entpath(c, path, sizeof path)) != 0)
+			remove(tmp);
+	} else if (fd >= 0) {
+		close(fd);
+		remove(tmp);
+	}
+}
+
+static void
+store(Cache *c, char *name, int nblk)
+{
+	Buf ent, text;
+	Lbl l;
+	uchar bits[16];
+	uint k;
+	int sz, ok;
+
+	/* the constants are stashed again in the same
+	 * order, so a hit numbers them the same way */
+	l = (Lbl){.store = 1, .bb = -(int64_t)c->id0, .nblk = nblk};
+	l.fp = c->fp;
+	l.nfp = c->nfp;
+	c->fp = 0;
+	c->nfp = 0;
+	text = (Buf){0};
+	ent = (Buf){0};
+	ok = relabel(c->text, c->ntext, &l, &text);
+	if (ok) {
+		bu32(&ent, c->key.n);
+		bput(&ent, c->key.p, c->key.n);
+		bu32(&ent, nblk);
+		bu32(&ent, l.nfp);
+		for (k=0; k<l.nfp && ok; k++) {
+			sz = qbe_stashget(l.fp[k], bits);
+			ok = sz != 0;
+			bu32(&ent, sz);
+			bput(&ent, bits, sz);
+		}
+		bu32(&ent, text.n);
+		bput(&ent, text.p, text.n);
+	}
+	if (ok && c->dir)
+		save(c, &ent);
+	if (ok && c->mem) {
+		keep(c, name, ent.p, ent.n);
+		ent.p = 0;
+	}
+	qbe_memfree(ent.p);
+	qbe_memfree(text.p);
+	qbe_memfree(l.fp);
+}
+
+static Cache *
+mkcache(void)
+{
+	if (!qbe_ctx->cache)
+		qbe_ctx->cache = qbe_emalloc(sizeof(Cache));
+	return qbe_ctx->cache;
+}
+
+static void
+dropent(Ent *e)
+{
+	qbe_memfree(e->name);
+	qbe_memfree(e->p);
+	qbe_memfree(e);
+}
+
+void
+qbe_cachedir(char *dir)
+{
+	Cache *c;
+
+	c = mkcache();
+	qbe_memfree(c->dir);
+	c->dir = 0;
+	if (dir) {
+		mkdir(dir, 0777);
+		c->dir = qbe_emalloc(strlen(dir) + 1);
+		strcpy(c->dir, dir);
+	}
+	if (!c->dir && !c->mem)
+		qbe_cachefree();
+}
+
+static void
+clear(Cache *c)
+{
+	Ent *e;
+	uint k;
+
+	for (k=0; k<c->ntab; k++)
+		while ((e = c->tab[k])) {
+			c->tab[k] = e->link;
+			dropent(e);
+		}
+	qbe_memfree(c->tab);
+	c->tab = 0;
+	c->ntab = 0;
+	c->nent = 0;
+}
+
+void
+qbe_cachemem(int on)
+{
+	Cache *c;
+
+	c = mkcache();
+	c->mem = on;
+	if (!on)
+		clear(c);
+	if (!c->dir && !c->mem)
+		qbe_cachefree();
+}
+
+/* drops the functions kept in memory that were not
+ * generated since the last call, unless none were */
+void
+qbe_cachesweep(void)
+{
+	Cache *c;
+	Ent **pe, *e;
+	uint k;
+
+	c = qbe_ctx->cache;
+	if (!c || !c->mem || !c->used)
+		return;
+	for (k=0; k<c->ntab; k++)
+		for (pe=&c->tab[k]; (e = *pe);)
+			if (e->gen != c->gen) {
+				*pe = e->link;
+				dropent(e);
+				c->nent--;
+			} else
+				pe = &e->link;
+	c->gen++;
+	c->used = 0;
+}
+
+void
+qbe_cachefree(void)
+{
+	Cache *c;
+
+	c = qbe_ctx->cache;
+	if (!c)
+		return;
+	clear(c);
+	qbe_memfree(c->dir);
+	qbe_memfree(c->key.p);
+	qbe_memfree(c->fp);
+	qbe_memfree(c);
+	qbe_ctx->cache = 0;
+}
+
+void
+qbe_cachestash(int n)
+{
+	Cache *c;
+	uint k;
+
+	c = qbe_ctx->cache;
+	if (!c || !c->log)
+		return;
+	for (k=0; k<c->nfp; k++)
+		if (c->fp[k] == (uint)n)
+			return;
+	c->fp = qbe_erealloc(c->fp, (c->nfp+1) * sizeof c->fp[0]); // @shoumodip
+	c->fp[c->nfp++] = n;
+}
+
+void
+qbe_cachestats(size_t *hit, size_t *miss)
+{
+	Cache *c;
+
+	c = qbe_ctx->cache;
+	*hit = c ? c->hit : 0;
+	*miss = c ? c->miss : 0;
+}
+
+/* emits the cached assembly of fn and returns 1,
+ * or starts capturing the assembly for qbe_cacheput() */
+int
+qbe_cacheget(Fn *fn)
+{
+	Cache *c;
+	Ent **pe;
+	uchar *p;
+	size_t n;
+	char path[4096];
+	int ok;
+
+	c = qbe_ctx->cache;
+	c->key.n = 0;
+	keyfn(&c->key, fn);
+	c->hash = hash(c->key.p, c->key.n);
+	strcpy(c->name, fn->name);
+	ok = 0;
+	if (c->mem) {
+		c->used = 1;
+		pe = lookup(c, fn->name);
+		ok = pe && *pe && load(c, (*pe)->p, (*pe)->n);
+		if (ok)
+			(*pe)->gen = c->gen;
+	}
+	if (!ok && c->dir) {
+		p = readall(entpath(c, path, sizeof path), &n);
+		ok = p && load(c, p, n);
+		if (ok && c->mem)
+			keep(c, fn->name, p, n);
+		else
+			qbe_memfree(p);
+	}
+	if (ok) {
+		c->hit++;
+		return 1;
+	}
+	c->miss++;
+	c->id0 = qbe_ctx->id0;
+	c->outf = qbe_ctx->outf;
+	c->text = 0;
+	c->ntext = 0;
+	c->log = 1;
+	qbe_ctx->outf = open_memstream(&c->text, &c->ntext);
+	if (!qbe_ctx->outf)
+		die("cannot capture the assembly");
+	return 0;
+}
+
+void
+qbe_cacheput(void)
+{
+	Cache *c;
+
+	c = qbe_ctx->cache;
+	c->log = 0;
+	fclose(qbe_ctx->outf);
+	qbe_ctx->outf = c->outf;
+	c->outf = 0;
+	fwrite(c->text, 1, c->ntext, qbe_ctx->outf);
+	store(c, c->name, qbe_ctx->id0 - c->id0);
+	free(c->text); /* open_memstream() */
+	c->text = 0;
+}
@@ -327,5 +327,5 @@ qbe_simpljmp(Fn *fn)
 		}
 	}
 	*p = ret;
-	free(uf);
+	qbe_memfree(uf); // @shoumodip
 }
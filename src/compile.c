@@ -1,23 +1,19 @@
+#ifdef __linux__
+#    define _GNU_SOURCE // pipe2
+#endif
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <spawn.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "all.h"
 #include "qbe.h"
 
-Target qbe_T;
-
-char qbe_debug['Z' + 1] = {
-    ['P'] = 0, /* parsing */
-    ['M'] = 0, /* memory optimization */
-    ['N'] = 0, /* ssa construction */
-    ['C'] = 0, /* copy elimination */
-    ['F'] = 0, /* constant folding */
-    ['A'] = 0, /* abi lowering */
-    ['I'] = 0, /* instruction selection */
-    ['L'] = 0, /* liveness */
-    ['S'] = 0, /* spilling */
-    ['R'] = 0, /* reg. allocation */
-};
+_Thread_local Ctx *qbe_ctx;
+
+extern char **environ;
 
 extern Target qbe_T_amd64_sysv;
 extern Target qbe_T_amd64_apple;
@@ -25,21 +21,34 @@ extern Target qbe_T_arm64;
 extern Target qbe_T_arm64_apple;
 extern Target qbe_T_rv64;
 
-static FILE *qbe_output;
-static int   dbg;
+static int dbg;
 
-static void data(Dat *d) {
+static void qbe_shard(size_t cost);
+static void qbe_shard_fn(Fn *fn);
+static void qbe_shard_data(Dat *d);
+static void qbe_shard_dbgfile(char *fn, uint nfile);
+
+static void emitdat(Dat *d) {
     if (dbg) return;
-    qbe_emitdat(d, qbe_output);
+    if (qbe_ctx->obj) {
+        qbe_objdat(d);
+        if (d->type == DEnd) qbe_freeall();
+        return;
+    }
+    qbe_emitdat(d, qbe_ctx->outf);
     if (d->type == DEnd) {
-        fputs("/* end data */\n\n", qbe_output);
+        fputs("/* end data */\n\n", qbe_ctx->outf);
         qbe_freeall();
     }
 }
 
-static void func(Fn *fn) {
-    uint n;
+static void data(Dat *d) {
+    if (!dbg && !qbe_ctx->obj) qbe_shard_data(d);
+    emitdat(d);
+}
 
+// Everything before the lowering of the ABI is the same for the targets that share abi0
+static void passes_generic(Fn *fn) {
     if (dbg) fprintf(stderr, "**** Function %s ****", fn->name);
     if (qbe_debug['P']) {
         fprintf(stderr, "\n> After parsing:\n");
@@ -64,11 +73,21 @@ static void func(Fn *fn) {
     qbe_copy(fn);
     qbe_filluse(fn);
     qbe_fold(fn);
+}
+
+// The passes are split around instruction selection, which allocates the floating point constants
+// and thus has to see the functions in source order for the output to be deterministic
+static void passes_front(Fn *fn) {
+    passes_generic(fn);
     qbe_T.abi1(fn);
     qbe_simpl(fn);
     qbe_fillpreds(fn);
     qbe_filluse(fn);
-    qbe_T.isel(fn);
+}
+
+static void passes_back(Fn *fn) {
+    uint n;
+
     qbe_fillrpo(fn);
     qbe_filllive(fn);
     qbe_fillloop(fn);
@@ -85,15 +104,42 @@ static void func(Fn *fn) {
             fn->rpo[n]->link = 0;
             break;
         } else fn->rpo[n]->link = fn->rpo[n + 1];
-    if (!dbg) {
-        qbe_T.emitfn(fn, qbe_output);
-        fprintf(qbe_output, "/* end function %s */\n\n", fn->name);
+}
+
+static void emitfn(Fn *fn) {
+    if (!dbg && qbe_ctx->obj) {
+        qbe_T.encodefn(fn);
+    } else if (!dbg) {
+        qbe_T.emitfn(fn, qbe_ctx->outf);
+        fprintf(qbe_ctx->outf, "/* end function %s */\n\n", fn->name);
     } else fprintf(stderr, "\n");
     qbe_freeall();
 }
 
+static void func(Fn *fn) {
+    if (!dbg && !qbe_ctx->obj) qbe_shard_fn(fn);
+
+    // Objects have no text to replay, and the dumps of the passes must see them run. Functions with
+    // debug information are cached too, with the file and the line in the key
+    const bool cache = qbe_ctx->cache && !qbe_ctx->obj && !dbg;
+    if (cache && qbe_cacheget(fn)) {
+        qbe_freeall();
+        return;
+    }
+
+    passes_front(fn);
+    qbe_T.isel(fn);
+    passes_back(fn);
+    emitfn(fn);
+
+    if (cache) qbe_cacheput();
+}
+
 static void dbgfile(char *fn) {
-    qbe_emitdbgfile(fn, qbe_output);
+    if (qbe_ctx->obj) return; // The objects have no debug information
+    const uint nfile = qbe_ctx->nfile;
+    qbe_emitdbgfile(fn, qbe_ctx->outf);
+    qbe_shard_dbgfile(fn, nfile);
 }
 
 // Copyright (C) 2025 Shoumodip Kar <shoumodipkar@gmail.com>
@@ -157,11 +203,7 @@ void cmd_push(Cmd *c, const char *arg) {
     c->data[c->count++] = arg;
 }
 
-int qbe_generate(Qbe *q, QbeTarget target, const char *output, const char **flags, size_t flags_count) {
-    if (!qbe_has_been_compiled(q)) {
-        qbe_compile(q);
-    }
-
+static void qbe_target_select(QbeTarget target) {
     if (target == QBE_TARGET_DEFAULT) {
         target = qbe_target_default();
     }
@@ -191,70 +233,1419 @@ int qbe_generate(Qbe *q, QbeTarget target, const char *output, const char **flag
         assert(0 && "unreachable");
         break;
     }
+}
 
-    int pipefd[2];
-    if (pipe(pipefd) < 0) {
-        return 1;
+static int qbe_exit_code(int status) {
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
     }
 
-    const pid_t pid = fork();
-    if (pid < 0) {
-        return 1;
+    return WEXITSTATUS(status);
+}
+
+// Toolchain
+//
+// The assembler and the linker are templates, where "{output}" and "{input}" are replaced anywhere in
+// an argument, and an argument of exactly "{flags}" or "{input}" expands to all of them
+static const char *qbe_driver[] = {"cc", "-o", "{output}", "-x", "assembler", "-", "{flags}", NULL};
+static const char *qbe_driver_object[] = {"cc", "-c", "-o", "{output}", "-x", "assembler", "-", "{flags}", NULL};
+static const char *qbe_driver_link[] = {"cc", "-o", "{output}", "{input}", "{flags}", NULL};
+static const char *qbe_driver_partial[] = {"cc", "-r", "-o", "{output}", "{input}", NULL};
+
+static char *qbe_subst(const char *arg, const char *output, const char *input) {
+    size_t count = strlen(arg) + 1;
+    for (const char *it = arg; (it = strchr(it, '{')); it++) {
+        if (!strncmp(it, "{output}", 8)) count += strlen(output);
+        if (!strncmp(it, "{input}", 7)) count += strlen(input);
     }
 
-    if (pid == 0) {
-        close(pipefd[1]);
-        dup2(pipefd[0], STDIN_FILENO);
-        close(pipefd[0]);
+    char *result = malloc(count);
+    assert(result && "Out of memory");
 
-        Cmd cmd = {0};
-        cmd_push(&cmd, "cc");
-        cmd_push(&cmd, "-o");
-        cmd_push(&cmd, output);
-        cmd_push(&cmd, "-x");
-        cmd_push(&cmd, "assembler");
-        cmd_push(&cmd, "-");
-        for (size_t i = 0; i < flags_count; i++) {
-            cmd_push(&cmd, flags[i]);
+    char *end = result;
+    while (*arg) {
+        if (!strncmp(arg, "{output}", 8)) {
+            end = stpcpy(end, output);
+            arg += 8;
+        } else if (!strncmp(arg, "{input}", 7)) {
+            end = stpcpy(end, input);
+            arg += 7;
+        } else {
+            *end++ = *arg++;
         }
-        cmd_push(&cmd, NULL);
+    }
+    *end = '\0';
+    return result;
+}
 
-        execvp(*cmd.data, (char *const *) cmd.data);
-        exit(127);
+// Every argument of the command is allocated
+static char **qbe_expand(
+    const char *const *tmpl,
+    const char        *output,
+    char *const       *inputs,
+    size_t             inputs_count,
+    const char       **flags,
+    size_t             flags_count) {
+    Cmd cmd = {0};
+    for (; *tmpl; tmpl++) {
+        if (!strcmp(*tmpl, "{flags}")) {
+            for (size_t i = 0; i < flags_count; i++) {
+                cmd_push(&cmd, qbe_subst(flags[i], "", ""));
+            }
+        } else if (!strcmp(*tmpl, "{input}")) {
+            for (size_t i = 0; i < inputs_count; i++) {
+                cmd_push(&cmd, qbe_subst(inputs[i], "", ""));
+            }
+        } else {
+            cmd_push(&cmd, qbe_subst(*tmpl, output, inputs_count ? inputs[0] : ""));
+        }
     }
+    cmd_push(&cmd, NULL);
+    return (char **) cmd.data;
+}
 
-    qbe_output = fdopen(pipefd[1], "w");
-    if (!qbe_output) {
-        return 1;
+static void qbe_cmd_free(char **cmd) {
+    if (cmd) {
+        for (char **it = cmd; *it; it++) {
+            free(*it);
+        }
+        free(cmd);
+    }
+}
+
+static char **qbe_cmd_copy(const char **tmpl) {
+    if (!tmpl) {
+        return NULL;
+    }
+
+    Cmd cmd = {0};
+    for (; *tmpl; tmpl++) {
+        char *arg = strdup(*tmpl);
+        assert(arg && "Out of memory");
+        cmd_push(&cmd, arg);
     }
-    close(pipefd[0]);
+    cmd_push(&cmd, NULL);
+    return (char **) cmd.data;
+}
+
+// Spawned rather than forked, since copying the page tables of a large host process costs far more
+// than the toolchain itself. The file actions are the only thing that runs in the child. Returns 0
+// if the command could not be executed
+static pid_t qbe_spawn(char **cmd, int in) {
+    posix_spawn_file_actions_t actions;
+    if (posix_spawn_file_actions_init(&actions)) {
+        return 0;
+    }
+
+    pid_t pid;
+    int   err = in >= 0 && posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+    err = err || posix_spawnp(&pid, *cmd, &actions, NULL, cmd, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    return err ? 0 : pid;
+}
+
+// The toolchain of a generation. The output is split into shards, each piped into its own assembler,
+// and the linker runs once all of them succeeded. With a single shard and no linker the assembler
+// writes the output directly, otherwise the objects in between are temporaries next to the output
+struct Run {
+    size_t count;   // Shards
+    pid_t *pids;    // Still running, the linker takes the first slot
+    FILE **files;   // Input of the assemblers while generating
+    size_t *loads;  // Output of the shards so far, for balancing
+    size_t  current;
+    char  **objects;
+    char  **link;
+    int     code; // Of the first step that failed
+};
+
+static void qbe_run_free(Run *r) {
+    for (size_t i = 0; r->objects && i < r->count; i++) {
+        if (r->objects[i]) {
+            remove(r->objects[i]);
+            free(r->objects[i]);
+        }
+    }
+    free(r->objects);
+    qbe_cmd_free(r->link);
+    free(r->pids);
+    free(r->files);
+    free(r->loads);
+    free(r);
+}
+
+// Records the exit of an assembler or the linker, and starts the linker once all the assemblers are
+// done. Returns whether the whole toolchain is
+static bool qbe_run_exited(Run *r, size_t i, int status) {
+    r->pids[i] = 0;
+    if (!r->code) {
+        r->code = status < 0 ? 1 : qbe_exit_code(status);
+    }
+
+    for (size_t j = 0; j < r->count; j++) {
+        if (r->pids[j]) {
+            return false;
+        }
+    }
+
+    if (!r->code && r->link) {
+        r->pids[0] = qbe_spawn(r->link, -1);
+        r->code = r->pids[0] ? 0 : 127; // Same as a child that failed to execute it
+    }
+
+    qbe_cmd_free(r->link);
+    r->link = NULL;
+    return !r->pids[0];
+}
+
+// Waits for the whole toolchain and frees it. Stops once no child is left, which may already be the
+// case when a spawn failed or the children were reaped before
+static int qbe_run_wait(Run *r) {
+    for (size_t i = 0; i < r->count;) {
+        if (!r->pids[i]) {
+            i++;
+            continue;
+        }
+
+        int status = 0;
+        if (waitpid(r->pids[i], &status, 0) < 0) {
+            status = -1;
+        }
+
+        if (qbe_run_exited(r, i, status)) {
+            break;
+        }
+        i = 0; // The linker may have started in the first slot
+    }
+
+    const int code = r->code;
+    qbe_run_free(r);
+    return code;
+}
+
+// Sends the next piece of output to the shard with the least output so far, where the cost is roughly
+// in lines of assembly
+static void qbe_shard(size_t cost) {
+    Run *r = qbe_ctx->run;
+    if (!r || r->count < 2) {
+        return;
+    }
+
+    r->current = 0;
+    for (size_t i = 1; i < r->count; i++) {
+        if (r->loads[i] < r->loads[r->current]) {
+            r->current = i;
+        }
+    }
+
+    r->loads[r->current] += cost;
+    qbe_ctx->outf = r->files[r->current];
+}
+
+static void qbe_shard_fn(Fn *fn) {
+    size_t cost = 0;
+    for (Blk *b = fn->start; b; b = b->link) {
+        cost += b->nins + 1;
+    }
+    qbe_shard(cost);
+}
+
+static void qbe_shard_data(Dat *d) {
+    Run *r = qbe_ctx->run;
+    if (d->type == DStart) {
+        qbe_shard(1);
+    } else if (r && r->count > 1) {
+        r->loads[r->current]++;
+    }
+}
+
+// Every shard refers to the debug files by number, so they all need the directives
+static void qbe_shard_dbgfile(char *fn, uint nfile) {
+    Run *r = qbe_ctx->run;
+    if (!r || r->count < 2 || qbe_ctx->nfile == nfile) {
+        return;
+    }
+
+    for (size_t i = 0; i < r->count; i++) {
+        if (r->files[i] != qbe_ctx->outf) {
+            fprintf(r->files[i], ".file %u %s\n", qbe_ctx->curfile, fn);
+        }
+    }
+}
+
+static int qbe_generate_spawn(QbeTarget target, const char *output, const char **flags, size_t flags_count) {
+    assert(!qbe_ctx->run && "Another generation is already in progress for this QBE context");
+    qbe_target_select(target);
+
+    Run *r = calloc(1, sizeof(*r));
+    assert(r && "Out of memory");
+    r->count = qbe_ctx->nshard > 1 ? qbe_ctx->nshard : 1;
+    r->pids = calloc(r->count, sizeof(*r->pids));
+    r->files = calloc(r->count, sizeof(*r->files));
+    r->loads = calloc(r->count, sizeof(*r->loads));
+    assert(r->pids && r->files && r->loads && "Out of memory");
+
+    const bool link = r->count > 1 || (qbe_ctx->ld && !qbe_ctx->objonly);
+    if (link) {
+        r->objects = calloc(r->count, sizeof(*r->objects));
+        assert(r->objects && "Out of memory");
+
+        for (size_t i = 0; i < r->count; i++) {
+            const size_t size = strlen(output) + 16;
+            r->objects[i] = malloc(size);
+            assert(r->objects[i] && "Out of memory");
+            snprintf(r->objects[i], size, "%s.XXXXXX.o", output);
+
+            const int fd = mkstemps(r->objects[i], 2);
+            if (fd < 0) {
+                free(r->objects[i]);
+                r->objects[i] = NULL;
+                qbe_run_free(r);
+                return 1;
+            }
+            close(fd);
+        }
+
+        const char *const *tmpl = qbe_driver_link;
+        if (qbe_ctx->objonly) {
+            tmpl = qbe_driver_partial;
+        } else if (qbe_ctx->ld) {
+            tmpl = (const char *const *) qbe_ctx->ld;
+        }
+        r->link = qbe_expand(tmpl, output, r->objects, r->count, flags, flags_count);
+    }
+
+    const char *const *as = (const char *const *) qbe_ctx->as;
+    if (!as) {
+        as = qbe_ctx->objonly || link ? qbe_driver_object : qbe_driver;
+    }
+
+    int code = 0;
+    for (size_t i = 0; i < r->count && !code; i++) {
+        char *const in[] = {"-"};
+        char      **cmd = qbe_expand(as, link ? r->objects[i] : output, in, 1, flags, flags_count);
 
-    QbeSV program = qbe_get_compiled_program(q);
-    FILE *qbe_input = fmemopen((void *) program.data, program.count, "r");
-    if (!qbe_input) {
+        // The pipe must not leak into the assemblers of concurrent generations, otherwise they can
+        // end up waiting on each other for end of input
+        int pipefd[2];
+#ifdef __linux__
+        code = pipe2(pipefd, O_CLOEXEC) < 0;
+#else
+        code = pipe(pipefd) < 0;
+        if (!code) {
+            fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+            fcntl(pipefd[1], F_SETFD, FD_CLOEXEC);
+        }
+#endif
+
+        if (!code) {
+            r->pids[i] = qbe_spawn(cmd, pipefd[0]);
+            close(pipefd[0]);
+            if (!r->pids[i]) {
+                close(pipefd[1]);
+                code = 127; // Same as a child that failed to execute the toolchain
+            } else if (!(r->files[i] = fdopen(pipefd[1], "w"))) {
+                close(pipefd[1]);
+                code = 1;
+            }
+        }
+        qbe_cmd_free(cmd);
+    }
+
+    if (code) {
+        // Whatever was started sees the end of its input right away
+        for (size_t i = 0; i < r->count; i++) {
+            if (r->files[i]) {
+                fclose(r->files[i]);
+            }
+            if (r->pids[i]) {
+                waitpid(r->pids[i], NULL, 0);
+            }
+        }
+        qbe_run_free(r);
+        return code;
+    }
+
+    qbe_ctx->run = r;
+    qbe_ctx->outf = r->files[0];
+    qbe_ctx->shared = r->count > 1;
+    return 0;
+}
+
+// Finishes the assembly of the output and hands it over to the toolchain
+static Run *qbe_run_close(void) {
+    Run *r = qbe_ctx->run;
+    if (!dbg) {
+        for (size_t i = 0; i < r->count; i++) {
+            qbe_T.emitfin(r->files[i]);
+        }
+    }
+    qbe_emit_resetall();
+
+    signal(SIGPIPE, SIG_IGN);
+    for (size_t i = 0; i < r->count; i++) {
+        fclose(r->files[i]);
+        r->files[i] = NULL;
+    }
+    qbe_ctx->outf = NULL;
+    qbe_ctx->run = NULL;
+    qbe_ctx->shared = 0;
+    return r;
+}
+
+// Finishes the assembly and hands it over to the toolchain, which is left running in the background.
+// The context is ready for the next generation afterwards
+static Run *qbe_generate_close(void) {
+    Run *r = qbe_run_close();
+    qbe_cachesweep();
+    qbe_util_resetall();
+    return r;
+}
+
+static int qbe_generate_wait(bool failed) {
+    Run *r = qbe_generate_close();
+    if (failed) {
+        r->code = 1;
+    }
+    return qbe_run_wait(r);
+}
+
+// The textual IL is only kept around for debugging, so go through the parser if the user asked for it,
+// otherwise lower the builder graph directly. The lowering must have been started already
+static bool qbe_generate_program(Qbe *q, void dbgfile(char *), void data(Dat *), void func(Fn *)) {
+    if (qbe_has_been_compiled(q)) {
+        QbeSV program = qbe_get_compiled_program(q);
+        FILE *qbe_input = fmemopen((void *) program.data, program.count, "r");
+        if (!qbe_input) {
+            return false;
+        }
+        qbe_parse(qbe_input, "<libqbe>", dbgfile, data, func);
+        fclose(qbe_input);
+    } else {
+        qbe_lower_end(q, dbgfile, data, func);
+        qbe_lower_free(q);
+    }
+    return true;
+}
+
+// The backend state lives in the context of the QBE context being generated, which is installed for
+// the calling thread only for the duration of each entry point
+int qbe_generate_begin(Qbe *q, QbeTarget target, const char *output, const char **flags, size_t flags_count) {
+    Ctx *prev = qbe_ctx;
+    qbe_ctx = qbe_ctx_of(q);
+
+    const int code = qbe_generate_spawn(target, output, flags, flags_count);
+    if (!code && !qbe_has_been_compiled(q)) {
+        qbe_lower_begin(q);
+    }
+
+    qbe_ctx = prev;
+    return code;
+}
+
+void qbe_fn_finish(Qbe *q, QbeFn *fn) {
+    Ctx *prev = qbe_ctx;
+    qbe_ctx = qbe_ctx_of(q);
+    assert(qbe_ctx->run && "No generation is in progress for this QBE context");
+    assert(!qbe_has_been_compiled(q) && "This QBE context is already compiled");
+
+    qbe_lower_finish(q, fn, dbgfile, func);
+    qbe_ctx = prev;
+}
+
+int qbe_generate_end(Qbe *q) {
+    Ctx *prev = qbe_ctx;
+    qbe_ctx = qbe_ctx_of(q);
+    assert(qbe_ctx->run && "No generation is in progress for this QBE context");
+
+    const int code = qbe_generate_wait(!qbe_generate_program(q, dbgfile, data, func));
+    qbe_ctx = prev;
+    return code;
+}
+
+int qbe_generate_binary(QbeSV program, QbeTarget target, const char *output, const char **flags, size_t flags_count) {
+    if (!qbe_bincheck((void *) program.data, program.count)) {
         return 1;
     }
 
-    qbe_parse(qbe_input, "<libqbe>", dbgfile, data, func);
+    Ctx *prev = qbe_ctx;
+    qbe_ctx = qbe_ctxnew(NULL);
+
+    int code = qbe_generate_spawn(target, output, flags, flags_count);
+    if (!code) {
+        qbe_parsebin((void *) program.data, program.count, dbgfile, data, func);
+        code = qbe_generate_wait(false);
+    }
+
+    qbe_ctxfree(qbe_ctx);
+    qbe_ctx = prev;
+    return code;
+}
+
+int qbe_generate(Qbe *q, QbeTarget target, const char *output, const char **flags, size_t flags_count) {
+    const int code = qbe_generate_begin(q, target, output, flags, flags_count);
+    if (code) {
+        return code;
+    }
+
+    return qbe_generate_end(q);
+}
+
+// Asynchronous generation
+//
+// The toolchains in flight are tracked globally, oldest first, so that going over the limit can
+// reap the oldest one on behalf of whoever owns it. A toolchain is only ever waited on by a single
+// thread, which is marked in its handle, and everyone else waits for the condition instead. Every
+// shard counts as a child of its own
+struct QbeAsync {
+    Run      *run;
+    size_t    slots;
+    int       code;
+    bool      done;
+    bool      reaping;
+    QbeAsync *next;
+};
+
+static pthread_mutex_t qbe_async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  qbe_async_cond = PTHREAD_COND_INITIALIZER;
+static QbeAsync       *qbe_async_head;
+static size_t          qbe_async_count; // Including the ones still being generated
+static size_t          qbe_async_limit;
+
+// Records the exit of one of the children, the handle is done once the whole toolchain is
+static void qbe_async_exited(QbeAsync *a, size_t i, int status) {
+    a->reaping = false;
+    pthread_cond_broadcast(&qbe_async_cond);
+    if (!qbe_run_exited(a->run, i, status)) {
+        return;
+    }
+
+    a->code = a->run->code;
+    a->done = true;
+    qbe_run_free(a->run);
+    a->run = NULL;
+    for (QbeAsync **it = &qbe_async_head; *it; it = &(*it)->next) {
+        if (*it == a) {
+            *it = a->next;
+            break;
+        }
+    }
+    qbe_async_count -= a->slots;
+}
+
+// Waits for one of the children of the handle with the lock held, which is released in the meantime
+static void qbe_async_reap(QbeAsync *a) {
+    size_t i = 0;
+    while (!a->run->pids[i]) {
+        i++;
+    }
+
+    a->reaping = true;
+    pthread_mutex_unlock(&qbe_async_lock);
+
+    int status = 0;
+    if (waitpid(a->run->pids[i], &status, 0) < 0) {
+        status = -1;
+    }
+
+    pthread_mutex_lock(&qbe_async_lock);
+    qbe_async_exited(a, i, status);
+}
+
+static size_t qbe_async_max(void) {
+    if (qbe_async_limit) {
+        return qbe_async_limit;
+    }
+
+    const long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+void qbe_set_async_limit(size_t limit) {
+    pthread_mutex_lock(&qbe_async_lock);
+    qbe_async_limit = limit;
+    pthread_cond_broadcast(&qbe_async_cond);
+    pthread_mutex_unlock(&qbe_async_lock);
+}
+
+QbeAsync *qbe_generate_async(Qbe *q, QbeTarget target, const char *output, const char **flags, size_t flags_count) {
+    QbeAsync *a = calloc(1, sizeof(*a));
+    assert(a && "Out of memory");
+
+    Ctx *prev = qbe_ctx;
+    qbe_ctx = qbe_ctx_of(q);
+    a->slots = qbe_ctx->nshard > 1 ? qbe_ctx->nshard : 1;
+
+    // Make room before spawning, by reaping the oldest toolchain unless someone is already on it. A
+    // generation with more shards than the limit only ever runs on its own
+    pthread_mutex_lock(&qbe_async_lock);
+    while (qbe_async_count && qbe_async_count + a->slots > qbe_async_max()) {
+        QbeAsync *oldest = qbe_async_head;
+        while (oldest && oldest->reaping) {
+            oldest = oldest->next;
+        }
+
+        if (oldest) {
+            qbe_async_reap(oldest);
+        } else {
+            pthread_cond_wait(&qbe_async_cond, &qbe_async_lock);
+        }
+    }
+    qbe_async_count += a->slots;
+    pthread_mutex_unlock(&qbe_async_lock);
+
+    int code = qbe_generate_spawn(target, output, flags, flags_count);
+    if (!code) {
+        if (!qbe_has_been_compiled(q)) {
+            qbe_lower_begin(q);
+        }
+
+        const bool failed = !qbe_generate_program(q, dbgfile, data, func);
+        a->run = qbe_generate_close();
+        if (failed) {
+            a->run->code = 1;
+            code = qbe_run_wait(a->run);
+            a->run = NULL;
+        }
+    }
+    qbe_ctx = prev;
+
+    pthread_mutex_lock(&qbe_async_lock);
+    if (code) {
+        a->code = code;
+        a->done = true;
+        qbe_async_count -= a->slots;
+        pthread_cond_broadcast(&qbe_async_cond);
+    } else {
+        QbeAsync **it = &qbe_async_head;
+        while (*it) {
+            it = &(*it)->next;
+        }
+        *it = a;
+    }
+    pthread_mutex_unlock(&qbe_async_lock);
+    return a;
+}
+
+bool qbe_poll(QbeAsync *a) {
+    pthread_mutex_lock(&qbe_async_lock);
+    for (size_t i = 0; !a->done && !a->reaping && i < a->run->count; i++) {
+        int status = 0;
+        if (a->run->pids[i]) {
+            const pid_t pid = waitpid(a->run->pids[i], &status, WNOHANG);
+            if (pid) {
+                qbe_async_exited(a, i, pid < 0 ? -1 : status);
+                i = -1; // The linker may have taken the first slot
+            }
+        }
+    }
+
+    const bool done = a->done;
+    pthread_mutex_unlock(&qbe_async_lock);
+    return done;
+}
+
+int qbe_wait(QbeAsync *a) {
+    pthread_mutex_lock(&qbe_async_lock);
+    while (!a->done) {
+        if (a->reaping) {
+            pthread_cond_wait(&qbe_async_cond, &qbe_async_lock);
+        } else {
+            qbe_async_reap(a);
+        }
+    }
+    pthread_mutex_unlock(&qbe_async_lock);
+
+    const int code = a->code;
+    free(a);
+    return code;
+}
+
+// Parallel generation
+//
+// The functions are lowered on the calling thread and queued as jobs, and their passes run on a pool
+// of workers. Idle workers take whichever stage is ready next instead of a fixed share of the
+// functions, so a huge function only ever keeps one of them busy. Instruction selection allocates
+// the floating point constants and the emitter numbers the blocks and debug files, so those two
+// stages run on the calling thread in source order, which keeps the output byte-identical to
+// qbe_generate(). Every function carries its own allocation pool between the threads.
+typedef enum {
+    QBE_JOB_TEXT, // Data, already emitted
+    QBE_JOB_DBGFILE,
+    QBE_JOB_FN,
+} QbeJobKind;
+
+typedef enum {
+    QBE_STAGE_FRONT,
+    QBE_STAGE_ISEL,
+    QBE_STAGE_BACK,
+    QBE_STAGE_EMIT,
+    QBE_STAGE_RUNNING,
+} QbeStage;
+
+typedef struct {
+    QbeJobKind kind;
+    QbeStage   stage;
+
+    Fn    *fn;
+    FnPool pool;
+
+    char  *text;
+    size_t size;
+    FILE  *stream;
+} QbeJob;
+
+typedef struct {
+    QbeJob *data;
+    size_t  count;
+    size_t  capacity;
+
+    size_t front; // Next job to claim for the front passes
+    size_t back;  // Next job to claim for the back passes
+    size_t isel;  // Next job for instruction selection
+    size_t emit;  // Next job to emit
+
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    bool            quit;
+
+    Ctx       *main;
+    pthread_t *threads;
+    size_t     threads_count;
+    size_t     threads_wanted;
+} QbeSched;
+
+static _Thread_local QbeSched *qbe_sched;
+
+static QbeJob *qbe_sched_push(QbeSched *s, QbeJobKind kind) {
+    if (s->count && s->data[s->count - 1].stream) {
+        fclose(s->data[s->count - 1].stream);
+        s->data[s->count - 1].stream = NULL;
+    }
+
+    if (s->count >= s->capacity) {
+        s->capacity = s->capacity ? s->capacity * 2 : 128;
+        s->data = realloc(s->data, s->capacity * sizeof(*s->data));
+        assert(s->data);
+    }
+
+    QbeJob *job = &s->data[s->count++];
+    memset(job, 0, sizeof(*job));
+    job->kind = kind;
+    job->stage = kind == QBE_JOB_FN ? QBE_STAGE_FRONT : QBE_STAGE_EMIT;
+    return job;
+}
+
+// Runs one stage of a function with its pool installed in the current context
+static void qbe_sched_stage(QbeStage stage, Fn *fn, FnPool *pool) {
+    const FnPool saved = qbe_ctx->pool;
+    qbe_ctx->pool = *pool;
+
+    switch (stage) {
+    case QBE_STAGE_FRONT:
+        passes_front(fn);
+        break;
+
+    case QBE_STAGE_ISEL:
+        qbe_T.isel(fn);
+        break;
+
+    case QBE_STAGE_BACK:
+        passes_back(fn);
+        break;
+
+    default:
+        assert(0 && "unreachable");
+        break;
+    }
+
+    *pool = qbe_ctx->pool;
+    qbe_ctx->pool = saved;
+}
+
+// Claims and runs one of the passes that can go in any order, with the lock held. Jobs reach the
+// back passes in source order, so claiming those first keeps the emitter fed
+static bool qbe_sched_run(QbeSched *s) {
+    size_t *cursor = NULL;
+    while (s->back < s->isel && s->data[s->back].kind != QBE_JOB_FN) {
+        s->back++;
+    }
+
+    if (s->back < s->isel && s->data[s->back].stage == QBE_STAGE_BACK) {
+        cursor = &s->back;
+    } else {
+        while (s->front < s->count && s->data[s->front].kind != QBE_JOB_FN) {
+            s->front++;
+        }
+
+        if (s->front < s->count) {
+            cursor = &s->front;
+        }
+    }
+
+    if (!cursor) {
+        return false;
+    }
+
+    const size_t   index = (*cursor)++;
+    const QbeStage stage = s->data[index].stage;
+    Fn            *fn = s->data[index].fn;
+    FnPool         pool = s->data[index].pool;
+    s->data[index].stage = QBE_STAGE_RUNNING;
+    pthread_mutex_unlock(&s->lock);
+
+    qbe_sched_stage(stage, fn, &pool);
+
+    pthread_mutex_lock(&s->lock);
+    s->data[index].pool = pool;
+    s->data[index].stage = stage + 1;
+    pthread_cond_broadcast(&s->cond);
+    return true;
+}
+
+static void *qbe_sched_worker(void *arg) {
+    QbeSched *s = arg;
+
+    Ctx *c = qbe_ctxnew(s->main->mem); // The pools are handed over to the main context
+    c->T = s->main->T;
+    c->typ = s->main->typ; // Read only until everything has been generated
+    memcpy(c->debug, s->main->debug, sizeof(c->debug));
+    qbe_ctx = c;
+
+    pthread_mutex_lock(&s->lock);
+    while (!s->quit) {
+        if (!qbe_sched_run(s)) {
+            pthread_cond_wait(&s->cond, &s->lock);
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    qbe_ctx = NULL;
+    qbe_ctxfree(c);
+    return NULL;
+}
+
+static void par_data(Dat *d) {
+    QbeSched *s = qbe_sched;
+
+    pthread_mutex_lock(&s->lock);
+    if (!s->count || !s->data[s->count - 1].stream) {
+        QbeJob *job = qbe_sched_push(s, QBE_JOB_TEXT);
+        job->stream = open_memstream(&job->text, &job->size);
+        if (!job->stream) {
+            die("open_memstream, out of memory");
+        }
+    }
+    FILE *stream = s->data[s->count - 1].stream;
+    pthread_mutex_unlock(&s->lock);
+
+    FILE *out = qbe_ctx->outf;
+    qbe_ctx->outf = stream;
+    emitdat(d);
+    qbe_ctx->outf = out;
+}
+
+static void par_dbgfile(char *fn) {
+    QbeSched *s = qbe_sched;
+
+    pthread_mutex_lock(&s->lock);
+    QbeJob *job = qbe_sched_push(s, QBE_JOB_DBGFILE);
+    job->text = strdup(fn);
+    assert(job->text);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void par_func(Fn *fn) {
+    QbeSched *s = qbe_sched;
+
+    pthread_mutex_lock(&s->lock);
+    QbeJob *job = qbe_sched_push(s, QBE_JOB_FN);
+    job->fn = fn;
+    job->pool = qbe_ctx->pool;
+    qbe_ctx->pool = (FnPool) {0};
+
+    // The types are complete by the time the first function is lowered, so the workers can share them
+    while (s->threads_count < s->threads_wanted) {
+        if (pthread_create(&s->threads[s->threads_count], NULL, qbe_sched_worker, s)) {
+            s->threads_wanted = s->threads_count; // Fewer workers, the calling thread still helps out
+            break;
+        }
+        s->threads_count++;
+    }
+
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+}
+
+// Emits the jobs in order, running instruction selection when it's the next job's turn and helping
+// out with the other passes in the meantime
+static void qbe_sched_drain(QbeSched *s) {
+    pthread_mutex_lock(&s->lock);
+    if (s->count && s->data[s->count - 1].stream) {
+        fclose(s->data[s->count - 1].stream);
+        s->data[s->count - 1].stream = NULL;
+    }
+
+    while (s->emit < s->count) {
+        QbeJob *job = &s->data[s->emit];
+        if (job->stage == QBE_STAGE_EMIT) {
+            QbeJob it = *job;
+            pthread_mutex_unlock(&s->lock);
+
+            switch (it.kind) {
+            case QBE_JOB_TEXT:
+                qbe_shard(it.size / 16);
+                fwrite(it.text, 1, it.size, qbe_ctx->outf);
+                free(it.text);
+                break;
+
+            case QBE_JOB_DBGFILE:
+                dbgfile(it.text);
+                free(it.text);
+                break;
+
+            case QBE_JOB_FN:
+                qbe_ctx->pool = it.pool;
+                qbe_shard_fn(it.fn);
+                emitfn(it.fn);
+                break;
+            }
+
+            pthread_mutex_lock(&s->lock);
+            s->emit++;
+            continue;
+        }
+
+        while (s->isel < s->count && s->data[s->isel].kind != QBE_JOB_FN) {
+            s->isel++;
+        }
+
+        if (s->isel < s->count && s->data[s->isel].stage == QBE_STAGE_ISEL) {
+            const size_t index = s->isel;
+            Fn          *fn = s->data[index].fn;
+            FnPool       pool = s->data[index].pool;
+            s->data[index].stage = QBE_STAGE_RUNNING;
+            pthread_mutex_unlock(&s->lock);
+
+            qbe_sched_stage(QBE_STAGE_ISEL, fn, &pool);
+
+            pthread_mutex_lock(&s->lock);
+            s->data[index].pool = pool;
+            s->data[index].stage = QBE_STAGE_BACK;
+            s->isel++;
+            pthread_cond_broadcast(&s->cond);
+            continue;
+        }
+
+        if (!qbe_sched_run(s)) {
+            pthread_cond_wait(&s->cond, &s->lock);
+        }
+    }
+
+    s->quit = true;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+
+    for (size_t i = 0; i < s->threads_count; i++) {
+        pthread_join(s->threads[i], NULL);
+    }
+}
+
+int qbe_generate_parallel(
+    Qbe *q, QbeTarget target, const char *output, const char **flags, size_t flags_count, size_t nthreads) {
+    // The parser defines the types as it goes, which the workers could not share
+    if (qbe_has_been_compiled(q) || nthreads == 1) {
+        return qbe_generate(q, target, output, flags, flags_count);
+    }
+
+    if (!nthreads) {
+        const long n = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = n > 0 ? n : 1;
+    }
+
+    const int code = qbe_generate_begin(q, target, output, flags, flags_count);
+    if (code) {
+        return code;
+    }
+
+    Ctx *prev = qbe_ctx;
+    qbe_ctx = qbe_ctx_of(q);
+
+    // The calling thread is one of the workers
+    QbeSched s = {
+        .main = qbe_ctx,
+        .threads = malloc((nthreads - 1) * sizeof(pthread_t)),
+        .threads_wanted = nthreads - 1,
+    };
+    assert(s.threads);
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.cond, NULL);
+
+    qbe_sched = &s;
+    qbe_lower_end(q, par_dbgfile, par_data, par_func);
+    qbe_sched_drain(&s);
+    qbe_sched = NULL;
+    qbe_lower_free(q);
+
+    pthread_cond_destroy(&s.cond);
+    pthread_mutex_destroy(&s.lock);
+    free(s.threads);
+    free(s.data);
+
+    const int result = qbe_generate_wait(false);
+    qbe_ctx = prev;
+    return result;
+}
+
+// Multiple outputs
+//
+// The program is parsed or lowered once, and every function goes through the target independent
+// passes once per variant of abi0, which only differs on arm64 macOS. Each output then lowers its own
+// copy for its target. Everything that the emission of an output depends on is swapped in around it
+struct Out {
+    Target    T;
+    FILE     *outf;
+    Run      *run;
+    int       shared;
+    uint      curfile;
+    uint32_t *file;
+    uint      nfile;
+    Stash     stash;
+    int64_t   zero;
+    int       id0;
+};
+
+static void qbe_out_swap(Out *o) {
+    const Out t = {
+        .T = qbe_ctx->T,
+        .outf = qbe_ctx->outf,
+        .run = qbe_ctx->run,
+        .shared = qbe_ctx->shared,
+        .curfile = qbe_ctx->curfile,
+        .file = qbe_ctx->file,
+        .nfile = qbe_ctx->nfile,
+        .stash = qbe_ctx->stash,
+        .zero = qbe_ctx->zero,
+        .id0 = qbe_ctx->id0,
+    };
+
+    qbe_ctx->T = o->T;
+    qbe_ctx->outf = o->outf;
+    qbe_ctx->run = o->run;
+    qbe_ctx->shared = o->shared;
+    qbe_ctx->curfile = o->curfile;
+    qbe_ctx->file = o->file;
+    qbe_ctx->nfile = o->nfile;
+    qbe_ctx->stash = o->stash;
+    qbe_ctx->zero = o->zero;
+    qbe_ctx->id0 = o->id0;
+    *o = t;
+}
+
+static void many_dbgfile(char *fn) {
+    for (uint i = 0; i < qbe_ctx->nout; i++) {
+        qbe_out_swap(&qbe_ctx->out[i]);
+        dbgfile(fn);
+        qbe_out_swap(&qbe_ctx->out[i]);
+    }
+}
+
+// The data is freed at its end, so all the outputs but the last emit it from a pool of their own
+static void many_data(Dat *d) {
+    const uint last = qbe_ctx->nout - 1;
+    for (uint i = 0; i < last; i++) {
+        const FnPool pool = qbe_ctx->pool;
+        qbe_ctx->pool = (FnPool) {0};
+
+        qbe_out_swap(&qbe_ctx->out[i]);
+        data(d);
+        qbe_out_swap(&qbe_ctx->out[i]);
+
+        qbe_freeall();
+        qbe_ctx->pool = pool;
+    }
+
+    qbe_out_swap(&qbe_ctx->out[last]);
+    data(d);
+    qbe_out_swap(&qbe_ctx->out[last]);
+}
+
+static void many_func(Fn *fn) {
+    Out       *out = qbe_ctx->out;
+    const uint last = qbe_ctx->nout - 1;
+
+    // The shards are balanced on the function as it comes in, like qbe_generate() does
+    for (uint i = 0; i <= last; i++) {
+        qbe_out_swap(&out[i]);
+        qbe_shard_fn(fn);
+        qbe_out_swap(&out[i]);
+    }
+
+    // The first output of every variant of abi0 runs the generic passes on behalf of the rest. The
+    // variant of the last output gets the function itself, so every copy is taken before it changes
+    Fn **generic = qbe_alloc((last + 1) * sizeof(*generic));
+    for (uint i = 0; i <= last; i++) {
+        for (uint j = 0; j < i && !generic[i]; j++) {
+            if (out[j].T.abi0 == out[i].T.abi0) {
+                generic[i] = generic[j];
+            }
+        }
+
+        if (!generic[i]) {
+            generic[i] = out[i].T.abi0 == out[last].T.abi0 ? fn : qbe_fncopy(fn);
+        }
+    }
+
+    for (uint i = 0; i <= last; i++) {
+        bool first = true;
+        for (uint j = 0; j < i; j++) {
+            first = first && generic[j] != generic[i];
+        }
+
+        if (first) {
+            qbe_out_swap(&out[i]);
+            passes_generic(generic[i]);
+            qbe_out_swap(&out[i]);
+        }
+    }
+
+    // All the outputs but the last lower a copy in a pool of their own, which the emission frees
+    for (uint i = 0; i <= last; i++) {
+        const FnPool pool = qbe_ctx->pool;
+        qbe_out_swap(&out[i]);
+
+        Fn *f = generic[i];
+        if (i != last) {
+            qbe_ctx->pool = (FnPool) {0};
+            f = qbe_fncopy(f);
+            qbe_fillrpo(f);
+            qbe_fillpreds(f);
+            qbe_filluse(f);
+        }
+
+        qbe_T.abi1(f);
+        qbe_simpl(f);
+        qbe_fillpreds(f);
+        qbe_filluse(f);
+        qbe_T.isel(f);
+        passes_back(f);
+        emitfn(f);
+
+        qbe_out_swap(&out[i]);
+        if (i != last) {
+            qbe_ctx->pool = pool;
+        }
+    }
+}
+
+int qbe_generate_many(Qbe *q, const QbeOutput *outputs, size_t outputs_count) {
+    if (!outputs_count) {
+        return 0;
+    }
+
+    Ctx *prev = qbe_ctx;
+    qbe_ctx = qbe_ctx_of(q);
+    assert(!qbe_ctx->run && "Another generation is already in progress for this QBE context");
+
+    Out *out = calloc(outputs_count, sizeof(*out));
+    assert(out && "Out of memory");
+
+    int code = 0;
+    for (size_t i = 0; i < outputs_count && !code; i++) {
+        const QbeOutput *o = &outputs[i];
+        qbe_out_swap(&out[i]);
+        code = qbe_generate_spawn(o->target, o->output, o->flags, o->flags_count);
+        qbe_out_swap(&out[i]);
+
+        if (code) {
+            for (size_t j = 0; j < i; j++) {
+                qbe_out_swap(&out[j]);
+                Run *r = qbe_run_close();
+                qbe_out_swap(&out[j]);
+                r->code = 1;
+                qbe_run_wait(r);
+            }
+        }
+    }
+
+    if (code) {
+        free(out);
+        qbe_ctx = prev;
+        return code;
+    }
+
+    // The functions come out of the lowering and the parser with the registers of the first target,
+    // which the copies for the other targets replace
+    qbe_target_select(outputs[0].target);
+    qbe_ctx->out = out;
+    qbe_ctx->nout = outputs_count;
+    if (!qbe_has_been_compiled(q)) {
+        qbe_lower_begin(q);
+    }
+
+    const bool failed = !qbe_generate_program(q, many_dbgfile, many_data, many_func);
+    qbe_ctx->out = NULL;
+    qbe_ctx->nout = 0;
+
+    Run **runs = malloc(outputs_count * sizeof(*runs));
+    assert(runs && "Out of memory");
+    for (size_t i = 0; i < outputs_count; i++) {
+        qbe_out_swap(&out[i]);
+        runs[i] = qbe_run_close();
+        qbe_out_swap(&out[i]);
+    }
+    qbe_util_resetall();
+
+    // All the toolchains run at the same time
+    for (size_t i = 0; i < outputs_count; i++) {
+        if (failed) {
+            runs[i]->code = 1;
+        }
+
+        const int result = qbe_run_wait(runs[i]);
+        if (!code) {
+            code = result;
+        }
+    }
+
+    free(runs);
+    free(out);
+    qbe_ctx = prev;
+    return code;
+}
+
+// Cache
+void qbe_set_cache_dir(Qbe *q, const char *dir) {
+    Ctx *prev = qbe_ctx;
+    qbe_ctx = qbe_ctx_of(q);
+    qbe_cachedir((char *) dir);
+    qbe_ctx = prev;
+}
+
+void qbe_set_incremental(Qbe *q, bool enabled) {
+    Ctx *prev = qbe_ctx;
+    qbe_ctx = qbe_ctx_of(q);
+    qbe_cachemem(enabled);
+    qbe_ctx = prev;
+}
+
+void qbe_get_cache_stats(Qbe *q, size_t *hits, size_t *misses) {
+    Ctx *prev = qbe_ctx;
+    qbe_ctx = qbe_ctx_of(q);
+    qbe_cachestats(hits, misses);
+    qbe_ctx = prev;
+}
+
+// Toolchain
+void qbe_set_toolchain(Qbe *q, const char **assembler, const char **linker) {
+    Ctx *c = qbe_ctx_of(q);
+    qbe_cmd_free(c->as);
+    qbe_cmd_free(c->ld);
+    c->as = qbe_cmd_copy(assembler);
+    c->ld = qbe_cmd_copy(linker);
+}
+
+void qbe_set_object_only(Qbe *q, bool enabled) {
+    qbe_ctx_of(q)->objonly = enabled;
+}
+
+void qbe_set_shards(Qbe *q, size_t count) {
+    qbe_ctx_of(q)->nshard = count;
+}
+
+// Assembly
+int qbe_generate_asm_file(Qbe *q, QbeTarget target, FILE *f) {
+    Ctx *prev = qbe_ctx;
+    qbe_ctx = qbe_ctx_of(q);
+    assert(!qbe_ctx->run && "Another generation is already in progress for this QBE context");
+
+    qbe_target_select(target);
+    qbe_ctx->outf = f;
+    if (!qbe_has_been_compiled(q)) {
+        qbe_lower_begin(q);
+    }
+
+    bool failed = !qbe_generate_program(q, dbgfile, data, func);
     if (!dbg) {
-        qbe_T.emitfin(qbe_output);
+        qbe_T.emitfin(f);
     }
 
+    qbe_cachesweep();
     qbe_util_resetall();
     qbe_emit_resetall();
+    qbe_ctx->outf = NULL;
 
-    signal(SIGPIPE, SIG_IGN);
-    fclose(qbe_input);
-    fclose(qbe_output);
+    failed |= fflush(f) != 0 || ferror(f);
+    qbe_ctx = prev;
+    return failed;
+}
 
-    int status = 0;
-    if (waitpid(pid, &status, 0) < 0) {
+int qbe_generate_asm(Qbe *q, QbeTarget target, QbeSV *out) {
+    Ctx *c = qbe_ctx_of(q);
+    free(c->asmbuf);
+    c->asmbuf = NULL;
+    c->asmlen = 0;
+    *out = (QbeSV) {0};
+
+    FILE *f = open_memstream(&c->asmbuf, &c->asmlen);
+    if (!f) {
         return 1;
     }
 
-    if (WIFSIGNALED(status)) {
-        return 128 + WTERMSIG(status);
+    // The backend writes in small pieces, so let them reach the buffer in large ones
+    setvbuf(f, NULL, _IOFBF, 1 << 16);
+
+    int failed = qbe_generate_asm_file(q, target, f);
+    failed |= fclose(f) != 0;
+    *out = (QbeSV) {.data = c->asmbuf, .count = c->asmlen};
+    return failed;
+}
+
+// Objects
+//
+// The machine code is encoded straight from the backend, so there is no assembler in the way. The
+// whole object is kept in memory until it's written
+static bool qbe_object_build(Qbe *q) {
+    qbe_objnew();
+    if (!qbe_has_been_compiled(q)) {
+        qbe_lower_begin(q);
     }
+    if (!qbe_generate_program(q, dbgfile, data, func)) {
+        return false;
+    }
+    qbe_elf_objfin();
+    return true;
+}
 
-    return WEXITSTATUS(status);
+static void qbe_object_free(void) {
+    qbe_freeall();
+    qbe_objfree();
+    qbe_util_resetall();
+    qbe_emit_resetall();
+}
+
+int qbe_generate_object(Qbe *q, QbeTarget target, const char *output) {
+    Ctx *prev = qbe_ctx;
+    qbe_ctx = qbe_ctx_of(q);
+    assert(!qbe_ctx->run && "Another generation is already in progress for this QBE context");
+
+    qbe_target_select(target);
+    if (!qbe_T.encodefn) {
+        qbe_ctx = prev;
+        return 1;
+    }
+
+    FILE *f = fopen(output, "wb");
+    if (!f) {
+        qbe_ctx = prev;
+        return 1;
+    }
+
+    bool failed = !qbe_object_build(q) || qbe_elf_objwrite(f);
+    failed |= fclose(f) != 0;
+    qbe_object_free();
+
+    if (failed) {
+        remove(output);
+    }
+
+    qbe_ctx = prev;
+    return failed;
+}
+
+// Server
+//
+// Generates a program received by a worker of qbe_serve(), in either form, into its assembly or an
+// object. The context of the worker is the current one, and is kept warm across the requests
+int qbe_generate_request(void *program, size_t count, int target, int object, FILE *f) {
+    if (target < QBE_TARGET_DEFAULT || target > QBE_TARGET_RV64_LINUX) {
+        return 1;
+    }
+
+    qbe_target_select(target);
+    if (object && !qbe_T.encodefn) {
+        return 1;
+    }
+
+    // A binary program of another version is rejected here, rather than parsed as text
+    const bool binary = count >= 4 && !memcmp(program, BinMagic, 4);
+    if (binary && !qbe_bincheck(program, count)) {
+        return 1;
+    }
+
+    if (object) {
+        qbe_objnew();
+    } else {
+        qbe_ctx->outf = f;
+    }
+
+    bool ok = true;
+    if (binary) {
+        qbe_parsebin(program, count, dbgfile, data, func);
+    } else {
+        FILE *in = fmemopen(program, count, "r");
+        ok = in != NULL;
+        if (ok) {
+            qbe_parse(in, "<request>", dbgfile, data, func);
+            fclose(in);
+        }
+    }
+
+    if (object) {
+        if (ok) {
+            qbe_elf_objfin();
+            ok = !qbe_elf_objwrite(f);
+        }
+        qbe_object_free();
+    } else {
+        if (ok && !dbg) {
+            qbe_T.emitfin(f);
+        }
+        qbe_cachesweep();
+        qbe_util_resetall();
+        qbe_emit_resetall();
+        qbe_ctx->outf = NULL;
+    }
+
+    return !ok || fflush(f) != 0 || ferror(f);
+}
+
+// JIT
+//
+// The same object as qbe_generate_object(), loaded into the current process instead of written
+QbeJit *qbe_jit(Qbe *q) {
+    return qbe_jit_with_resolver(q, NULL, NULL);
+}
+
+QbeJit *qbe_jit_with_resolver(Qbe *q, QbeJitResolver resolver, void *user) {
+#ifdef __x86_64__
+    Ctx *prev = qbe_ctx;
+    qbe_ctx = qbe_ctx_of(q);
+    assert(!qbe_ctx->run && "Another generation is already in progress for this QBE context");
+
+    qbe_target_select(QBE_TARGET_X86_64_LINUX);
+
+    Image *image = NULL;
+    if (qbe_object_build(q)) {
+        image = qbe_objload(resolver, user);
+    }
+    qbe_object_free();
+
+    qbe_ctx = prev;
+    return (QbeJit *) image;
+#else
+    (void) q;
+    (void) resolver;
+    (void) user;
+    return NULL;
+#endif
+}
+
+void *qbe_jit_lookup(QbeJit *jit, const char *name) {
+    return qbe_imagesym((Image *) jit, (char *) name);
+}
+
+void qbe_jit_free(QbeJit *jit) {
+    if (jit) {
+        qbe_imagefree((Image *) jit);
+    }
 }
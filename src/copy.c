@@ -225,5 +225,5 @@ qbe_copy(Fn *fn)
 		qbe_printfn(fn, stderr);
 	}
 	qbe_vfree(stk);
-	free(cpy);
+	qbe_memfree(cpy); // @shoumodip
 }
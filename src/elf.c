@@ -0,0 +1,687 @@
+// @shoumodip: Relocatable object writer for qbe_generate_object()
+//
+// The object is built in memory: the targets encode their functions into
+// the sections through the functions below, the data goes through
+// qbe_objdat() which mirrors qbe_emitdat(), and the whole thing is written
+// out as an ELF file at the end. Relocations are only resolved when writing,
+// once every symbol is known, the same way the assembler does it.
+#include <ctype.h>
+
+#include "all.h"
+
+enum {
+	EShdr = 64,
+	ESym  = 24,
+	ERela = 24,
+
+	ShProgbits = 1,
+	ShSymtab   = 2,
+	ShStrtab   = 3,
+	ShRela     = 4,
+	ShNobits   = 8,
+
+	ShfWrite = 0x1,
+	ShfAlloc = 0x2,
+	ShfExec  = 0x4,
+	ShfInfo  = 0x40,
+	ShfTls   = 0x400,
+
+	SttNotype  = 0,
+	SttFunc    = 2,
+	SttSection = 3,
+	SttTls     = 6,
+};
+
+/* R_X86_64_*, the only machine for now */
+static int reltype[] = {
+	[RelAbs64]   = 1,
+	[RelPc32]    = 2,
+	[RelAbs32]   = 10,
+	[RelAbs32S]  = 11,
+	[RelTpoff32] = 23,
+	[RelPlt32]   = 4,
+};
+
+/* decodes a string literal the way the assembler
+ * does, returns the number of bytes written */
+static size_t
+unquote(char *s, char *out)
+{
+	char *o;
+	int c, n;
+
+	assert(*s == '"');
+	for (o=out, s++; *s && *s != '"'; o++) {
+		if (*s != '\\') {
+			*o = *s++;
+			continue;
+		}
+		switch ((c = *++s)) {
+		case 'b': *o = '\b'; s++; break;
+		case 'f': *o = '\f'; s++; break;
+		case 'n': *o = '\n'; s++; break;
+		case 'r': *o = '\r'; s++; break;
+		case 't': *o = '\t'; s++; break;
+		case 'x':
+		case 'X':
+			for (c=0, s++; isxdigit((uchar)*s); s++)
+				c = c*16 + (isdigit((uchar)*s) ? *s-'0' : (*s|32)-'a'+10);
+			*o = c;
+			break;
+		default:
+			if ('0' <= c && c <= '7') {
+				for (c=0, n=0; n<3 && '0' <= *s && *s <= '7'; n++, s++)
+					c = c*8 + *s-'0';
+				*o = c;
+			} else if (c) {
+				*o = c;
+				s++;
+			} else
+				o--;
+		}
+	}
+	return o - out;
+}
+
+static uint32_t
+symid(char *name)
+{
+	char buf[NString*4];
+	size_t n;
+
+	if (*name == '$')
+		name++;
+	if (*name != '"')
+		return qbe_intern(name);
+	if (strlen(name) >= sizeof buf)
+		qbe_err("symbol name too long");
+	n = unquote(name, buf);
+	buf[n] = 0;
+	return qbe_intern(buf);
+}
+
+void
+qbe_objnew(void)
+{
+	Obj *o;
+
+	o = qbe_emalloc(sizeof *o);
+	o->sec = qbe_vnew(0, sizeof o->sec[0], PHeap);
+	o->sym = qbe_vnew(0, sizeof o->sym[0], PHeap);
+	o->nsymh = 256;
+	o->symh = qbe_emalloc(o->nsymh * sizeof o->symh[0]);
+	memset(o->symh, 0xff, o->nsymh * sizeof o->symh[0]);
+	o->cur = -1;
+	qbe_ctx->obj = o;
+}
+
+void
+qbe_objfree(void)
+{
+	Obj *o;
+	uint n;
+
+	o = qbe_ctx->obj;
+	if (!o)
+		return;
+	for (n=0; n<o->nsec; n++) {
+		qbe_memfree(o->sec[n].data); // @shoumodip
+		qbe_memfree(o->sec[n].rel); // @shoumodip
+	}
+	qbe_vfree(o->sec);
+	qbe_vfree(o->sym);
+	qbe_memfree(o->symh); // @shoumodip
+	qbe_memfree(o); // @shoumodip
+	qbe_ctx->obj = 0;
+}
+
+int
+qbe_objsym(char *name)
+{
+	Obj *o;
+	ObjSym *s;
+	uint32_t id;
+	uint h, n, *oh;
+
+	o = qbe_ctx->obj;
+	id = symid(name);
+	for (h=id*0x9e3779b1;; h++) {
+		h &= o->nsymh-1;
+		if (o->symh[h] == -1u)
+			break;
+		if (o->sym[o->symh[h]].id == id)
+			return o->symh[h];
+	}
+	qbe_vgrow(&o->sym, o->nsym+1);
+	s = &o->sym[o->nsym];
+	memset(s, 0, sizeof *s);
+	s->id = id;
+	s->sec = -1;
+	o->symh[h] = o->nsym;
+	if (2 * ++o->nsym > o->nsymh) {
+		oh = o->symh;
+		o->nsymh *= 2;
+		o->symh = qbe_emalloc(o->nsymh * sizeof o->symh[0]);
+		memset(o->symh, 0xff, o->nsymh * sizeof o->symh[0]);
+		for (n=0; n<o->nsym; n++) {
+			for (h=o->sym[n].id*0x9e3779b1;; h++) {
+				h &= o->nsymh-1;
+				if (o->symh[h] == -1u)
+					break;
+			}
+			o->symh[h] = n;
+		}
+		qbe_memfree(oh); // @shoumodip
+	}
+	return o->nsym-1;
+}
+
+void
+qbe_objsec(char *name, char *flags)
+{
+	Obj *o;
+	ObjSec *s;
+	uint n;
+	int f;
+
+	o = qbe_ctx->obj;
+	for (n=0; n<o->nsec; n++)
+		if (strcmp(o->sec[n].name, name) == 0) {
+			o->cur = n;
+			return;
+		}
+	if (flags) {
+		f = 0;
+		for (; *flags; flags++)
+			switch (*flags) {
+			case 'w': f |= ObjWrite; break;
+			case 'x': f |= ObjExec; break;
+			case 'T': f |= ObjTls; break;
+			}
+	} else if (strncmp(name, ".text", 5) == 0)
+		f = ObjExec;
+	else if (strncmp(name, ".rodata", 7) == 0)
+		f = 0;
+	else if (strncmp(name, ".tbss", 5) == 0)
+		f = ObjWrite | ObjTls | ObjNobits;
+	else if (strncmp(name, ".tdata", 6) == 0)
+		f = ObjWrite | ObjTls;
+	else if (strncmp(name, ".bss", 4) == 0)
+		f = ObjWrite | ObjNobits;
+	else
+		f = ObjWrite;
+	qbe_vgrow(&o->sec, o->nsec+1);
+	s = &o->sec[o->nsec];
+	memset(s, 0, sizeof *s);
+	s->name = qbe_str(qbe_intern(name));
+	s->flags = f;
+	s->align = 1;
+	o->cur = o->nsec++;
+}
+
+uint64_t
+qbe_objpos(void)
+{
+	return qbe_ctx->obj->sec[qbe_ctx->obj->cur].size;
+}
+
+void
+qbe_objbytes(void *p, uint64_t n)
+{
+	ObjSec *s;
+
+	s = &qbe_ctx->obj->sec[qbe_ctx->obj->cur];
+	if (s->flags & ObjNobits) {
+		if (p)
+			qbe_err("initialized data in section %s", s->name);
+		s->size += n;
+		return;
+	}
+	if (n == 0)
+		return;
+	if (s->size + n > s->cap) {
+		s->cap = s->cap ? s->cap : 256;
+		while (s->cap < s->size + n)
+			s->cap *= 2;
+		s->data = qbe_erealloc(s->data, s->cap); // @shoumodip
+	}
+	if (p)
+		memcpy(&s->data[s->size], p, n);
+	else
+		memset(&s->data[s->size], s->flags & ObjExec ? 0x90 : 0, n);
+	s->size += n;
+}
+
+void
+qbe_objalign(int align)
+{
+	ObjSec *s;
+
+	s = &qbe_ctx->obj->sec[qbe_ctx->obj->cur];
+	if (align > s->align)
+		s->align = align;
+	qbe_objbytes(0, -s->size & (align-1));
+}
+
+void
+qbe_objrel(uint64_t off, int type, int sym, int64_t add)
+{
+	Obj *o;
+	ObjSec *s;
+
+	o = qbe_ctx->obj;
+	s = &o->sec[o->cur];
+	if ((s->nrel & (s->nrel-1)) == 0) {
+		s->rel = qbe_erealloc(s->rel, (s->nrel ? 2*s->nrel : 1) * sizeof s->rel[0]); // @shoumodip
+	}
+	s->rel[s->nrel++] = (ObjRel){off, type, sym, add};
+	if (type == RelTpoff32)
+		o->sym[sym].tls = 1;
+}
+
+void
+qbe_objlabel(char *name, int global)
+{
+	Obj *o;
+	ObjSym *s;
+	int n;
+
+	o = qbe_ctx->obj;
+	n = qbe_objsym(name);
+	s = &o->sym[n];
+	if (s->sec != -1)
+		qbe_err("symbol %s is already defined", name);
+	s->sec = o->cur;
+	s->off = qbe_objpos();
+	s->global = global;
+	s->tls = (o->sec[o->cur].flags & ObjTls) != 0;
+}
+
+static void
+objlnk(char *n, Lnk *l, char *sec)
+{
+	char *p;
+
+	if (l->sec) {
+		p = l->secf;
+		if (p && *p == '"') {
+			p = qbe_alloc(strlen(p));
+			p[unquote(l->secf, p)] = 0;
+		}
+		qbe_objsec(l->sec, p);
+	} else
+		qbe_objsec(sec, 0);
+	if (l->align)
+		qbe_objalign(l->align);
+	qbe_objlabel(n, l->export);
+}
+
+void
+qbe_objfnlnk(char *n, Lnk *l)
+{
+	objlnk(n, l, ".text");
+}
+
+void
+qbe_objfnfin(char *n)
+{
+	ObjSym *s;
+	int i;
+
+	i = qbe_objsym(n);
+	s = &qbe_ctx->obj->sym[i];
+	s->func = 1;
+	s->size = qbe_objpos() - s->off;
+}
+
+void
+qbe_objdat(Dat *d)
+{
+	static char *sec[2][2] = {
+		{".data", ".bss"},
+		{".tdata", ".tbss"},
+	};
+	char *s;
+	size_t n;
+	int64_t v;
+	int w;
+
+	switch (d->type) {
+	case DStart:
+		qbe_ctx->zero = 0;
+		break;
+	case DEnd:
+		if (qbe_ctx->zero != -1) {
+			objlnk(d->name, d->lnk, sec[d->lnk->thread != 0][1]);
+			qbe_objbytes(0, qbe_ctx->zero);
+		}
+		break;
+	case DZ:
+		if (qbe_ctx->zero != -1)
+			qbe_ctx->zero += d->u.num;
+		else
+			qbe_objbytes(0, d->u.num);
+		break;
+	default:
+		if (qbe_ctx->zero != -1) {
+			objlnk(d->name, d->lnk, sec[d->lnk->thread != 0][0]);
+			if (qbe_ctx->zero > 0)
+				qbe_objbytes(0, qbe_ctx->zero);
+			qbe_ctx->zero = -1;
+		}
+		w = 1 << (d->type - DB);
+		if (d->isstr) {
+			if (d->type != DB)
+				qbe_err("strings only supported for 'b' currently");
+			s = qbe_alloc(strlen(d->u.str));
+			n = unquote(d->u.str, s);
+			qbe_objbytes(s, n);
+			break;
+		}
+		v = d->u.num;
+		if (d->isref) {
+			if (w < 4)
+				qbe_err("references only supported for 'w' and 'l'");
+			qbe_objrel(qbe_objpos(), w == 8 ? RelAbs64 : RelAbs32,
+				qbe_objsym(d->u.ref.name), d->u.ref.off);
+			v = 0;
+		}
+		qbe_objle(v, w);
+		break;
+	}
+}
+
+void
+qbe_objle(int64_t v, int n)
+{
+	uchar b[8];
+	int i;
+
+	for (i=0; i<n; i++, v>>=8)
+		b[i] = v;
+	qbe_objbytes(b, n);
+}
+
+/* ELF writer */
+
+static void
+put(uchar *p, uint64_t v, int n)
+{
+	while (n--) {
+		*p++ = v;
+		v >>= 8;
+	}
+}
+
+typedef struct Strtab Strtab;
+
+struct Strtab {
+	char *s;
+	uint n;
+};
+
+static uint
+addstr(Strtab *t, char *s)
+{
+	uint n, off;
+
+	n = strlen(s) + 1;
+	qbe_vgrow(&t->s, t->n + n);
+	memcpy(&t->s[t->n], s, n);
+	off = t->n;
+	t->n += n;
+	return off;
+}
+
+
+static void
+pad(FILE *f, uint64_t *off, int align)
+{
+	for (; *off & (align-1); (*off)++)
+		fputc(0, f);
+}
+
+static void
+shdr(FILE *f, uint name, uint type, uint64_t flags, uint64_t off, uint64_t size, uint link, uint info, uint64_t align, uint64_t esz)
+{
+	uchar h[EShdr];
+
+	memset(h, 0, sizeof h);
+	put(h, name, 4);
+	put(&h[4], type, 4);
+	put(&h[8], flags, 8);
+	put(&h[24], off, 8);
+	put(&h[32], size, 8);
+	put(&h[40], link, 4);
+	put(&h[44], info, 4);
+	put(&h[48], align, 8);
+	put(&h[56], esz, 8);
+	fwrite(h, 1, sizeof h, f);
+}
+
+static int
+isasloc(ObjSym *y)
+{
+	return !y->global
+		&& strncmp(qbe_str(y->id), qbe_T.asloc, strlen(qbe_T.asloc)) == 0;
+}
+
+/* resolves the relocations against local symbols of
+ * the same section and rewrites the other local ones
+ * relative to their section, as the assembler does */
+static void
+fixrel(Obj *o)
+{
+	ObjSec *s;
+	ObjSym *y;
+	ObjRel *r;
+	uint n, i, k;
+
+	for (i=0; i<o->nsym; i++) {
+		y = &o->sym[i];
+		if (y->sec == -1) {
+			if (isasloc(y))
+				qbe_err("undefined label %s", qbe_str(y->id));
+			y->global = 1;
+		}
+	}
+	for (n=0; n<o->nsec; n++) {
+		s = &o->sec[n];
+		for (i=0, k=0; i<s->nrel; i++) {
+			r = &s->rel[i];
+			y = &o->sym[r->sym];
+			if (!y->global) {
+				if (y->sec == (int)n
+				&& (r->type == RelPc32 || r->type == RelPlt32)) {
+					put(&s->data[r->off], y->off + r->add - r->off, 4);
+					continue;
+				}
+				if (r->type != RelTpoff32 && r->type != RelPlt32) {
+					r->add += y->off;
+					r->sym = -1 - y->sec;
+				}
+			}
+			s->rel[k++] = *r;
+		}
+		s->nrel = k;
+	}
+}
+
+int
+qbe_elf_objwrite(FILE *f)
+{
+	Obj *o;
+	ObjSec *s;
+	ObjSym *y;
+	ObjRel *r;
+	Strtab shstr, str;
+	uchar h[64];
+	uint n, i, nsh, nsym, nlocal, shnote, shsym, shstrtab, shshstrtab;
+	uint *symidx, *symstr;
+	uint64_t off, *secoff, *reloff, symoff, stroff, shstroff, shoff, fl;
+	int k;
+	char *name;
+
+	o = qbe_ctx->obj;
+	fixrel(o);
+
+	/* the local symbols come first: the null symbol,
+	 * one per section, and the named ones; assembler
+	 * labels are only reachable through the sections */
+	str.s = qbe_vnew(0, 1, PHeap);
+	str.n = 0;
+	addstr(&str, "");
+	symidx = qbe_alloc((o->nsym+1) * sizeof symidx[0]);
+	symstr = qbe_alloc((o->nsym+1) * sizeof symstr[0]);
+	nsym = 1 + o->nsec;
+	nlocal = 0;
+	for (k=0; k<2; k++) {
+		for (i=0; i<o->nsym; i++) {
+			y = &o->sym[i];
+			if (y->global != k)
+				continue;
+			if (isasloc(y)) {
+				symidx[i] = 0;
+				continue;
+			}
+			symidx[i] = nsym++;
+			symstr[i] = addstr(&str, qbe_str(y->id));
+		}
+		if (k == 0)
+			nlocal = nsym;
+	}
+
+	/* the sections are followed by the note, their
+	 * relocations, and the tables */
+	shstr.s = qbe_vnew(0, 1, PHeap);
+	shstr.n = 0;
+	addstr(&shstr, "");
+	nsh = 1 + o->nsec + 1;
+	for (n=0; n<o->nsec; n++)
+		o->sec[n].shname = addstr(&shstr, o->sec[n].name);
+	shnote = addstr(&shstr, ".note.GNU-stack");
+	for (n=0; n<o->nsec; n++)
+		if (o->sec[n].nrel) {
+			name = qbe_alloc(strlen(o->sec[n].name) + 6);
+			sprintf(name, ".rela%s", o->sec[n].name);
+			o->sec[n].shrel = addstr(&shstr, name);
+			nsh++;
+		}
+	shsym = addstr(&shstr, ".symtab");
+	shstrtab = addstr(&shstr, ".strtab");
+	shshstrtab = addstr(&shstr, ".shstrtab");
+	nsh += 3;
+
+	/* layout */
+	off = 64;
+	secoff = qbe_alloc((o->nsec+1) * sizeof secoff[0]);
+	reloff = qbe_alloc((o->nsec+1) * sizeof reloff[0]);
+	for (n=0; n<o->nsec; n++) {
+		s = &o->sec[n];
+		secoff[n] = (off + s->align-1) & -(uint64_t)s->align;
+		if (!(s->flags & ObjNobits))
+			off = secoff[n] + s->size;
+	}
+	for (n=0; n<o->nsec; n++) {
+		off = (off + 7) & -8;
+		reloff[n] = off;
+		off += o->sec[n].nrel * ERela;
+	}
+	symoff = (off + 7) & -8;
+	stroff = symoff + nsym * ESym;
+	shstroff = stroff + str.n;
+	shoff = (shstroff + shstr.n + 7) & -8;
+
+	memset(h, 0, sizeof h);
+	memcpy(h, "\177ELF", 4);
+	h[4] = 2; /* 64 bits */
+	h[5] = 1; /* little endian */
+	h[6] = 1; /* version */
+	put(&h[16], 1, 2); /* relocatable */
+	put(&h[18], 62, 2); /* x86-64 */
+	put(&h[20], 1, 4);
+	put(&h[40], shoff, 8);
+	put(&h[52], 64, 2);
+	put(&h[58], EShdr, 2);
+	put(&h[60], nsh, 2);
+	put(&h[62], nsh-1, 2);
+	fwrite(h, 1, 64, f);
+
+	off = 64;
+	for (n=0; n<o->nsec; n++) {
+		s = &o->sec[n];
+		if (s->flags & ObjNobits)
+			continue;
+		pad(f, &off, s->align);
+		fwrite(s->data, 1, s->size, f);
+		off += s->size;
+	}
+	for (n=0; n<o->nsec; n++) {
+		s = &o->sec[n];
+		pad(f, &off, 8);
+		for (i=0; i<s->nrel; i++) {
+			r = &s->rel[i];
+			k = r->sym < 0 ? -r->sym : (int)symidx[r->sym];
+			put(h, r->off, 8);
+			put(&h[8], (uint64_t)k << 32 | reltype[r->type], 8);
+			put(&h[16], r->add, 8);
+			fwrite(h, 1, ERela, f);
+			off += ERela;
+		}
+	}
+
+	pad(f, &off, 8);
+	memset(h, 0, ESym);
+	fwrite(h, 1, ESym, f);
+	for (n=0; n<o->nsec; n++) {
+		memset(h, 0, ESym);
+		h[4] = SttSection;
+		put(&h[6], n+1, 2);
+		fwrite(h, 1, ESym, f);
+	}
+	for (k=0; k<2; k++)
+		for (i=0; i<o->nsym; i++) {
+			y = &o->sym[i];
+			if (y->global != k || !symidx[i])
+				continue;
+			memset(h, 0, ESym);
+			put(h, symstr[i], 4);
+			h[4] = k << 4 | (y->func ? SttFunc : y->tls ? SttTls : SttNotype);
+			put(&h[6], y->sec + 1, 2);
+			put(&h[8], y->off, 8);
+			put(&h[16], y->size, 8);
+			fwrite(h, 1, ESym, f);
+		}
+	fwrite(str.s, 1, str.n, f);
+	fwrite(shstr.s, 1, shstr.n, f);
+	off = shstroff + shstr.n;
+	pad(f, &off, 8);
+
+	shdr(f, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	for (n=0; n<o->nsec; n++) {
+		s = &o->sec[n];
+		fl = ShfAlloc;
+		if (s->flags & ObjWrite)
+			fl |= ShfWrite;
+		if (s->flags & ObjExec)
+			fl |= ShfExec;
+		if (s->flags & ObjTls)
+			fl |= ShfTls;
+		shdr(f, s->shname, s->flags & ObjNobits ? ShNobits : ShProgbits,
+			fl, secoff[n], s->size, 0, 0, s->align, 0);
+	}
+	shdr(f, shnote, ShProgbits, 0, symoff, 0, 0, 0, 1, 0);
+	for (n=0; n<o->nsec; n++) {
+		s = &o->sec[n];
+		if (s->nrel)
+			shdr(f, s->shrel, ShRela, ShfInfo, reloff[n],
+				s->nrel * ERela, nsh-3, n+1, 8, ERela);
+	}
+	shdr(f, shsym, ShSymtab, 0, symoff, nsym * ESym, nsh-2, nlocal, 8, ESym);
+	shdr(f, shstrtab, ShStrtab, 0, stroff, str.n, 0, 0, 1, 0);
+	shdr(f, shshstrtab, ShStrtab, 0, shstroff, shstr.n, 0, 0, 1, 0);
+
+	qbe_vfree(str.s);
+	qbe_vfree(shstr.s);
+	return ferror(f) != 0;
+}
@@ -6,8 +6,6 @@ enum {
 	SecBss,
 };
 
-static uint curfile; // @shoumodip
-
 void
 qbe_emitlnk(char *n, uint linenr, Lnk *l, int s, FILE *f) // @shoumodip
 {
@@ -51,11 +49,15 @@ qbe_emitlnk(char *n, uint linenr, Lnk *l, int s, FILE *f) // @shoumodip
 		fprintf(f, ".balign %d\n", l->align);
 	if (l->export)
 		fprintf(f, ".globl %s%s\n", pfx, n);
+	else if (qbe_ctx->shared) { // @shoumodip: Visible to the other shards only
+		fprintf(f, ".globl %s%s\n", pfx, n);
+		fprintf(f, "%s %s%s\n", qbe_T.apple ? ".private_extern" : ".hidden", pfx, n);
+	}
 	fprintf(f, "%s%s%s:\n", pfx, n, sfx);
 
 	// @shoumodip
-	if (curfile && linenr) {
-		fprintf(f, "    .loc %u %u\n", curfile, linenr);
+	if (qbe_ctx->curfile && linenr) {
+		fprintf(f, "    .loc %u %u\n", qbe_ctx->curfile, linenr);
 	}
 }
 
@@ -74,31 +76,30 @@ qbe_emitdat(Dat *d, FILE *f)
 		[DW] = "\t.int",
 		[DL] = "\t.quad"
 	};
-	static int64_t zero;
 	char *p;
 
 	switch (d->type) {
 	case DStart:
-		zero = 0;
+		qbe_ctx->zero = 0;
 		break;
 	case DEnd:
-		if (zero != -1) {
+		if (qbe_ctx->zero != -1) {
 			qbe_emitlnk(d->name, 0, d->lnk, SecBss, f); // @shoumodip
-			fprintf(f, "\t.fill %"PRId64",1,0\n", zero);
+			fprintf(f, "\t.fill %"PRId64",1,0\n", qbe_ctx->zero);
 		}
 		break;
 	case DZ:
-		if (zero != -1)
-			zero += d->u.num;
+		if (qbe_ctx->zero != -1)
+			qbe_ctx->zero += d->u.num;
 		else
 			fprintf(f, "\t.fill %"PRId64",1,0\n", d->u.num);
 		break;
 	default:
-		if (zero != -1) {
+		if (qbe_ctx->zero != -1) {
 			qbe_emitlnk(d->name, 0, d->lnk, SecData, f); // @shoumodip
-			if (zero > 0)
-				fprintf(f, "\t.fill %"PRId64",1,0\n", zero);
-			zero = -1;
+			if (qbe_ctx->zero > 0)
+				fprintf(f, "\t.fill %"PRId64",1,0\n", qbe_ctx->zero);
+			qbe_ctx->zero = -1;
 		}
 		if (d->isstr) {
 			if (d->type != DB)
@@ -119,35 +120,128 @@ qbe_emitdat(Dat *d, FILE *f)
 	}
 }
 
-typedef struct Asmbits Asmbits;
-
 struct Asmbits {
-	char bits[16];
+	_Alignas(8) char bits[16]; /* @shoumodip: read as doubles, in a vector */
 	int size;
-	Asmbits *link;
 };
 
-static Asmbits *stash;
+// Modification BEGIN
+// Copyright (C) 2025 Shoumodip Kar <shoumodipkar@gmail.com>
+
+// A constant is reused for any constant that its bytes start with, so the index has an entry for
+// every prefix of every constant, pointing to the first constant that has it. The entries are the
+// number of the constant plus one, and the log of the size of the prefix in the low bits
+static uint
+stashhash(void *bits, int size)
+{
+	uint64_t w[2], h;
+
+	w[0] = w[1] = 0;
+	memcpy(w, bits, size);
+	h = (w[0] ^ w[1] * 0xc2b2ae3d27d4eb4full) * 0x9e3779b97f4a7c15ull + size;
+	return h ^ h >> 32;
+}
+
+static uint *
+stashslot(void *bits, int size)
+{
+	Stash *s;
+	uint h, e, *p;
+
+	s = &qbe_ctx->stash;
+	for (h=stashhash(bits, size);; h++) {
+		p = &s->tab[h & (s->ntab-1)];
+		e = *p;
+		if (!e)
+			return p;
+		if (1 << (e & 7) == size)
+		if (memcmp(bits, s->bits[(e >> 3) - 1].bits, size) == 0)
+			return p;
+	}
+}
+
+static void
+stashindex(uint n)
+{
+	Stash *s;
+	uint *tab, ntab, i, *p;
+	int lg;
+
+	s = &qbe_ctx->stash;
+	if (s->ntab < 8 * (s->n + 1)) {
+		/* up to three prefixes a constant */
+		tab = s->tab;
+		ntab = s->ntab;
+		s->ntab = ntab ? 2 * ntab : 64;
+		s->tab = qbe_emalloc(s->ntab * sizeof s->tab[0]);
+		for (i=0; i<ntab; i++)
+			if (tab[i]) {
+				p = stashslot(s->bits[(tab[i] >> 3) - 1].bits, 1 << (tab[i] & 7));
+				*p = tab[i];
+			}
+		qbe_memfree(tab);
+	}
+	for (lg=2; 1<<lg <= s->bits[n].size; lg++) {
+		p = stashslot(s->bits[n].bits, 1 << lg);
+		if (!*p)
+			*p = (n + 1) << 3 | lg;
+	}
+}
 
 int
 qbe_stashbits(void *bits, int size)
 {
-	Asmbits **pb, *b;
+	Stash *s;
+	uint *p;
 	int i;
 
 	assert(size == 4 || size == 8 || size == 16);
-	for (pb=&stash, i=0; (b=*pb); pb=&b->link, i++)
-		if (size <= b->size)
-		if (memcmp(bits, b->bits, size) == 0)
+	s = &qbe_ctx->stash;
+	if (s->tab) {
+		p = stashslot(bits, size);
+		if (*p) {
+			i = (*p >> 3) - 1;
+			qbe_cachestash(i);
 			return i;
-	b = qbe_emalloc(sizeof *b);
-	memcpy(b->bits, bits, size);
-	b->size = size;
-	b->link = 0;
-	*pb = b;
+		}
+	}
+	if (!s->bits)
+		s->bits = qbe_vnew(0, sizeof s->bits[0], PHeap);
+	i = s->n++;
+	qbe_vgrow(&s->bits, s->n);
+	memcpy(s->bits[i].bits, bits, size);
+	s->bits[i].size = size;
+	stashindex(i);
+	qbe_cachestash(i);
 	return i;
 }
 
+static void
+stashfree(void)
+{
+	Stash *s;
+
+	s = &qbe_ctx->stash;
+	if (s->bits)
+		qbe_vfree(s->bits);
+	qbe_memfree(s->tab);
+	*s = (Stash){0};
+}
+
+// For the cache, returns the size of constant n, or 0
+int
+qbe_stashget(int n, void *bits)
+{
+	Stash *s;
+
+	s = &qbe_ctx->stash;
+	if (n < 0 || (uint)n >= s->n)
+		return 0;
+	memcpy(bits, s->bits[n].bits, s->bits[n].size);
+	return s->bits[n].size;
+}
+// Modification END
+
 static void
 emitfin(FILE *f, char *sec[3])
 {
@@ -156,11 +250,11 @@ emitfin(FILE *f, char *sec[3])
 	int lg, i;
 	double d;
 
-	if (!stash)
+	if (!qbe_ctx->stash.n)
 		return;
 	fprintf(f, "/* floating point constants */\n");
 	for (lg=4; lg>=2; lg--)
-		for (b=stash, i=0; b; b=b->link, i++) {
+		for (b=qbe_ctx->stash.bits, i=0; i<(int)qbe_ctx->stash.n; b++, i++) {
 			if (b->size == (1<<lg)) {
 				fprintf(f,
 					".section %s\n"
@@ -181,10 +275,7 @@ emitfin(FILE *f, char *sec[3])
 					fprintf(f, "\n\n");
 			}
 		}
-	while ((b=stash)) {
-		stash = b->link;
-		free(b);
-	}
+	/* @shoumodip: Freed by qbe_emit_resetall(), every shard has a copy */
 }
 
 void
@@ -196,6 +287,27 @@ qbe_elf_emitfin(FILE *f)
 	fprintf(f, ".section .note.GNU-stack,\"\",@progbits\n");
 }
 
+// @shoumodip: The same layout as emitfin(), for objects
+void
+qbe_elf_objfin(void)
+{
+	Asmbits *b;
+	char name[16];
+	int lg, i;
+
+	for (lg=4; lg>=2; lg--)
+		for (b=qbe_ctx->stash.bits, i=0; i<(int)qbe_ctx->stash.n; b++, i++) {
+			if (b->size == (1<<lg)) {
+				qbe_objsec(".rodata", 0);
+				qbe_objalign(1<<lg);
+				sprintf(name, "%sfp%d", qbe_T.asloc, i);
+				qbe_objlabel(name, 0);
+				qbe_objbytes(b->bits, b->size);
+			}
+		}
+	stashfree(); // @shoumodip
+}
+
 void
 qbe_elf_emitfnfin(char *fn, FILE *f)
 {
@@ -215,20 +327,20 @@ qbe_macho_emitfin(FILE *f)
 	emitfin(f, sec);
 }
 
-static uint32_t *file;
-static uint nfile;
-
 // Modification BEGIN
 // Copyright (C) 2025 Shoumodip Kar <shoumodipkar@gmail.com>
 void
 qbe_emit_resetall(void)
 {
-    if (file) {
-        qbe_vfree(file);
-        file = NULL;
+    if (qbe_ctx->file) {
+        qbe_vfree(qbe_ctx->file);
+        qbe_ctx->file = NULL;
     }
-    nfile = 0;
-    curfile = 0;
+    qbe_ctx->nfile = 0;
+    qbe_ctx->curfile = 0;
+    qbe_ctx->id0 = 0;
+
+    stashfree();
 }
 // Modification END
 
@@ -239,26 +351,26 @@ qbe_emitdbgfile(char *fn, FILE *f)
 	uint n;
 
 	id = qbe_intern(fn);
-	for (n=0; n<nfile; n++)
-		if (file[n] == id) {
+	for (n=0; n<qbe_ctx->nfile; n++)
+		if (qbe_ctx->file[n] == id) {
 			/* gas requires positive
 			 * file numbers */
-			curfile = n + 1;
+			qbe_ctx->curfile = n + 1;
 			return;
 		}
-	if (!file)
-		file = qbe_vnew(0, sizeof *file, PHeap);
-	qbe_vgrow(&file, ++nfile);
-	file[nfile-1] = id;
-	curfile = nfile;
-	fprintf(f, ".file %u %s\n", curfile, fn);
+	if (!qbe_ctx->file)
+		qbe_ctx->file = qbe_vnew(0, sizeof *qbe_ctx->file, PHeap);
+	qbe_vgrow(&qbe_ctx->file, ++qbe_ctx->nfile);
+	qbe_ctx->file[qbe_ctx->nfile-1] = id;
+	qbe_ctx->curfile = qbe_ctx->nfile;
+	fprintf(f, ".file %u %s\n", qbe_ctx->curfile, fn);
 }
 
 void
 qbe_emitdbgloc(uint line, uint col, FILE *f)
 {
 	if (col != 0)
-		fprintf(f, "\t.loc %u %u %u\n", curfile, line, col);
+		fprintf(f, "\t.loc %u %u %u\n", qbe_ctx->curfile, line, col);
 	else
-		fprintf(f, "\t.loc %u %u\n", curfile, line);
+		fprintf(f, "\t.loc %u %u\n", qbe_ctx->curfile, line);
 }
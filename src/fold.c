@@ -13,10 +13,10 @@ struct Edge {
 	Edge *work;
 };
 
-static int *val;
-static Edge *flowrk, (*edge)[2];
-static Use **usewrk;
-static uint nuse;
+static _Thread_local int *val;
+static _Thread_local Edge *flowrk, (*edge)[2];
+static _Thread_local Use **usewrk;
+static _Thread_local uint nuse;
 
 static int
 iscon(Con *c, int w, uint64_t k)
@@ -320,8 +320,8 @@ qbe_fold(Fn *fn)
 		qbe_printfn(fn, stderr);
 	}
 
-	free(val);
-	free(edge);
+	qbe_memfree(val); // @shoumodip
+	qbe_memfree(edge); // @shoumodip
 	qbe_vfree(usewrk);
 }
 
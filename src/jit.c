@@ -0,0 +1,307 @@
+// @shoumodip: In-process loader for qbe_jit()
+//
+// The object built for qbe_generate_object() is laid out in fresh pages
+// instead of being written out: the code and the read-only data first,
+// then the writable data, each part on its own pages. The relocations are
+// applied like the static linker would, the undefined symbols are looked
+// up in the host, and the code pages are made executable last.
+#define _GNU_SOURCE // RTLD_DEFAULT
+
+#include <dlfcn.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "all.h"
+
+enum {
+	NStub = 16, /* jmp *0(%rip); .quad addr */
+};
+
+typedef struct ImageSym ImageSym;
+
+struct ImageSym {
+	char *name;
+	void *addr;
+};
+
+struct Image {
+	uchar *mem;
+	size_t size;
+	ImageSym *sym; /* sorted by name */
+	uint nsym;
+	char *str;
+};
+
+static void
+jiterr(char *s, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "qbe: jit: ");
+	va_start(ap, s);
+	vfprintf(stderr, s, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+/* maps the pages within the reach of a rip-relative
+ * reference from 'near', if there is room for them */
+static uchar *
+mapnear(uint64_t near, size_t size)
+{
+	uint64_t d, a;
+	void *p;
+	int i;
+
+	if (near)
+		for (d=1<<20; d<1u<<31; d*=4)
+			for (i=0; i<2; i++) {
+				a = i ? near + d : near - d - size;
+				a &= ~(uint64_t)0xfff;
+				p = mmap((void *)a, size, PROT_READ|PROT_WRITE,
+					MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+				if (p == MAP_FAILED)
+					continue;
+				if ((uint64_t)p == a)
+					return p;
+				munmap(p, size);
+			}
+	p = mmap(0, size, PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	return p == MAP_FAILED ? 0 : p;
+}
+
+static int
+symcmp(const void *a, const void *b)
+{
+	return strcmp(((ImageSym *)a)->name, ((ImageSym *)b)->name);
+}
+
+static void
+put32(uchar *p, int64_t v)
+{
+	int32_t w;
+
+	w = v;
+	memcpy(p, &w, 4);
+}
+
+Image *
+qbe_objload(Resolver *res, void *user)
+{
+	Obj *o;
+	ObjSec *s;
+	ObjSym *y;
+	ObjRel *r;
+	Image *img;
+	uint64_t *base, *ext, off, rx, stubs, near, S, P;
+	int64_t v;
+	size_t pg, nstr;
+	int *stub, nstub, pass, ok;
+	uint n, i;
+	uchar *p;
+	char *name;
+
+	o = qbe_ctx->obj;
+	img = 0;
+	base = qbe_emalloc(o->nsec * sizeof base[0]);
+	ext = qbe_emalloc(o->nsym * sizeof ext[0]);
+	stub = qbe_emalloc(o->nsym * sizeof stub[0]);
+	ok = 1;
+
+	/* resolve the undefined symbols, the calls to
+	 * them get a stub in case they are out of reach */
+	nstub = 0;
+	near = 0;
+	for (i=0; i<o->nsym; i++) {
+		y = &o->sym[i];
+		stub[i] = -1;
+		if (y->sec != -1)
+			continue;
+		name = qbe_str(y->id);
+		p = res ? res(user, name) : 0;
+		if (!p)
+			p = dlsym(RTLD_DEFAULT, name);
+		if (!p) {
+			jiterr("undefined symbol %s", name);
+			ok = 0;
+		}
+		ext[i] = (uint64_t)p;
+	}
+	for (n=0; n<o->nsec; n++) {
+		s = &o->sec[n];
+		if ((s->flags & ObjTls) && s->size) {
+			jiterr("thread local data in section %s is not supported", s->name);
+			ok = 0;
+		}
+		for (r=s->rel; r<&s->rel[s->nrel]; r++) {
+			y = &o->sym[r->sym];
+			if (y->sec != -1)
+				continue;
+			if (r->type == RelTpoff32) {
+				jiterr("thread local symbol %s is not supported", qbe_str(y->id));
+				ok = 0;
+			}
+			if (r->type == RelPlt32 && stub[r->sym] == -1)
+				stub[r->sym] = nstub++;
+			if (r->type == RelPc32 || !near)
+				near = ext[r->sym];
+		}
+	}
+	if (!ok)
+		goto Out;
+
+	/* the code and read-only data, the stubs, then
+	 * the writable data on separate pages */
+	pg = sysconf(_SC_PAGESIZE);
+	off = 0;
+	rx = 0;
+	stubs = 0;
+	for (pass=0; pass<2; pass++) {
+		for (n=0; n<o->nsec; n++) {
+			s = &o->sec[n];
+			if (!(s->flags & ObjWrite) != !pass || (s->flags & ObjTls))
+				continue;
+			off = (off + s->align-1) & -(uint64_t)s->align;
+			base[n] = off;
+			off += s->size;
+		}
+		if (pass == 0) {
+			stubs = (off + NStub-1) & -(uint64_t)NStub;
+			off = stubs + nstub * NStub;
+			rx = (off + pg-1) & -(uint64_t)pg;
+			off = rx;
+		}
+	}
+	off = (off + pg-1) & -(uint64_t)pg;
+	if (!off)
+		off = pg;
+
+	img = qbe_memalloc(0, sizeof *img); // @shoumodip: outlives the context, so not accounted
+	img->size = off;
+	img->mem = mapnear(near, img->size);
+	if (!img->mem) {
+		jiterr("could not map %zu bytes", img->size);
+		qbe_memfree(img); // @shoumodip
+		img = 0;
+		goto Out;
+	}
+	for (n=0; n<o->nsec; n++) {
+		s = &o->sec[n];
+		if (s->data && !(s->flags & ObjTls))
+			memcpy(&img->mem[base[n]], s->data, s->size);
+	}
+	for (i=0; i<o->nsym; i++)
+		if (stub[i] != -1) {
+			p = &img->mem[stubs + stub[i] * NStub];
+			memcpy(p, "\xff\x25\0\0\0\0", 6);
+			memcpy(p+6, &ext[i], 8);
+		}
+
+	for (n=0; n<o->nsec; n++) {
+		s = &o->sec[n];
+		for (r=s->rel; r<&s->rel[s->nrel]; r++) {
+			y = &o->sym[r->sym];
+			p = &img->mem[base[n] + r->off];
+			P = (uint64_t)p;
+			if (y->sec == -1)
+				S = ext[r->sym];
+			else
+				S = (uint64_t)&img->mem[base[y->sec] + y->off];
+			switch (r->type) {
+			case RelAbs64:
+				v = S + r->add;
+				memcpy(p, &v, 8);
+				continue;
+			case RelAbs32:
+				v = S + r->add;
+				if (v != (uint32_t)v)
+					break;
+				put32(p, v);
+				continue;
+			case RelAbs32S:
+				v = S + r->add;
+				if (v != (int32_t)v)
+					break;
+				put32(p, v);
+				continue;
+			case RelPc32:
+			case RelPlt32:
+				v = S + r->add - P;
+				if (v != (int32_t)v && r->type == RelPlt32 && stub[r->sym] != -1) {
+					S = (uint64_t)&img->mem[stubs + stub[r->sym] * NStub];
+					v = S + r->add - P;
+				}
+				if (v != (int32_t)v)
+					break;
+				put32(p, v);
+				continue;
+			}
+			jiterr("symbol %s is out of reach", qbe_str(y->id));
+			ok = 0;
+		}
+	}
+	if (!ok || (rx && mprotect(img->mem, rx, PROT_READ|PROT_EXEC) != 0)) {
+		if (ok)
+			jiterr("could not make the code executable");
+		munmap(img->mem, img->size);
+		qbe_memfree(img); // @shoumodip
+		img = 0;
+		goto Out;
+	}
+
+	/* the symbols for qbe_imagesym() */
+	img->nsym = 0;
+	nstr = 0;
+	for (i=0; i<o->nsym; i++) {
+		y = &o->sym[i];
+		name = qbe_str(y->id);
+		if (y->sec == -1 || (!y->global
+		&& strncmp(name, qbe_T.asloc, strlen(qbe_T.asloc)) == 0))
+			continue;
+		img->nsym++;
+		nstr += strlen(name) + 1;
+	}
+	img->sym = qbe_memalloc(0, img->nsym * sizeof img->sym[0] + 1); // @shoumodip
+	img->str = qbe_memalloc(0, nstr + 1); // @shoumodip
+	img->nsym = 0;
+	nstr = 0;
+	for (i=0; i<o->nsym; i++) {
+		y = &o->sym[i];
+		name = qbe_str(y->id);
+		if (y->sec == -1 || (!y->global
+		&& strncmp(name, qbe_T.asloc, strlen(qbe_T.asloc)) == 0))
+			continue;
+		img->sym[img->nsym].name = strcpy(&img->str[nstr], name);
+		img->sym[img->nsym].addr = &img->mem[base[y->sec] + y->off];
+		img->nsym++;
+		nstr += strlen(name) + 1;
+	}
+	qsort(img->sym, img->nsym, sizeof img->sym[0], symcmp);
+
+Out:
+	qbe_memfree(base); // @shoumodip
+	qbe_memfree(ext); // @shoumodip
+	qbe_memfree(stub); // @shoumodip
+	return img;
+}
+
+void *
+qbe_imagesym(Image *img, char *name)
+{
+	ImageSym k, *y;
+
+	k.name = name;
+	y = bsearch(&k, img->sym, img->nsym, sizeof img->sym[0], symcmp);
+	return y ? y->addr : 0;
+}
+
+void
+qbe_imagefree(Image *img)
+{
+	munmap(img->mem, img->size);
+	qbe_memfree(img->sym); // @shoumodip
+	qbe_memfree(img->str); // @shoumodip
+	qbe_memfree(img); // @shoumodip
+}
@@ -37,10 +37,10 @@ struct Insert {
 	} new;
 };
 
-static Fn *curf;
-static uint inum;    /* current insertion number */
-static Insert *ilog; /* global insertion log */
-static uint nlog;    /* number of entries in the log */
+static _Thread_local Fn *curf;
+static _Thread_local uint inum;    /* current insertion number */
+static _Thread_local Insert *ilog; /* global insertion log */
+static _Thread_local uint nlog;    /* number of entries in the log */
 
 int
 qbe_loadsz(Ins *l)
@@ -302,7 +302,7 @@ qbe_coalesce(Fn *fn)
 			}
 		br[n].a = ip;
 	}
-	free(br);
+	qbe_memfree(br); // @shoumodip
 
 	/* kill dead stores */
 	for (s=sl; s<&sl[nsl]; s++)
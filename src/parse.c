@@ -89,7 +89,7 @@ enum Token {
 	Ntok
 };
 
-static char *kwmap[Ntok] = {
+static _Thread_local char *kwmap[Ntok] = {
 	[Tloadw] = "loadw",
 	[Tloadl] = "loadl",
 	[Tloads] = "loads",
@@ -127,37 +127,40 @@ static char *kwmap[Ntok] = {
 };
 
 enum {
-	NPred = 63,
+	NPred = 63, /* @shoumodip: arguments of an instruction, phis have no limit */
 
-	TMask = 16383, /* for temps hash */
-	BMask = 8191, /* for blocks hash */
+	NHash = 256, /* least size of the tables by name */
 
 	K = 9583425, /* found using tools/lexh.c */
 	M = 23,
 };
 
-static uchar lexh[1 << (32-M)];
-static FILE *inf;
-static char *inpath;
-static int thead;
-static struct {
+static _Thread_local uchar lexh[1 << (32-M)];
+static _Thread_local FILE *inf;
+static _Thread_local char *inpath;
+static _Thread_local int thead;
+static _Thread_local struct {
 	char chr;
 	double fltd;
 	float flts;
 	int64_t num;
 	char *str;
 } tokval;
-static int lnum;
-
-static Fn *curf;
-static int tmph[TMask+1];
-static Phi **plink;
-static Blk *curb;
-static Blk **blink;
-static Blk *blkh[BMask+1];
-static int nblk;
-static int rcls;
-static uint ntyp;
+static _Thread_local int lnum;
+
+static _Thread_local Fn *curf;
+static _Thread_local int *tmph;
+static _Thread_local uint ntmph;
+static _Thread_local Phi **plink;
+static _Thread_local Blk *curb;
+static _Thread_local Blk **blink;
+static _Thread_local Blk **blkh;
+static _Thread_local uint nblkh;
+static _Thread_local int nblk;
+static _Thread_local int rcls;
+static _Thread_local uint ntyp;
+static _Thread_local int *typh;
+static _Thread_local uint ntyph;
 
 void
 qbe_err(char *s, ...)
@@ -165,7 +168,11 @@ qbe_err(char *s, ...)
 	va_list ap;
 
 	va_start(ap, s);
-	fprintf(stderr, "qbe:%s:%d: ", inpath, lnum);
+	// @shoumodip: Functions lowered directly from the builder have no source
+	if (inpath)
+		fprintf(stderr, "qbe:%s:%d: ", inpath, lnum);
+	else
+		fprintf(stderr, "qbe: ");
 	vfprintf(stderr, s, ap);
 	fprintf(stderr, "\n");
 	va_end(ap);
@@ -175,7 +182,7 @@ qbe_err(char *s, ...)
 static void
 lexinit(void)
 {
-	static int done;
+	static _Thread_local int done;
 	int i;
 	long h;
 
@@ -218,7 +225,7 @@ getint(void)
 static int
 lex(void)
 {
-	static char tok[NString];
+	static _Thread_local char tok[NString];
 	int c, i, esc;
 	int t;
 
@@ -379,26 +386,50 @@ expect(int t)
 	qbe_err(buf);
 }
 
+// Modification BEGIN
+// Copyright (C) 2025 Shoumodip Kar <shoumodipkar@gmail.com>
+
+// The temporaries, blocks and types are found by name with open addressing tables, which are grown
+// at half load. The ones of temporaries and blocks are sized to the function being parsed
+static int *
+tmpslot(char *v)
+{
+	uint32_t h;
+	int *p;
+
+	for (h=qbe_strhash(v, 0);; h++) {
+		p = &tmph[h & (ntmph-1)];
+		if (!*p || strcmp(curf->tmp[*p].name, v) == 0)
+			return p;
+	}
+}
+
 static Ref
 tmpref(char *v)
 {
-	int t, *h;
-
-	h = &tmph[qbe_hash(v) & TMask];
-	t = *h;
-	if (t) {
-		if (strcmp(curf->tmp[t].name, v) == 0)
-			return TMP(t);
-		for (t=curf->ntmp-1; t>=Tmp0; t--)
-			if (strcmp(curf->tmp[t].name, v) == 0)
-				return TMP(t);
+	int t, *tab, *p;
+	uint n, i;
+
+	if (2 * (curf->ntmp + 1) > (int)ntmph) {
+		tab = tmph;
+		n = ntmph;
+		ntmph = n ? 2 * n : NHash;
+		tmph = qbe_emalloc(ntmph * sizeof tmph[0]);
+		for (i=0; i<n; i++)
+			if (tab[i])
+				*tmpslot(curf->tmp[tab[i]].name) = tab[i];
+		qbe_memfree(tab);
 	}
+	p = tmpslot(v);
+	if (*p)
+		return TMP(*p);
 	t = curf->ntmp;
-	*h = t;
+	*p = t;
 	qbe_newtmp(0, Kx, curf);
 	strcpy(curf->tmp[t].name, v);
 	return TMP(t);
 }
+// Modification END
 
 static Ref
 parseref(void)
@@ -437,14 +468,55 @@ parseref(void)
 	return qbe_newcon(&c, curf);
 }
 
+// Modification BEGIN
+// Copyright (C) 2025 Shoumodip Kar <shoumodipkar@gmail.com>
+static int *
+typslot(char *name)
+{
+	uint32_t h;
+	int *p;
+
+	for (h=qbe_strhash(name, 0);; h++) {
+		p = &typh[h & (ntyph-1)];
+		if (!*p || strcmp(qbe_typ[*p-1].name, name) == 0)
+			return p;
+	}
+}
+
+// A type is only found once it is complete, so that it cannot contain itself. A type that is
+// defined again hides the previous one from then on
+static void
+deftyp(int i)
+{
+	int *tab;
+	uint n, j;
+
+	if (2 * (ntyp + 1) > ntyph) {
+		tab = typh;
+		n = ntyph;
+		ntyph = n ? 2 * n : NHash;
+		typh = qbe_emalloc(ntyph * sizeof typh[0]);
+		for (j=0; j<n; j++)
+			if (tab[j])
+				*typslot(qbe_typ[tab[j]-1].name) = tab[j];
+		qbe_memfree(tab);
+	}
+	*typslot(qbe_typ[i].name) = i + 1;
+}
+
 static int
-findtyp(int i)
+findtyp(void)
 {
-	while (--i >= 0)
-		if (strcmp(tokval.str, qbe_typ[i].name) == 0)
-			return i;
+	int *p;
+
+	if (typh) {
+		p = typslot(tokval.str);
+		if (*p)
+			return *p - 1;
+	}
 	qbe_err("undefined type :%s", tokval.str);
 }
+// Modification END
 
 static int
 parsecls(int *tyn)
@@ -453,7 +525,7 @@ parsecls(int *tyn)
 	default:
 		qbe_err("invalid class specifier");
 	case Ttyp:
-		*tyn = findtyp(ntyp);
+		*tyn = findtyp();
 		return Kc;
 	case Tsb:
 		return Ksb;
@@ -484,8 +556,7 @@ parserefl(int arg)
 	vararg = 0;
 	expect(Tlparen);
 	while (peek() != Trparen) {
-		if (qbe_curi - qbe_insb >= NIns)
-			qbe_err("too many instructions");
+		qbe_insfit(1); // @shoumodip
 		if (!arg && vararg)
 			qbe_err("no parameters allowed after '...'");
 		switch (peek()) {
@@ -547,24 +618,67 @@ parserefl(int arg)
 	return vararg;
 }
 
-static Blk *
-findblk(char *name)
+// Modification BEGIN
+// Copyright (C) 2025 Shoumodip Kar <shoumodipkar@gmail.com>
+static Blk **
+blkslot(char *name)
 {
-	Blk *b;
 	uint32_t h;
+	Blk **p;
 
-	h = qbe_hash(name) & BMask;
-	for (b=blkh[h]; b; b=b->dlink)
-		if (strcmp(b->name, name) == 0)
-			return b;
+	for (h=qbe_strhash(name, 0);; h++) {
+		p = &blkh[h & (nblkh-1)];
+		if (!*p || strcmp((*p)->name, name) == 0)
+			return p;
+	}
+}
+
+static Blk *
+findblk(char *name)
+{
+	Blk *b, **tab, **p;
+	uint n, i;
+
+	if (2 * (nblk + 1) > (int)nblkh) {
+		tab = blkh;
+		n = nblkh;
+		nblkh = n ? 2 * n : NHash;
+		blkh = qbe_emalloc(nblkh * sizeof blkh[0]);
+		for (i=0; i<n; i++)
+			if (tab[i])
+				*blkslot(tab[i]->name) = tab[i];
+		qbe_memfree(tab);
+	}
+	p = blkslot(name);
+	if (*p)
+		return *p;
 	b = qbe_newblk();
 	b->id = nblk++;
 	strcpy(b->name, name);
-	b->dlink = blkh[h];
-	blkh[h] = b;
+	*p = b;
 	return b;
 }
 
+// The tables of a function that was large are given back, rather than cleared for every function
+// that follows
+static void
+resetnames(void)
+{
+	if (ntmph > NHash) {
+		qbe_memfree(tmph);
+		tmph = 0;
+		ntmph = 0;
+	} else if (tmph)
+		memset(tmph, 0, ntmph * sizeof tmph[0]);
+	if (nblkh > NHash) {
+		qbe_memfree(blkh);
+		blkh = 0;
+		nblkh = 0;
+	} else if (blkh)
+		memset(blkh, 0, nblkh * sizeof blkh[0]);
+}
+// Modification END
+
 static void
 closeblk(void)
 {
@@ -577,8 +691,7 @@ closeblk(void)
 static PState
 parseline(PState ps)
 {
-	Ref arg[NPred] = {R};
-	Blk *blk[NPred];
+	Ref arg[NPred] = {R}, *a;
 	Phi *phi;
 	Ref r;
 	Blk *b;
@@ -703,16 +816,29 @@ parseline(PState ps)
 	if (k >= Ksb)
 		qbe_err("size class must be w, l, s, or d");
 	i = 0;
+	/* @shoumodip: The arguments of a phi are not limited, they
+	 * are parsed straight into its vectors
+	 */
+	phi = 0;
+	if (op == Tphi) {
+		phi = qbe_alloc(sizeof *phi);
+		phi->arg = qbe_vnew(0, sizeof phi->arg[0], PFn);
+		phi->blk = qbe_vnew(0, sizeof phi->blk[0], PFn);
+	}
 	if (peek() != Tnl)
 		for (;;) {
-			if (i == NPred)
-				qbe_err("too many arguments");
 			if (op == Tphi) {
+				qbe_vgrow(&phi->arg, i+1);
+				qbe_vgrow(&phi->blk, i+1);
 				expect(Tlbl);
-				blk[i] = findblk(tokval.str);
-			}
-			arg[i] = parseref();
-			if (req(arg[i], R))
+				phi->blk[i] = findblk(tokval.str);
+				a = &phi->arg[i];
+			} else if (i == NPred)
+				qbe_err("too many arguments");
+			else
+				a = &arg[i];
+			*a = parseref();
+			if (req(*a, R))
 				qbe_err("invalid instruction argument");
 			i++;
 			t = peek();
@@ -727,20 +853,14 @@ parseline(PState ps)
 	case Tphi:
 		if (ps != PPhi || curb == curf->start)
 			qbe_err("unexpected phi instruction");
-		phi = qbe_alloc(sizeof *phi);
 		phi->to = r;
 		phi->cls = k;
-		phi->arg = qbe_vnew(i, sizeof arg[0], PFn);
-		memcpy(phi->arg, arg, i * sizeof arg[0]);
-		phi->blk = qbe_vnew(i, sizeof blk[0], PFn);
-		memcpy(phi->blk, blk, i * sizeof blk[0]);
 		phi->narg = i;
 		*plink = phi;
 		plink = &phi->link;
 		return PPhi;
 	case Tblit:
-		if (qbe_curi - qbe_insb >= NIns-1)
-			qbe_err("too many instructions");
+		qbe_insfit(2); // @shoumodip
 		memset(qbe_curi, 0, 2 * sizeof(Ins));
 		qbe_curi->op = Oblit0;
 		qbe_curi->arg[0] = arg[0];
@@ -762,8 +882,7 @@ parseline(PState ps)
 		if (op >= NPubOp)
 			qbe_err("invalid instruction");
 	Ins:
-		if (qbe_curi - qbe_insb >= NIns)
-			qbe_err("too many instructions");
+		qbe_insfit(1); // @shoumodip
 		qbe_curi->op = op;
 		qbe_curi->cls = k;
 		qbe_curi->to = r;
@@ -781,8 +900,9 @@ usecheck(Ref r, int k, Fn *fn)
 		|| (fn->tmp[r.val].cls == Kl && k == Kw);
 }
 
-static void
-typecheck(Fn *fn)
+// @shoumodip: Shared with the builder, which constructs functions directly
+void
+qbe_typecheck(Fn *fn)
 {
 	Blk *b;
 	Phi *p;
@@ -872,12 +992,11 @@ typecheck(Fn *fn)
 	}
 }
 
-static uint linenr_for_next_fn; // @shoumodip
+static _Thread_local uint linenr_for_next_fn; // @shoumodip
 
 static Fn *
 parsefn(Lnk *lnk)
 {
-	Blk *b;
 	int i;
 	PState ps;
 
@@ -929,12 +1048,8 @@ parsefn(Lnk *lnk)
 	curf->nmem = 0;
 	curf->nblk = nblk;
 	curf->rpo = 0;
-	for (b=0; b; b=b->link)
-		b->dlink = 0; /* was trashed by findblk() */
-	for (i=0; i<BMask+1; ++i)
-		blkh[i] = 0;
-	memset(tmph, 0, sizeof tmph);
-	typecheck(curf);
+	resetnames(); // @shoumodip
+	qbe_typecheck(curf);
 	return curf;
 }
 
@@ -960,7 +1075,7 @@ parsefields(Field *fld, Typ *ty, int t)
 		case Tb: type = Fb; s = 1; a = 0; break;
 		case Ttyp:
 			type = FTyp;
-			ty1 = &qbe_typ[findtyp(ntyp-1)];
+			ty1 = &qbe_typ[findtyp()];
 			s = ty1->size;
 			a = ty1->align;
 			break;
@@ -1043,6 +1158,7 @@ parsetyp(void)
 			qbe_err("dark types need alignment");
 		if (nextnl() != Trbrace)
 			qbe_err("} expected");
+		deftyp(ntyp-1); // @shoumodip
 		return;
 	}
 	n = 0;
@@ -1059,6 +1175,7 @@ parsetyp(void)
 	} else
 		parsefields(ty->fields[n++], ty, t);
 	ty->nunion = n;
+	deftyp(ntyp-1); // @shoumodip
 }
 
 static void
@@ -1228,6 +1345,15 @@ qbe_parse(FILE *f, char *path, void dbgfile(char *), void data(Dat *), void func
 				if (qbe_typ[n].nunion)
 					qbe_vfree(qbe_typ[n].fields);
 			qbe_vfree(qbe_typ);
+			// @shoumodip
+			qbe_memfree(tmph);
+			qbe_memfree(blkh);
+			qbe_memfree(typh);
+			tmph = 0;
+			blkh = 0;
+			typh = 0;
+			ntmph = nblkh = ntyph = 0;
+			inpath = 0; // @shoumodip
 			return;
 		}
 	}
@@ -0,0 +1,348 @@
+// @shoumodip: Reader for the binary IL written by qbe_get_binary_program() in builder.c
+//
+// Records are decoded straight from the buffer, which may be a read-only
+// mapping. Strings are referenced in place, only the records the passes
+// mutate (functions, blocks, instructions) are materialized.
+#include "all.h"
+
+static _Thread_local uchar *bp, *bend;
+static _Thread_local uint ntyp;
+
+static void __attribute__((noreturn))
+binerr(void)
+{
+	qbe_err("invalid binary IL");
+}
+
+static uint64_t
+getu(void)
+{
+	uint64_t n;
+	int s, c;
+
+	n = 0;
+	for (s=0;; s+=7) {
+		if (bp == bend || s > 63)
+			binerr();
+		c = *bp++;
+		n |= (uint64_t)(c & 0x7f) << s;
+		if (!(c & 0x80))
+			return n;
+	}
+}
+
+static int64_t
+geti(void)
+{
+	uint64_t n;
+
+	n = getu();
+	return (int64_t)(n >> 1) ^ -(int64_t)(n & 1);
+}
+
+static uint
+getn(uint max)
+{
+	uint64_t n;
+
+	n = getu();
+	if (n >= max)
+		binerr();
+	return n;
+}
+
+static char *
+getstr(void)
+{
+	uint64_t n;
+	char *s;
+
+	n = getu();
+	if (n >= (uint64_t)(bend - bp) || bp[n])
+		binerr();
+	s = (char *)bp;
+	bp += n + 1;
+	return s;
+}
+
+static void
+getname(char name[NString])
+{
+	char *s;
+
+	s = getstr();
+	if (strlen(s) >= NString)
+		binerr();
+	strcpy(name, s);
+}
+
+static Ref
+getref(Fn *fn)
+{
+	uint64_t n;
+	Ref r;
+
+	n = getu();
+	r.type = n & 3;
+	r.val = n >> 2;
+	if (n >> 2 != r.val)
+		binerr();
+	switch (r.type) {
+	case RTmp:
+		if (r.val)
+			r.val += Tmp0 - 1;
+		if (r.val >= (uint)fn->ntmp)
+			binerr();
+		break;
+	case RCon:
+		if (r.val >= (uint)fn->ncon)
+			binerr();
+		break;
+	case RType:
+		if (r.val >= ntyp)
+			binerr();
+		break;
+	case RInt:
+		break;
+	}
+	return r;
+}
+
+static void
+gettyp(void)
+{
+	Typ *ty;
+	Field *fld;
+	uint n, i, nf;
+
+	qbe_vgrow(&qbe_typ, ntyp+1);
+	ty = &qbe_typ[ntyp];
+	getname(ty->name);
+	ty->isdark = getn(2);
+	ty->isunion = getn(2);
+	ty->align = geti();
+	ty->size = getu();
+	ty->nunion = 0;
+	if (ty->isdark) {
+		ntyp++;
+		return;
+	}
+	n = getn(1 << 16);
+	if (n == 0)
+		binerr();
+	ty->fields = qbe_vnew(n, sizeof ty->fields[0], PHeap);
+	ty->nunion = n;
+	ntyp++;
+	for (i=0; i<n; i++) {
+		fld = ty->fields[i];
+		nf = getn(NField+1);
+		fld[nf].type = FEnd;
+		while (nf--) {
+			fld->type = getn(FTyp+1);
+			fld->len = getu();
+			if (fld->type == FEnd
+			|| (fld->type == FTyp && fld->len >= ntyp-1))
+				binerr();
+			fld++;
+		}
+	}
+}
+
+static void
+getdat(void data(Dat *))
+{
+	static _Thread_local char *name;
+	static _Thread_local Lnk lnk;
+	Dat d;
+
+	memset(&d, 0, sizeof d);
+	d.type = getn(DZ+1);
+	if (d.type == DStart)
+		name = getstr();
+	else if (!name)
+		binerr();
+	d.name = name;
+	d.lnk = &lnk;
+	switch (d.type) {
+	case DStart:
+		lnk = (Lnk){0};
+		lnk.export = getn(2);
+		lnk.align = getn(128);
+		break;
+	case DEnd:
+		name = 0;
+		break;
+	default:
+		d.isstr = getn(2);
+		d.isref = getn(2);
+		if (d.isstr)
+			d.u.str = getstr();
+		else if (d.isref) {
+			d.u.ref.name = getstr();
+			d.u.ref.off = geti();
+		} else
+			d.u.num = geti();
+		break;
+	}
+	data(&d);
+}
+
+static Fn *
+getfn(void)
+{
+	Blk **blk, *b, **blink;
+	Phi *p, **plink;
+	Fn *fn;
+	Con *c;
+	Ins *i;
+	Ref r;
+	uint a, n, nb, ntmp, ncon;
+	int t;
+
+	fn = qbe_alloc(sizeof *fn);
+	getname(fn->name);
+	fn->lnk.export = getn(2);
+	fn->vararg = getn(2);
+	fn->retty = geti();
+	if (fn->retty < -1 || fn->retty >= (int)ntyp)
+		binerr();
+	fn->linenr = getu();
+
+	ntmp = getn(1 << 28);
+	ncon = getn(1 << 28);
+	fn->ntmp = 0;
+	fn->ncon = 2 + ncon;
+	fn->tmp = qbe_vnew(Tmp0 + ntmp, sizeof fn->tmp[0], PFn);
+	fn->con = qbe_vnew(fn->ncon, sizeof fn->con[0], PFn);
+	for (t=0; t<Tmp0; ++t)
+		if (qbe_T.fpr0 <= t && t < qbe_T.fpr0 + qbe_T.nfpr)
+			qbe_newtmp(0, Kd, fn);
+		else
+			qbe_newtmp(0, Kl, fn);
+	for (n=0; n<ntmp; n++) {
+		r = qbe_newtmp(0, Kx, fn);
+		qbe_strf(fn->tmp[r.val].name, ".%u", n);
+	}
+	fn->con[0].type = CBits;
+	fn->con[0].bits.i = 0xdeaddead; /* UNDEF */
+	fn->con[1].type = CBits;
+	for (c=&fn->con[2]; c<&fn->con[fn->ncon]; c++) {
+		n = getn((CAddr+1) << 2);
+		c->type = n >> 2;
+		c->flt = n & 3;
+		if (c->flt == 3)
+			binerr();
+		if (c->type == CAddr) {
+			c->sym.type = getn(SThr+1);
+			c->sym.id = qbe_intern(getstr());
+		}
+		c->bits.i = geti();
+	}
+
+	fn->nblk = getn(1 << 28);
+	if (fn->nblk == 0)
+		binerr();
+	blk = qbe_vnew(fn->nblk, sizeof blk[0], PFn);
+	for (n=0; n<fn->nblk; n++) {
+		blk[n] = qbe_newblk();
+		blk[n]->id = n;
+	}
+	blink = &fn->start;
+	for (nb=0; nb<fn->nblk; nb++) {
+		b = blk[getn(fn->nblk)];
+		if (b->name[0])
+			binerr();
+		getname(b->name);
+		if (!b->name[0])
+			binerr();
+		*blink = b;
+		blink = &b->link;
+
+		plink = &b->phi;
+		for (n=getn(1 << 28); n>0; n--) {
+			p = qbe_alloc(sizeof *p);
+			p->to = getref(fn);
+			p->cls = getn(Kd+1);
+			p->narg = getn(1 << 28);
+			p->arg = qbe_vnew(p->narg, sizeof p->arg[0], PFn);
+			p->blk = qbe_vnew(p->narg, sizeof p->blk[0], PFn);
+			for (a=0; a<p->narg; a++) {
+				p->blk[a] = blk[getn(fn->nblk)];
+				p->arg[a] = getref(fn);
+			}
+			*plink = p;
+			plink = &p->link;
+		}
+
+		b->nins = getn(1 << 28); // @shoumodip
+		b->ins = qbe_vnew(b->nins, sizeof b->ins[0], PFn);
+		for (i=b->ins; i<&b->ins[b->nins]; i++) {
+			n = getn(NOp << 2);
+			i->op = n >> 2;
+			i->cls = n & 3;
+			i->to = getref(fn);
+			i->arg[0] = getref(fn);
+			i->arg[1] = getref(fn);
+		}
+
+		b->jmp.type = getn(NJmp);
+		if (b->jmp.type == Jxxx)
+			binerr();
+		b->jmp.arg = getref(fn);
+		n = getn(fn->nblk+1);
+		b->s1 = n ? blk[n-1] : 0;
+		n = getn(fn->nblk+1);
+		b->s2 = n ? blk[n-1] : 0;
+	}
+
+	fn->mem = qbe_vnew(0, sizeof fn->mem[0], PFn);
+	fn->nmem = 0;
+	fn->rpo = 0;
+	qbe_typecheck(fn);
+	return fn;
+}
+
+int
+qbe_bincheck(void *buf, size_t len)
+{
+	uchar *p;
+
+	p = buf;
+	return len > 4
+		&& memcmp(p, BinMagic, 4) == 0
+		&& p[4] == BinVersion;
+}
+
+void
+qbe_parsebin(void *buf, size_t len, void dbgfile(char *), void data(Dat *), void func(Fn *))
+{
+	uint n;
+
+	if (!qbe_bincheck(buf, len))
+		binerr();
+	bp = (uchar *)buf + 5;
+	bend = (uchar *)buf + len;
+	ntyp = 0;
+	qbe_typ = qbe_vnew(0, sizeof qbe_typ[0], PHeap);
+	for (;;)
+		switch (getn(BinFn+1)) {
+		case BinTyp:
+			gettyp();
+			break;
+		case BinDbg:
+			dbgfile(getstr());
+			break;
+		case BinDat:
+			getdat(data);
+			break;
+		case BinFn:
+			func(getfn());
+			break;
+		case BinEnd:
+			for (n=0; n<ntyp; n++)
+				if (qbe_typ[n].nunion)
+					qbe_vfree(qbe_typ[n].fields);
+			qbe_vfree(qbe_typ);
+			return;
+		}
+}
@@ -15,18 +15,18 @@ struct RMap {
 	int n;
 };
 
-static bits regu;      /* registers used */
-static Tmp *tmp;       /* function temporaries */
-static Mem *mem;       /* function mem references */
-static struct {
+static _Thread_local bits regu;      /* registers used */
+static _Thread_local Tmp *tmp;       /* function temporaries */
+static _Thread_local Mem *mem;       /* function mem references */
+static _Thread_local struct {
 	Ref src, dst;
 	int cls;
 } pm[Tmp0];            /* parallel move constructed */
-static int npm;        /* size of pm */
-static int loop;       /* current loop level */
+static _Thread_local int npm;        /* size of pm */
+static _Thread_local int loop;       /* current loop level */
 
-static uint stmov;     /* stats: added moves */
-static uint stblk;     /* stats: added blocks */
+static _Thread_local uint stmov;     /* stats: added moves */
+static _Thread_local uint stblk;     /* stats: added blocks */
 
 static int *
 hint(int t)
@@ -363,7 +363,7 @@ doblk(Blk *b, RMap *cur)
 
 	if (rtype(b->jmp.arg) == RTmp)
 		b->jmp.arg = ralloc(cur, b->jmp.arg.val);
-	qbe_curi = &qbe_insb[NIns];
+	qbe_insreset(b->nins); // @shoumodip
 	for (i1=&b->ins[b->nins]; i1!=b->ins;) {
 		qbe_emiti(*--i1);
 		i = qbe_curi;
@@ -439,7 +439,7 @@ doblk(Blk *b, RMap *cur)
 			 * the above loop must be changed */
 		}
 	}
-	b->nins = &qbe_insb[NIns] - qbe_curi;
+	b->nins = qbe_inse - qbe_curi;
 	qbe_idup(&b->ins, qbe_curi, b->nins);
 }
 
@@ -610,9 +610,9 @@ qbe_rega(Fn *fn)
 				qbe_bsset(m->b, x);
 			}
 		}
-		qbe_curi = &qbe_insb[NIns];
+		qbe_insreset(npm); // @shoumodip
 		pmgen();
-		j = &qbe_insb[NIns] - qbe_curi;
+		j = qbe_inse - qbe_curi;
 		if (j == 0)
 			continue;
 		stmov += j;
@@ -661,9 +661,9 @@ qbe_rega(Fn *fn)
 				dst = rref(&beg[s->id], t);
 				pmadd(src, dst, tmp[t].cls);
 			}
-			qbe_curi = &qbe_insb[NIns];
+			qbe_insreset(npm); // @shoumodip
 			pmgen();
-			if (qbe_curi == &qbe_insb[NIns])
+			if (qbe_curi == qbe_inse)
 				continue;
 			b1 = qbe_newblk();
 			b1->loop = (b->loop+s->loop) / 2;
@@ -671,7 +671,7 @@ qbe_rega(Fn *fn)
 			blist = b1;
 			fn->nblk++;
 			qbe_strf(b1->name, "%s_%s", b->name, s->name);
-			b1->nins = &qbe_insb[NIns] - qbe_curi;
+			b1->nins = qbe_inse - qbe_curi;
 			stmov += b1->nins;
 			stblk += 1;
 			qbe_idup(&b1->ins, qbe_curi, b1->nins);
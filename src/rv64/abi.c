@@ -486,7 +486,7 @@ selpar(Fn *fn, Ins *i0, Ins *i1)
 
 	ca = qbe_alloc((i1-i0) * sizeof ca[0]);
 	cr.class = 0;
-	qbe_curi = &qbe_insb[NIns];
+	qbe_insreset(i1-i0); // @shoumodip
 
 	if (fn->retty >= 0) {
 		typclass(&cr, &qbe_typ[fn->retty], 1, gpreg, fpreg);
@@ -600,9 +600,9 @@ qbe_rv64_abi(Fn *fn)
 		if (!ispar(i->op))
 			break;
 	p = selpar(fn, b->ins, i);
-	n = b->nins - (i - b->ins) + (&qbe_insb[NIns] - qbe_curi);
+	n = b->nins - (i - b->ins) + (qbe_inse - qbe_curi);
 	i0 = qbe_alloc(n * sizeof(Ins));
-	ip = qbe_icpy(ip = i0, qbe_curi, &qbe_insb[NIns] - qbe_curi);
+	ip = qbe_icpy(ip = i0, qbe_curi, qbe_inse - qbe_curi);
 	ip = qbe_icpy(ip, i, &b->ins[b->nins] - i);
 	b->nins = n;
 	b->ins = i0;
@@ -615,7 +615,7 @@ qbe_rv64_abi(Fn *fn)
 			b = fn->start; /* do it last */
 		if (b->visit)
 			continue;
-		qbe_curi = &qbe_insb[NIns];
+		qbe_insreset(b->nins); // @shoumodip
 		selret(b, fn);
 		for (i=&b->ins[b->nins]; i!=b->ins;)
 			switch ((--i)->op) {
@@ -642,7 +642,7 @@ qbe_rv64_abi(Fn *fn)
 		if (b == fn->start)
 			for (; il; il=il->link)
 				qbe_emiti(il->i);
-		b->nins = &qbe_insb[NIns] - qbe_curi;
+		b->nins = qbe_inse - qbe_curi;
 		qbe_idup(&b->ins, qbe_curi, b->nins);
 	} while (b != fn->start);
 
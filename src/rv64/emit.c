@@ -447,7 +447,6 @@ emitins(Ins *i, Fn *fn, FILE *f)
 void
 qbe_rv64_emitfn(Fn *fn, FILE *f)
 {
-	static int id0;
 	int lbl, neg, off, frame, *pr, r;
 	Blk *b, *s;
 	Ins *i;
@@ -500,7 +499,7 @@ qbe_rv64_emitfn(Fn *fn, FILE *f)
 
 	for (lbl=0, b=fn->start; b; b=b->link) {
 		if (lbl || b->npred > 1)
-			fprintf(f, ".L%d:\n", id0+b->id);
+			fprintf(f, ".L%d:\n", qbe_ctx->id0+b->id);
 		for (i=b->ins; i!=&b->ins[b->nins]; i++)
 			emitins(i, fn, f);
 		lbl = 1;
@@ -543,7 +542,7 @@ qbe_rv64_emitfn(Fn *fn, FILE *f)
 		case Jjmp:
 		Jmp:
 			if (b->s1 != b->link)
-				fprintf(f, "\tj .L%d\n", id0+b->s1->id);
+				fprintf(f, "\tj .L%d\n", qbe_ctx->id0+b->s1->id);
 			else
 				lbl = 0;
 			break;
@@ -560,11 +559,11 @@ qbe_rv64_emitfn(Fn *fn, FILE *f)
 				"\tb%sz %s, .L%d\n",
 				neg ? "ne" : "eq",
 				rname[b->jmp.arg.val],
-				id0+b->s2->id
+				qbe_ctx->id0+b->s2->id
 			);
 			goto Jmp;
 		}
 	}
-	id0 += fn->nblk;
+	qbe_ctx->id0 += fn->nblk;
 	qbe_elf_emitfnfin(fn->name, f);
 }
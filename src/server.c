@@ -0,0 +1,350 @@
+// Copyright (C) 2025 Shoumodip Kar <shoumodipkar@gmail.com>
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "all.h"
+#include "qbe.h"
+
+// Protocol
+//
+// A connection carries any number of requests, each answered before the next one is read. The
+// integers are in the byte order of the host, since both ends are on the same machine
+#define QBE_SERVE_MAGIC 0x53454251 // "QBES"
+#define QBE_SERVE_LIMIT (1ull << 30) // Of a program, anything larger drops the connection
+
+typedef struct {
+    uint32_t magic;
+    uint32_t target;
+    uint32_t object;
+    uint32_t reserved;
+    uint64_t count; // Of the program that follows
+} QbeRequest;
+
+typedef struct {
+    uint64_t code;
+    uint64_t count; // Of the output that follows
+} QbeResponse;
+
+#ifdef MSG_NOSIGNAL
+#    define QBE_SEND_FLAGS MSG_NOSIGNAL
+#else
+#    define QBE_SEND_FLAGS 0 // SO_NOSIGPIPE is set on the socket instead
+#endif
+
+static bool qbe_send_all(int fd, const void *data, size_t count) {
+    const char *it = data;
+    while (count) {
+        const ssize_t n = send(fd, it, count, QBE_SEND_FLAGS);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            return false;
+        }
+
+        it += n;
+        count -= n;
+    }
+    return true;
+}
+
+static bool qbe_recv_all(int fd, void *data, size_t count) {
+    char *it = data;
+    while (count) {
+        const ssize_t n = recv(fd, it, count, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            return false;
+        }
+
+        it += n;
+        count -= n;
+    }
+    return true;
+}
+
+static bool qbe_reserve(char **data, size_t *capacity, size_t count) {
+    if (count > *capacity) {
+        char *grown = realloc(*data, count);
+        if (!grown) {
+            return false;
+        }
+        *data = grown;
+        *capacity = count;
+    }
+    return true;
+}
+
+static bool qbe_socket_address(struct sockaddr_un *addr, const char *path) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        return false;
+    }
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+// Server
+//
+// The workers are processes rather than threads, since the backend exits on a malformed program. A
+// worker that died is replaced by the supervisor, and its client sees the connection close. Every
+// worker accepts from the same socket and keeps its context, with the incremental cache, across all
+// the requests it serves
+static volatile sig_atomic_t qbe_serve_quit;
+
+static void qbe_serve_stop(int sig) {
+    (void) sig;
+    qbe_serve_quit = 1;
+}
+
+static void qbe_serve_connection(int fd) {
+    char  *program = NULL;
+    size_t capacity = 0;
+
+    QbeRequest request;
+    while (qbe_recv_all(fd, &request, sizeof(request)) && request.magic == QBE_SERVE_MAGIC) {
+        // The program is not read, so the stream cannot be resynchronized
+        if (request.count > QBE_SERVE_LIMIT || !qbe_reserve(&program, &capacity, request.count) ||
+            !qbe_recv_all(fd, program, request.count)) {
+            break;
+        }
+
+        char  *output = NULL;
+        size_t output_count = 0;
+        FILE  *f = open_memstream(&output, &output_count);
+
+        int code = 1;
+        if (f) {
+            setvbuf(f, NULL, _IOFBF, 1 << 16);
+            code = qbe_generate_request(program, request.count, request.target, request.object, f);
+            code |= fclose(f) != 0;
+        }
+
+        const QbeResponse response = {.code = code, .count = code ? 0 : output_count};
+        const bool        sent = qbe_send_all(fd, &response, sizeof(response)) &&
+                          qbe_send_all(fd, output, response.count);
+        free(output);
+        if (!sent) {
+            break;
+        }
+    }
+
+    free(program);
+}
+
+static void __attribute__((noreturn)) qbe_serve_worker(int listener) {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGPIPE, SIG_IGN);
+
+    qbe_ctx = qbe_ctxnew(NULL);
+    qbe_cachemem(1);
+
+    for (;;) {
+        const int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            _exit(1);
+        }
+
+        qbe_serve_connection(fd);
+        close(fd);
+    }
+}
+
+static pid_t qbe_serve_spawn(int listener) {
+    const pid_t pid = fork();
+    if (pid == 0) {
+        qbe_serve_worker(listener);
+    }
+    return pid > 0 ? pid : 0;
+}
+
+int qbe_serve(const char *path, size_t workers) {
+    if (!workers) {
+        const long n = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = n > 0 ? n : 1;
+    }
+
+    struct sockaddr_un addr;
+    if (!qbe_socket_address(&addr, path)) {
+        return 1;
+    }
+
+    // A socket left behind by a server that is gone is replaced, anything else is not touched
+    struct stat st;
+    if (!stat(path, &st) && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        return 1;
+    }
+
+    if (bind(listener, (struct sockaddr *) &addr, sizeof(addr)) || listen(listener, SOMAXCONN)) {
+        close(listener);
+        return 1;
+    }
+
+    // Without SA_RESTART, so that the supervisor wakes up from waitpid()
+    struct sigaction stop = {.sa_handler = qbe_serve_stop}, old_int, old_term;
+    sigemptyset(&stop.sa_mask);
+    qbe_serve_quit = 0;
+    sigaction(SIGINT, &stop, &old_int);
+    sigaction(SIGTERM, &stop, &old_term);
+
+    pid_t *pids = calloc(workers, sizeof(*pids));
+    assert(pids && "Out of memory");
+    while (!qbe_serve_quit) {
+        // A slot whose fork() failed is retried every second, rather than shrinking the pool for good
+        bool missing = false;
+        for (size_t i = 0; i < workers; i++) {
+            if (!pids[i]) {
+                pids[i] = qbe_serve_spawn(listener);
+                missing |= !pids[i];
+            }
+        }
+
+        const pid_t pid = waitpid(-1, NULL, missing ? WNOHANG : 0);
+        if (pid < 0 && errno != EINTR && !(missing && errno == ECHILD)) {
+            break;
+        }
+
+        if (pid <= 0) {
+            if (missing) {
+                sleep(1);
+            }
+            continue;
+        }
+
+        for (size_t i = 0; i < workers; i++) {
+            if (pids[i] == pid) {
+                pids[i] = 0;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < workers; i++) {
+        if (pids[i]) {
+            kill(pids[i], SIGTERM);
+            waitpid(pids[i], NULL, 0);
+        }
+    }
+    free(pids);
+
+    close(listener);
+    unlink(path);
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+    return 0;
+}
+
+// Client
+struct QbeClient {
+    int    fd;
+    char  *output;
+    size_t capacity;
+};
+
+QbeClient *qbe_client_new(const char *path) {
+    struct sockaddr_un addr;
+    if (!qbe_socket_address(&addr, path)) {
+        return NULL;
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+
+#ifdef SO_NOSIGPIPE
+    const int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr))) {
+        close(fd);
+        return NULL;
+    }
+
+    QbeClient *c = calloc(1, sizeof(*c));
+    assert(c && "Out of memory");
+    c->fd = fd;
+    return c;
+}
+
+int qbe_client_generate(QbeClient *c, QbeSV program, QbeTarget target, bool object, QbeSV *out) {
+    *out = (QbeSV) {0};
+    if (c->fd < 0) {
+        return 1;
+    }
+
+    const QbeRequest request = {
+        .magic = QBE_SERVE_MAGIC,
+        .target = target,
+        .object = object,
+        .count = program.count,
+    };
+
+    QbeResponse response;
+    if (!qbe_send_all(c->fd, &request, sizeof(request)) ||
+        !qbe_send_all(c->fd, program.data, program.count) ||
+        !qbe_recv_all(c->fd, &response, sizeof(response)) ||
+        !qbe_reserve(&c->output, &c->capacity, response.count) ||
+        !qbe_recv_all(c->fd, c->output, response.count)) {
+        // The stream is out of sync, or the worker is gone
+        close(c->fd);
+        c->fd = -1;
+        return 1;
+    }
+
+    if (response.code) {
+        return response.code;
+    }
+
+    *out = (QbeSV) {.data = c->output, .count = response.count};
+    return 0;
+}
+
+void qbe_client_free(QbeClient *c) {
+    if (c) {
+        if (c->fd >= 0) {
+            close(c->fd);
+        }
+        free(c->output);
+        free(c);
+    }
+}
@@ -14,6 +14,7 @@ blit(Ref sd[2], int sz, Fn *fn)
 
 	fwd = sz >= 0;
 	sz = abs(sz);
+	qbe_insgrow(4 * (sz/8 + 3)); // @shoumodip
 	off = fwd ? sz : 0;
 	for (p=tbl; sz; p++)
 		for (n=p->size; sz>=n; sz-=n) {
@@ -45,7 +46,7 @@ ins(Ins **pi, int *new, Blk *b, Fn *fn)
 		assert(i > b->ins);
 		assert((i-1)->op == Oblit0);
 		if (!*new) {
-			qbe_curi = &qbe_insb[NIns];
+			qbe_insreset(b->nins); // @shoumodip
 			ni = &b->ins[b->nins] - (i+1);
 			qbe_curi -= ni;
 			qbe_icpy(qbe_curi, i+1, ni);
@@ -75,7 +76,7 @@ qbe_simpl(Fn *fn)
 			ins(&i, &new, b, fn);
 		}
 		if (new) {
-			b->nins = &qbe_insb[NIns] - qbe_curi;
+			b->nins = qbe_inse - qbe_curi;
 			qbe_idup(&b->ins, qbe_curi, b->nins);
 		}
 	}
@@ -94,13 +94,13 @@ qbe_fillcost(Fn *fn)
 	}
 }
 
-static BSet *fst; /* temps to prioritize in registers (for tcmp1) */
-static Tmp *tmp;  /* current temporaries (for tcmpX) */
-static int ntmp;  /* current # of temps (for limit) */
-static int locs;  /* stack size used by locals */
-static int slot4; /* next slot of 4 bytes */
-static int slot8; /* ditto, 8 bytes */
-static BSet mask[2][1]; /* class masks */
+static _Thread_local BSet *fst; /* temps to prioritize in registers (for tcmp1) */
+static _Thread_local Tmp *tmp;  /* current temporaries (for tcmpX) */
+static _Thread_local int ntmp;  /* current # of temps (for limit) */
+static _Thread_local int locs;  /* stack size used by locals */
+static _Thread_local int slot4; /* next slot of 4 bytes */
+static _Thread_local int slot8; /* ditto, 8 bytes */
+static _Thread_local BSet mask[2][1]; /* class masks */
 
 static int
 tcmp0(const void *pa, const void *pb)
@@ -164,17 +164,18 @@ slot(int t)
 static void
 limit(BSet *b, int k, BSet *f)
 {
-	static int *tarr, maxt;
-	int i, t, nt;
+	int i, t, nt, *tarr;
 
 	nt = qbe_bscount(b);
 	if (nt <= k)
 		return;
-	if (nt > maxt) {
-		free(tarr);
-		tarr = qbe_emalloc(nt * sizeof tarr[0]);
-		maxt = nt;
+	// @shoumodip: kept in the context, so that it goes with it
+	if (nt > qbe_ctx->maxt) {
+		qbe_memfree(qbe_ctx->tarr);
+		qbe_ctx->tarr = qbe_emalloc(nt * sizeof qbe_ctx->tarr[0]);
+		qbe_ctx->maxt = nt;
 	}
+	tarr = qbe_ctx->tarr;
 	for (i=0, t=0; qbe_bsiter(b, &t); t++) {
 		qbe_bsclr(b, t);
 		tarr[i++] = t;
@@ -426,7 +427,7 @@ qbe_spill(Fn *fn)
 			}
 			reloads(u, v);
 		}
-		qbe_curi = &qbe_insb[NIns];
+		qbe_insreset(b->nins); // @shoumodip
 		for (i=&b->ins[b->nins]; i!=b->ins;) {
 			i--;
 			if (regcpy(i)) {
@@ -517,7 +518,7 @@ qbe_spill(Fn *fn)
 				p->to = slot(p->to.val);
 		}
 		qbe_bscopy(b->in, v);
-		b->nins = &qbe_insb[NIns] - qbe_curi;
+		b->nins = qbe_inse - qbe_curi;
 		qbe_idup(&b->ins, qbe_curi, b->nins);
 	}
 
@@ -197,7 +197,7 @@ phiins(Fn *fn)
 			}
 		}
 	}
-	free(blist);
+	qbe_memfree(blist); // @shoumodip
 }
 
 typedef struct Name Name;
@@ -207,7 +207,7 @@ struct Name {
 	Name *up;
 };
 
-static Name *namel;
+static _Thread_local Name *namel;
 
 static Name *
 nnew(Ref r, Blk *b, Name *up)
@@ -218,10 +218,7 @@ nnew(Ref r, Blk *b, Name *up)
 		n = namel;
 		namel = n->up;
 	} else
-		/* could use alloc, here
-		 * but namel should be reset
-		 */
-		n = qbe_emalloc(sizeof *n);
+		n = qbe_alloc(sizeof *n); // @shoumodip: namel is reset by qbe_ssa()
 	n->r = r;
 	n->b = b;
 	n->up = up;
@@ -320,6 +317,7 @@ qbe_ssa(Fn *fn)
 
 	nt = fn->ntmp;
 	stk = qbe_emalloc(nt * sizeof stk[0]);
+	namel = 0; // @shoumodip
 	d = qbe_debug['L'];
 	qbe_debug['L'] = 0;
 	qbe_filldom(fn);
@@ -344,7 +342,7 @@ qbe_ssa(Fn *fn)
 			nfree(n);
 		}
 	qbe_debug['L'] = d;
-	free(stk);
+	qbe_memfree(stk); // @shoumodip
 	if (qbe_debug['N']) {
 		fprintf(stderr, "\n> After SSA construction:\n");
 		qbe_printfn(fn, stderr);
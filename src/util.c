@@ -1,9 +1,14 @@
 #include "all.h"
 #include <stdarg.h>
+#include <stddef.h>
+
+// @shoumodip: For the kernels of the sets
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 typedef struct Bitset Bitset;
 typedef struct Vec Vec;
-typedef struct Bucket Bucket;
 
 struct Vec {
 	ulong mag;
@@ -17,28 +22,11 @@ struct Vec {
 	} align[];
 };
 
-struct Bucket {
-	uint nstr;
-	char **str;
-};
-
 enum {
 	VMin = 2,
 	VMag = 0xcabba9e,
-	NPtr = 256,
-	IBits = 12,
-	IMask = (1<<IBits) - 1,
 };
 
-Typ *qbe_typ;
-Ins qbe_insb[NIns], *qbe_curi;
-
-static void *ptr[NPtr];
-static void **pool = ptr;
-static int nptr = 1;
-
-static Bucket itbl[IMask+1]; /* string interning table */
-
 uint32_t
 qbe_hash(char *s)
 {
@@ -62,50 +50,170 @@ qbe_die_(char *file, char *s, ...)
 	abort();
 }
 
+// Modification BEGIN
+// Copyright (C) 2025 Shoumodip Kar <shoumodipkar@gmail.com>
+
+// Every allocation is preceded by its size and the account it's charged to, so that the allocator
+// gets the size back on free and the account is right whichever context frees it
+typedef struct {
+	size_t  size;
+	size_t *account;
+} MemHdr;
+
+static_assert(sizeof(MemHdr) == 16, "The allocations must stay aligned");
+
+static void *(*mem_alloc)(void *, size_t);
+static void *(*mem_realloc)(void *, void *, size_t, size_t);
+static void (*mem_free)(void *, void *, size_t);
+static void *mem_user;
+
+void
+qbe_memhooks(void *(*alloc)(void *, size_t), void *(*realloc)(void *, void *, size_t, size_t), void (*free)(void *, void *, size_t), void *user)
+{
+	mem_alloc = alloc;
+	mem_realloc = realloc;
+	mem_free = free;
+	mem_user = user;
+}
+
+static void
+charge(size_t *account, ptrdiff_t n)
+{
+	if (account) {
+		__atomic_add_fetch(account, n, __ATOMIC_RELAXED);
+	}
+}
+
+// Zeroed, like the calloc() it replaces
 void *
-qbe_emalloc(size_t n)
+qbe_memalloc(size_t *account, size_t n)
 {
-	void *p;
+	MemHdr *h;
+	if (mem_alloc) {
+		h = mem_alloc(mem_user, sizeof(*h) + n);
+		if (h) {
+			memset(h, 0, sizeof(*h) + n);
+		}
+	} else {
+		h = calloc(1, sizeof(*h) + n);
+	}
 
-	p = calloc(1, n);
-	if (!p)
+	if (!h)
 		die("emalloc, out of memory");
-	return p;
+	h->size = n;
+	h->account = account;
+	charge(account, n);
+	return h + 1;
 }
 
+// The account is only used when p is NULL, otherwise the allocation stays in its own
+void *
+qbe_memrealloc(size_t *account, void *p, size_t n)
+{
+	if (!p)
+		return qbe_memalloc(account, n);
+
+	MemHdr *h = (MemHdr *) p - 1;
+	const size_t size = h->size;
+	h = mem_realloc ? mem_realloc(mem_user, h, sizeof(*h) + size, sizeof(*h) + n) : realloc(h, sizeof(*h) + n);
+	if (!h)
+		die("erealloc, out of memory");
+	h->size = n;
+	charge(h->account, (ptrdiff_t) n - (ptrdiff_t) size);
+	return h + 1;
+}
+
+void
+qbe_memfree(void *p)
+{
+	if (!p)
+		return;
+
+	MemHdr *h = (MemHdr *) p - 1;
+	charge(h->account, -(ptrdiff_t) h->size);
+	if (mem_free)
+		mem_free(mem_user, h, sizeof(*h) + h->size);
+	else
+		free(h);
+}
+// Modification END
+
+void *
+qbe_emalloc(size_t n)
+{
+	return qbe_memalloc(qbe_ctx ? qbe_ctx->mem : 0, n); // @shoumodip
+}
+
+// @shoumodip
+void *
+qbe_erealloc(void *p, size_t n)
+{
+	return qbe_memrealloc(qbe_ctx ? qbe_ctx->mem : 0, p, n);
+}
+
+// Modification BEGIN
+// Copyright (C) 2025 Shoumodip Kar <shoumodipkar@gmail.com>
+static_assert(sizeof(Chunk) % 16 == 0, "The allocations must stay aligned");
+
+static void
+chunkfree(Chunk *c)
+{
+	Chunk *next;
+
+	for (; c; c=next) {
+		next = c->next;
+		qbe_memfree(c);
+	}
+}
+
+// Zeroed, like the calloc() it replaces. The spare chunks are only
+// looked at from the top, so that taking one stays O(1)
 void *
 qbe_alloc(size_t n)
 {
-	void **pp;
+	FnPool *p;
+	Chunk *c;
+	size_t sz;
+	void *v;
 
 	if (n == 0)
 		return 0;
-	if (nptr >= NPtr) {
-		pp = qbe_emalloc(NPtr * sizeof(void *));
-		pp[0] = pool;
-		pool = pp;
-		nptr = 1;
+	p = &qbe_ctx->pool;
+	n = (n + 15) & -16;
+	if ((size_t)(p->end - p->cur) < n) {
+		c = qbe_ctx->spare;
+		if (c && c->size >= n)
+			qbe_ctx->spare = c->next;
+		else {
+			sz = n > NChunk ? n : NChunk;
+			c = qbe_emalloc(sizeof *c + sz);
+			c->size = sz;
+		}
+		c->next = p->head;
+		p->head = c;
+		if (!p->tail)
+			p->tail = c;
+		p->cur = (char *)(c + 1);
+		p->end = p->cur + c->size;
 	}
-	return pool[nptr++] = qbe_emalloc(n);
+	v = p->cur;
+	p->cur += n;
+	return memset(v, 0, n);
 }
 
 void
 qbe_freeall(void)
 {
-	void **pp;
+	FnPool *p;
 
-	for (;;) {
-		for (pp = &pool[1]; pp < &pool[nptr]; pp++)
-			free(*pp);
-		pp = pool[0];
-		if (!pp)
-			break;
-		free(pool);
-		pool = pp;
-		nptr = NPtr;
+	p = &qbe_ctx->pool;
+	if (p->head) {
+		p->tail->next = qbe_ctx->spare;
+		qbe_ctx->spare = p->head;
 	}
-	nptr = 1;
+	*p = (FnPool){0};
 }
+// Modification END
 
 void *
 qbe_vnew(ulong len, size_t esz, Pool pool)
@@ -134,7 +242,7 @@ qbe_vfree(void *p)
 	assert(v->mag == VMag);
 	if (v->pool == PHeap) {
 		v->mag = 0;
-		free(v);
+		qbe_memfree(v); // @shoumodip
 	}
 }
 
@@ -169,61 +277,272 @@ qbe_strf(char str[NString], char *s, ...)
 void
 qbe_util_resetall(void)
 {
-    size_t n = (sizeof(itbl) / sizeof(*itbl));
-    for (size_t i = 0; i < n; i++) {
-        Bucket *b = &itbl[i];
-        if (b->nstr) {
-            for (size_t j = 0; j < b->nstr; j++) {
-                free(b->str[j]);
+    Ctx *c = qbe_ctx;
+    if (c->itbl.str) {
+        qbe_vfree(c->itbl.str);
+    }
+    qbe_memfree(c->itbl.tab);
+    chunkfree(c->itbl.chunk);
+    c->itbl = (Interns) {0};
+
+    c->typ = NULL;
+    qbe_memfree(c->insb);
+    c->insb = NULL;
+    c->inse = NULL;
+    c->curi = NULL;
+    chunkfree(c->pool.head);
+    c->pool = (FnPool) {0};
+    chunkfree(c->spare);
+    c->spare = NULL;
+}
+
+Ctx *
+qbe_ctxnew(size_t *mem)
+{
+    Ctx *c = qbe_memalloc(mem, sizeof(*c));
+    c->mem = mem;
+    return c;
+}
+
+static void
+freeargv(char **argv)
+{
+    if (argv) {
+        for (char **it = argv; *it; it++) {
+            free(*it);
+        }
+        free(argv);
+    }
+}
+
+void
+qbe_ctxfree(Ctx *c)
+{
+    if (c) {
+        qbe_memfree(c->tarr);
+        c->tarr = NULL;
+        free(c->asmbuf);
+        c->asmbuf = NULL;
+        freeargv(c->as);
+        freeargv(c->ld);
+
+        Ctx *prev = qbe_ctx;
+        qbe_ctx = c;
+        qbe_util_resetall();
+        qbe_emit_resetall();
+        qbe_cachefree();
+        qbe_ctx = prev;
+
+        qbe_memfree(c);
+    }
+}
+
+// Copies a function into the current pool, so that the passes of another target can run on it. The
+// uses, predecessors and the rest of the derived information are left for the passes to fill in
+Fn *
+qbe_fncopy(Fn *fn)
+{
+    Fn *f = qbe_alloc(sizeof(*f));
+    *f = *fn;
+    f->rpo = NULL;
+
+    f->tmp = qbe_vnew(fn->ntmp, sizeof(*f->tmp), PFn);
+    memcpy(f->tmp, fn->tmp, fn->ntmp * sizeof(*f->tmp));
+    for (int t = 0; t < f->ntmp; t++) {
+        Tmp *tmp = &f->tmp[t];
+        tmp->def = NULL;
+        tmp->use = NULL;
+        if (tmp->alias.slot) {
+            const size_t slot = (Tmp *) ((char *) tmp->alias.slot - offsetof(Tmp, alias)) - fn->tmp;
+            tmp->alias.slot = &f->tmp[slot].alias;
+        }
+
+        // The registers differ between the targets
+        if (t < Tmp0) {
+            tmp->cls = qbe_T.fpr0 <= t && t < qbe_T.fpr0 + qbe_T.nfpr ? Kd : Kl;
+        }
+    }
+
+    f->con = qbe_vnew(fn->ncon, sizeof(*f->con), PFn);
+    memcpy(f->con, fn->con, fn->ncon * sizeof(*f->con));
+    f->conh = NULL;
+    f->nconh = 0;
+    f->nconi = 0;
+    f->mem = qbe_vnew(fn->nmem, sizeof(*f->mem), PFn);
+    memcpy(f->mem, fn->mem, fn->nmem * sizeof(*f->mem));
+
+    // The blocks are numbered in order for the mapping, and the numbers of the original restored later
+    uint nblk = 0;
+    for (Blk *b = fn->start; b; b = b->link) {
+        nblk++;
+    }
+
+    Blk **blk = qbe_emalloc((nblk + 1) * sizeof(*blk));
+    uint *id = qbe_emalloc((nblk + 1) * sizeof(*id));
+    uint  n = 0;
+    for (Blk *b = fn->start; b; b = b->link) {
+        id[n] = b->id;
+        b->id = n;
+        blk[n] = qbe_alloc(sizeof(*blk[n]));
+        *blk[n] = *b;
+        n++;
+    }
+
+    Blk **link = &f->start;
+    for (n = 0; n < nblk; n++) {
+        Blk *b = blk[n];
+        *link = b;
+        link = &b->link;
+
+        b->s1 = b->s1 ? blk[b->s1->id] : NULL;
+        b->s2 = b->s2 ? blk[b->s2->id] : NULL;
+        b->idom = b->dom = b->dlink = NULL;
+        b->fron = NULL;
+        b->nfron = 0;
+        b->pred = NULL;
+        b->npred = 0;
+        memset(b->in, 0, sizeof(b->in));
+        memset(b->out, 0, sizeof(b->out));
+        memset(b->gen, 0, sizeof(b->gen));
+        qbe_idup(&b->ins, b->ins, b->nins);
+
+        Phi **plink = &b->phi;
+        for (Phi *p = b->phi; p; p = p->link) {
+            Phi *c = qbe_alloc(sizeof(*c));
+            *c = *p;
+            c->arg = qbe_vnew(p->narg, sizeof(*c->arg), PFn);
+            c->blk = qbe_vnew(p->narg, sizeof(*c->blk), PFn);
+            memcpy(c->arg, p->arg, p->narg * sizeof(*c->arg));
+            for (uint a = 0; a < p->narg; a++) {
+                c->blk[a] = blk[p->blk[a]->id];
             }
-            qbe_vfree(b->str);
+            *plink = c;
+            plink = &c->link;
         }
+        *plink = NULL;
+    }
+    *link = NULL;
+    f->nblk = nblk;
+
+    n = 0;
+    for (Blk *b = fn->start; b; b = b->link) {
+        b->id = id[n++];
     }
 
-    qbe_typ = NULL;
-    memset(qbe_insb, 0, sizeof(qbe_insb));
-    qbe_curi = NULL;
-    memset(ptr, 0, sizeof(ptr));
-    pool = ptr;
-    nptr = 1;
-    memset(itbl, 0, sizeof(itbl));
+    qbe_memfree(blk);
+    qbe_memfree(id);
+    return f;
 }
 // Modification END
 
+// Modification BEGIN
+// Copyright (C) 2025 Shoumodip Kar <shoumodipkar@gmail.com>
+
+// FNV-1a, mixed down at the end, since the tables are indexed by the low bits. The length is
+// optional
 uint32_t
-qbe_intern(char *s)
+qbe_strhash(char *s, uint32_t *len)
 {
-	Bucket *b;
-	uint32_t h;
-	uint i, n;
+	uint64_t h;
+	char *p;
+
+	h = 0xcbf29ce484222325ull;
+	for (p=s; *p; p++)
+		h = (h ^ (uchar)*p) * 0x100000001b3ull;
+	if (len)
+		*len = p - s;
+	h ^= h >> 29;
+	h *= 0xbf58476d1ce4e5b9ull;
+	return h ^ h >> 32;
+}
 
-	h = qbe_hash(s) & IMask;
-	b = &itbl[h];
-	n = b->nstr;
+static uint32_t *
+strslot(char *s, uint32_t h, uint32_t len)
+{
+	Interns *t;
+	uint32_t i, *p;
+
+	t = &qbe_ctx->itbl;
+	for (i=h;; i++) {
+		p = &t->tab[i & (t->ntab-1)];
+		if (!*p)
+			return p;
+		if (t->str[*p-1].hash == h && t->str[*p-1].len == len)
+		if (memcmp(t->str[*p-1].s, s, len) == 0)
+			return p;
+	}
+}
 
-	for (i=0; i<n; i++)
-		if (strcmp(s, b->str[i]) == 0)
-			return h + (i<<IBits);
+// The strings are never moved, so the pointers of qbe_str() stay valid until the reset
+static char *
+strsave(char *s, uint32_t len)
+{
+	Interns *t;
+	Chunk *c;
+	size_t sz;
+
+	t = &qbe_ctx->itbl;
+	if ((size_t)(t->end - t->cur) <= len) {
+		sz = len >= NChunk ? len+1 : NChunk;
+		c = qbe_emalloc(sizeof *c + sz);
+		c->size = sz;
+		c->next = t->chunk;
+		t->chunk = c;
+		t->cur = (char *)(c + 1);
+		t->end = t->cur + sz;
+	}
+	s = memcpy(t->cur, s, len+1);
+	t->cur += len+1;
+	return s;
+}
 
-	if (n == 1<<(32-IBits))
-		die("interning table overflow");
-	if (n == 0)
-		b->str = qbe_vnew(1, sizeof b->str[0], PHeap);
-	else if ((n & (n-1)) == 0)
-		qbe_vgrow(&b->str, n+n);
+// The numbers are indices in the order of interning, so they do not change when the table grows
+uint32_t
+qbe_intern(char *s)
+{
+	Interns *t;
+	uint32_t h, len, i, n, *p;
+	uint32_t *tab, ntab;
+
+	t = &qbe_ctx->itbl;
+	h = qbe_strhash(s, &len);
+	if (t->tab) {
+		p = strslot(s, h, len);
+		if (*p)
+			return *p-1;
+	}
 
-	b->str[n] = qbe_emalloc(strlen(s)+1);
-	b->nstr = n + 1;
-	strcpy(b->str[n], s);
-	return h + (n<<IBits);
+	n = t->nstr;
+	if (n == UINT32_MAX - 1)
+		die("interning table overflow");
+	if (2 * (n + 1) > t->ntab) {
+		tab = t->tab;
+		ntab = t->ntab;
+		t->ntab = ntab ? 2 * ntab : 1024;
+		t->tab = qbe_emalloc(t->ntab * sizeof t->tab[0]);
+		for (i=0; i<ntab; i++)
+			if (tab[i])
+				*strslot(t->str[tab[i]-1].s, t->str[tab[i]-1].hash, t->str[tab[i]-1].len) = tab[i];
+		qbe_memfree(tab);
+	}
+	if (!t->str)
+		t->str = qbe_vnew(0, sizeof t->str[0], PHeap);
+	qbe_vgrow(&t->str, n+1);
+	t->str[n].s = strsave(s, len);
+	t->str[n].hash = h;
+	t->str[n].len = len;
+	t->nstr = n + 1;
+	*strslot(s, h, len) = n + 1;
+	return n;
 }
 
 char *
 qbe_str(uint32_t id)
 {
-	assert(id>>IBits < itbl[id&IMask].nstr);
-	return itbl[id&IMask].str[id>>IBits];
+	assert(id < qbe_ctx->itbl.nstr);
+	return qbe_ctx->itbl.str[id].s;
 }
+// Modification END
 
 int
 qbe_isreg(Ref r)
@@ -261,6 +580,61 @@ qbe_argcls(Ins *i, int n)
 	return qbe_optab[i->op].argcls[n][i->cls];
 }
 
+// Modification BEGIN
+// Copyright (C) 2025 Shoumodip Kar <shoumodipkar@gmail.com>
+
+// The passes fill the instruction buffer backwards and the parsers forwards, keeping the
+// instructions on the filled side when it grows. It is only ever grown while the passes hold no
+// pointers into it, that is when a block starts or right before a blit is expanded, and is sized from
+// the block so that the instructions emitted for it fit
+static void
+insgrow(ulong cap, int fwd)
+{
+	Ins *b;
+	ulong ncap, n;
+
+	ncap = qbe_inse - qbe_insb;
+	if (cap <= ncap)
+		return;
+	if (cap < 2 * ncap)
+		cap = 2 * ncap;
+	b = qbe_emalloc(cap * sizeof b[0]);
+	if (fwd) {
+		n = qbe_curi ? qbe_curi - qbe_insb : 0;
+		qbe_curi = qbe_icpy(b, qbe_insb, n);
+	} else {
+		n = qbe_curi ? qbe_inse - qbe_curi : 0;
+		qbe_curi = &b[cap - n];
+		qbe_icpy(qbe_curi, qbe_inse - n, n);
+	}
+	qbe_memfree(qbe_insb);
+	qbe_insb = b;
+	qbe_inse = &b[cap];
+}
+
+// Empties the buffer, with room for the instructions emitted from a block of n
+void
+qbe_insreset(uint n)
+{
+	qbe_curi = qbe_inse;
+	insgrow(4 * (ulong)n + NIns, 0);
+}
+
+// Room for n more instructions before qbe_curi
+void
+qbe_insgrow(uint n)
+{
+	insgrow((qbe_inse - qbe_curi) + n, 0);
+}
+
+// Room for n more instructions after qbe_curi
+void
+qbe_insfit(uint n)
+{
+	insgrow((qbe_curi - qbe_insb) + n, 1);
+}
+// Modification END
+
 void
 qbe_emit(int op, int k, Ref to, Ref arg0, Ref arg1)
 {
@@ -363,14 +737,13 @@ qbe_phicls(int t, Tmp *tmp)
 Ref
 qbe_newtmp(char *prfx, int k,  Fn *fn)
 {
-	static int n;
 	int t;
 
 	t = fn->ntmp++;
 	qbe_vgrow(&fn->tmp, fn->ntmp);
 	memset(&fn->tmp[t], 0, sizeof(Tmp));
 	if (prfx)
-		qbe_strf(fn->tmp[t].name, "%s.%d", prfx, ++n);
+		qbe_strf(fn->tmp[t].name, "%s.%d", prfx, ++qbe_ctx->ntmpname);
 	fn->tmp[t].cls = k;
 	fn->tmp[t].slot = -1;
 	fn->tmp[t].nuse = +1;
@@ -391,37 +764,88 @@ qbe_symeq(Sym s0, Sym s1)
 	return s0.type == s1.type && s0.id == s1.id;
 }
 
-Ref
-qbe_newcon(Con *c0, Fn *fn)
+// Modification BEGIN
+// Copyright (C) 2025 Shoumodip Kar <shoumodipkar@gmail.com>
+
+// The constants are looked up through a hash index instead of a scan. Constants appended to con
+// directly, like by the parsers and the instruction selection, are indexed on the next lookup. Only
+// the first of equal constants is indexed, so the same one is found as by a scan
+static uint
+conhash(Con *c)
+{
+	uint64_t h;
+
+	h = (uint64_t)c->bits.i * 0x9e3779b97f4a7c15ull;
+	h ^= ((uint64_t)c->sym.id << 8 | c->sym.type << 4 | c->type) * 0xc2b2ae3d27d4eb4full;
+	return h ^ h >> 32;
+}
+
+static int *
+conslot(Con *c, Fn *fn)
 {
 	Con *c1;
-	int i;
+	uint h;
+	int *s;
+
+	for (h=conhash(c);; h++) {
+		s = &fn->conh[h & (fn->nconh-1)];
+		if (!*s)
+			return s;
+		c1 = &fn->con[*s];
+		if (c->type == c1->type
+		&& qbe_symeq(c->sym, c1->sym)
+		&& c->bits.i == c1->bits.i)
+			return s;
+	}
+}
 
-	for (i=1; i<fn->ncon; i++) {
-		c1 = &fn->con[i];
-		if (c0->type == c1->type
-		&& qbe_symeq(c0->sym, c1->sym)
-		&& c0->bits.i == c1->bits.i)
-			return CON(i);
+static void
+conindex(Fn *fn)
+{
+	uint n;
+	int *s;
+
+	if ((uint)fn->ncon >= fn->nconh / 2) {
+		for (n=fn->nconh ? fn->nconh : 64; n/2<=(uint)fn->ncon; n*=2)
+			;
+		fn->conh = qbe_alloc(n * sizeof fn->conh[0]);
+		fn->nconh = n;
+		fn->nconi = 0;
 	}
+	if (fn->nconi < 1)
+		fn->nconi = 1; /* UNDEF is never found */
+	for (; fn->nconi<fn->ncon; fn->nconi++) {
+		s = conslot(&fn->con[fn->nconi], fn);
+		if (!*s)
+			*s = fn->nconi;
+	}
+}
+
+Ref
+qbe_newcon(Con *c0, Fn *fn)
+{
+	int *s;
+
+	conindex(fn);
+	s = conslot(c0, fn);
+	if (*s)
+		return CON(*s);
 	qbe_vgrow(&fn->con, ++fn->ncon);
-	fn->con[i] = *c0;
-	return CON(i);
+	fn->con[fn->ncon-1] = *c0;
+	*s = fn->nconi++;
+	return CON(*s);
 }
 
+/* the integer constants have no symbol */
 Ref
 qbe_getcon(int64_t val, Fn *fn)
 {
-	int c;
+	Con c;
 
-	for (c=1; c<fn->ncon; c++)
-		if (fn->con[c].type == CBits
-		&& fn->con[c].bits.i == val)
-			return CON(c);
-	qbe_vgrow(&fn->con, ++fn->ncon);
-	fn->con[c] = (Con){.type = CBits, .bits.i = val};
-	return CON(c);
+	c = (Con){.type = CBits, .bits.i = val};
+	return qbe_newcon(&c, fn);
 }
+// Modification END
 
 int
 qbe_addcon(Con *c0, Con *c1)
@@ -482,6 +906,10 @@ MAKESURE(NBit_is_64, NBit == 64);
 inline static uint
 popcnt(bits b)
 {
+	// @shoumodip
+#if defined(__GNUC__) && (defined(__POPCNT__) || defined(__aarch64__))
+	return __builtin_popcountll(b);
+#else
 	b = (b & 0x5555555555555555) + ((b>>1) & 0x5555555555555555);
 	b = (b & 0x3333333333333333) + ((b>>2) & 0x3333333333333333);
 	b = (b & 0x0f0f0f0f0f0f0f0f) + ((b>>4) & 0x0f0f0f0f0f0f0f0f);
@@ -489,11 +917,16 @@ popcnt(bits b)
 	b += (b>>16);
 	b += (b>>32);
 	return b & 0xff;
+#endif
 }
 
 inline static int
 firstbit(bits b)
 {
+	// @shoumodip: Never called with 0, so the instruction is always defined
+#ifdef __GNUC__
+	return __builtin_ctzll(b);
+#else
 	int n;
 
 	n = 0;
@@ -515,18 +948,229 @@ firstbit(bits b)
 	}
 	n += (char[16]){4,0,1,0,2,0,1,0,3,0,1,0,2,0,1,0}[b & 0xf];
 	return n;
+#endif
+}
+
+// Modification BEGIN
+// Copyright (C) 2025 Shoumodip Kar <shoumodipkar@gmail.com>
+
+// The operations on sets of NBsVec words or more run vector kernels over the longest prefix of a
+// multiple of 4 words, and finish the rest one word at a time. On x86-64 the kernels are picked for
+// the processor once, AVX2 if it has it and SSE2 otherwise, which all of them have. Other
+// targets keep the word loops, as do most functions, which have sets of a few words. Counting uses
+// the popcnt instruction at any size, where there is one
+enum {
+	NBsVec = 8,
+};
+
+#if defined(__GNUC__) && defined(__x86_64__)
+
+#define VOR(p, s, x, y) p##_or_##s(x, y)
+#define VAND(p, s, x, y) p##_and_##s(x, y)
+#define VANDN(p, s, x, y) p##_andnot_##s(y, x)
+
+// The kernel is picked on the first call and kept, so that the later ones go straight to it
+#define BSVPICK(k, t, e)                                                     \
+	do {                                                                 \
+		k = __atomic_load_n(&t, __ATOMIC_RELAXED);                   \
+		if (!k) {                                                    \
+			k = e;                                               \
+			__atomic_store_n(&t, k, __ATOMIC_RELAXED);           \
+		}                                                            \
+	} while (0)
+
+typedef void Bsvop(bits *, bits *, uint);
+typedef int Bsvcmp(bits *, bits *, uint);
+typedef uint Bsvcnt(bits *, uint);
+
+#define BSVOP(f, op)                                                         \
+	static void                                                          \
+	f##sse2(bits *a, bits *b, uint n)                                    \
+	{                                                                    \
+		__m128i x, y;                                                \
+		uint i;                                                      \
+		                                                             \
+		for (i=0; i<n; i+=2) {                                       \
+			x = _mm_loadu_si128((__m128i *)&a[i]);               \
+			y = _mm_loadu_si128((__m128i *)&b[i]);               \
+			_mm_storeu_si128((__m128i *)&a[i], op(_mm, si128, x, y)); \
+		}                                                            \
+	}                                                                    \
+	                                                                     \
+	__attribute__((target("avx2"))) static void                          \
+	f##avx2(bits *a, bits *b, uint n)                                    \
+	{                                                                    \
+		__m256i x, y;                                                \
+		uint i;                                                      \
+		                                                             \
+		for (i=0; i<n; i+=4) {                                       \
+			x = _mm256_loadu_si256((__m256i *)&a[i]);            \
+			y = _mm256_loadu_si256((__m256i *)&b[i]);            \
+			_mm256_storeu_si256((__m256i *)&a[i], op(_mm256, si256, x, y)); \
+		}                                                            \
+	}                                                                    \
+	                                                                     \
+	static Bsvop *f##k;                                                  \
+	                                                                     \
+	static void                                                          \
+	f(bits *a, bits *b, uint n)                                          \
+	{                                                                    \
+		Bsvop *k;                                                    \
+		                                                             \
+		BSVPICK(k, f##k, __builtin_cpu_supports("avx2") ? f##avx2 : f##sse2); \
+		k(a, b, n);                                                  \
+	}
+
+BSVOP(bsvunion, VOR)
+BSVOP(bsvinter, VAND)
+BSVOP(bsvdiff, VANDN)
+
+static int
+bsvequalsse2(bits *a, bits *b, uint n)
+{
+	__m128i x, y;
+	uint i;
+
+	for (i=0; i<n; i+=2) {
+		x = _mm_loadu_si128((__m128i *)&a[i]);
+		y = _mm_loadu_si128((__m128i *)&b[i]);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xffff)
+			return 0;
+	}
+	return 1;
 }
 
+__attribute__((target("avx2"))) static int
+bsvequalavx2(bits *a, bits *b, uint n)
+{
+	__m256i x;
+	uint i;
+
+	for (i=0; i<n; i+=4) {
+		x = _mm256_xor_si256(
+			_mm256_loadu_si256((__m256i *)&a[i]),
+			_mm256_loadu_si256((__m256i *)&b[i]));
+		if (!_mm256_testz_si256(x, x))
+			return 0;
+	}
+	return 1;
+}
+
+static Bsvcmp *bsvequalk;
+
+static int
+bsvequal(bits *a, bits *b, uint n)
+{
+	Bsvcmp *k;
+
+	BSVPICK(k, bsvequalk, __builtin_cpu_supports("avx2") ? bsvequalavx2 : bsvequalsse2);
+	return k(a, b, n);
+}
+
+static uint
+bsvcountword(bits *a, uint n)
+{
+	uint i, c;
+
+	c = 0;
+	for (i=0; i<n; i++)
+		c += popcnt(a[i]);
+	return c;
+}
+
+__attribute__((target("popcnt"))) static uint
+bsvcountpopcnt(bits *a, uint n)
+{
+	uint i, c;
+
+	c = 0;
+	for (i=0; i<n; i++)
+		c += __builtin_popcountll(a[i]);
+	return c;
+}
+
+// The bits of every nibble are counted with a table, and summed up per word
+__attribute__((target("avx2,popcnt"))) static uint
+bsvcountavx2(bits *a, uint n)
+{
+	__m256i tab, low, sum, x, c;
+	uint i, m;
+
+	if (n < NBsVec)
+		return bsvcountpopcnt(a, n);
+	tab = _mm256_setr_epi8(
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	low = _mm256_set1_epi8(0x0f);
+	sum = _mm256_setzero_si256();
+	m = n & ~3u;
+	for (i=0; i<m; i+=4) {
+		x = _mm256_loadu_si256((__m256i *)&a[i]);
+		c = _mm256_add_epi8(
+			_mm256_shuffle_epi8(tab, _mm256_and_si256(x, low)),
+			_mm256_shuffle_epi8(tab, _mm256_and_si256(_mm256_srli_epi16(x, 4), low)));
+		sum = _mm256_add_epi64(sum, _mm256_sad_epu8(c, _mm256_setzero_si256()));
+	}
+	return _mm256_extract_epi64(sum, 0) + _mm256_extract_epi64(sum, 1)
+		+ _mm256_extract_epi64(sum, 2) + _mm256_extract_epi64(sum, 3)
+		+ bsvcountpopcnt(a + m, n - m);
+}
+
+static Bsvcnt *bsvcountk;
+
+static uint
+bsvcount(bits *a, uint n)
+{
+	Bsvcnt *k;
+
+	BSVPICK(k, bsvcountk,
+		!__builtin_cpu_supports("popcnt") ? bsvcountword
+		: __builtin_cpu_supports("avx2") ? bsvcountavx2
+		: bsvcountpopcnt);
+	return k(a, n);
+}
+
+#else
+
+#define BSVOP(f, op)                                                         \
+	static void                                                          \
+	f(bits *a, bits *b, uint n)                                          \
+	{                                                                    \
+		uint i;                                                      \
+		                                                             \
+		for (i=0; i<n; i++)                                          \
+			a[i] op b[i];                                        \
+	}
+
+BSVOP(bsvunion, |=)
+BSVOP(bsvinter, &=)
+BSVOP(bsvdiff, &= ~)
+
+static int
+bsvequal(bits *a, bits *b, uint n)
+{
+	return memcmp(a, b, n * sizeof a[0]) == 0;
+}
+
+static uint
+bsvcount(bits *a, uint n)
+{
+	uint i, c;
+
+	c = 0;
+	for (i=0; i<n; i++)
+		c += popcnt(a[i]);
+	return c;
+}
+
+#endif
+
 uint
 qbe_bscount(BSet *bs)
 {
-	uint i, n;
-
-	n = 0;
-	for (i=0; i<bs->nt; i++)
-		n += popcnt(bs->t[i]);
-	return n;
+	return bsvcount(bs->t, bs->nt);
 }
+// Modification END
 
 static inline uint
 bsmax(BSet *bs)
@@ -548,21 +1192,34 @@ qbe_bsclr(BSet *bs, uint elt)
 	bs->t[elt/NBit] &= ~BIT(elt%NBit);
 }
 
-#define BSOP(f, op)                           \
+// @shoumodip: With the kernels above NBsVec words
+#define BSOP(f, op, vf)                       \
 	void                                  \
 	f(BSet *a, BSet *b)                   \
 	{                                     \
 		uint i;                       \
 		                              \
 		assert(a->nt == b->nt);       \
-		for (i=0; i<a->nt; i++)       \
+		i = 0;                        \
+		if (a->nt >= NBsVec) {        \
+			i = a->nt & ~3u;      \
+			vf(a->t, b->t, i);    \
+		}                             \
+		for (; i<a->nt; i++)          \
 			a->t[i] op b->t[i];   \
 	}
 
-BSOP(qbe_bscopy, =)
-BSOP(qbe_bsunion, |=)
-BSOP(qbe_bsinter, &=)
-BSOP(qbe_bsdiff, &= ~)
+BSOP(qbe_bsunion, |=, bsvunion)
+BSOP(qbe_bsinter, &=, bsvinter)
+BSOP(qbe_bsdiff, &= ~, bsvdiff)
+
+// @shoumodip
+void
+qbe_bscopy(BSet *a, BSet *b)
+{
+	assert(a->nt == b->nt);
+	memcpy(a->t, b->t, a->nt * sizeof a->t[0]);
+}
 
 int
 qbe_bsequal(BSet *a, BSet *b)
@@ -570,7 +1227,14 @@ qbe_bsequal(BSet *a, BSet *b)
 	uint i;
 
 	assert(a->nt == b->nt);
-	for (i=0; i<a->nt; i++)
+	i = 0;
+	// @shoumodip
+	if (a->nt >= NBsVec) {
+		i = a->nt & ~3u;
+		if (!bsvequal(a->t, b->t, i))
+			return 0;
+	}
+	for (; i<a->nt; i++)
 		if (a->t[i] != b->t[i])
 			return 0;
 	return 1;